@@ -21,50 +21,35 @@
 
 #include "../common/common.h"
 #include "../cpu/cpu.h"
-#include "../external/nukedopl/opl3.h"
+#include "../external/nukedopl/opl3v.h"
 #include "../frontend/frontend.h"
 
 
 // audio enabled
 bool audio_enable;
+// the audio device clock paces emulation
+bool audio_clock;
 
 // audio sample rate
 static uint32_t _sample_rate;
 // cpu cycles per sample
 static uint32_t _cycles_per_sample;
 
-// event buffer mutex
-static SDL_mutex *_audio_mux;
-
-// pc speaker oscillator
-static uint32_t _spk_accum;
-static uint32_t _spk_delta;
-static bool     _spk_enable;
-static uint32_t _spk_freq;
-
 #if USE_AUDIO_ADLIB
 // adlib opl3
-opl3_chip _adlib_chip;
+opl3v_chip _adlib_chip;
 #endif
 
 // type of audio event
 enum audio_event_type_t {
   // none, but must render cycle_delta cycles
   event_none,
-  // pc speaker has updated
-  event_speaker,
   // adlib ym3812 event
   event_adlib,
   // floppy disk event
   event_floppy,
 };
 
-// pc speaker update
-struct audio_event_speaker_t {
-  bool enable;
-  uint16_t freq;
-};
-
 struct audio_event_adlib_t {
   uint8_t reg;
   uint8_t data;
@@ -78,7 +63,6 @@ struct audio_event_t {
   uint8_t type;
   // event data
   union {
-    struct audio_event_speaker_t spk;
     struct audio_event_adlib_t adlib;
   };
 };
@@ -86,48 +70,142 @@ struct audio_event_t {
 // last tick delta sent
 static uint64_t _last_update;
 
-// event ringbuffer
+// event ringbuffer, filled by the emulator and drained by the audio thread
+// without a lock as each index is only ever written by one side
 #define RING_SIZE 1024
 static struct audio_event_t _ring_data[RING_SIZE];
-static uint32_t _ring_head, _ring_tail;
+static volatile uint32_t _ring_head, _ring_tail;
+// running sums of the cycles queued and consumed so the audio thread can
+// tell how much is buffered without walking the ring
+static volatile uint32_t _cycles_in, _cycles_out;
 
 #define RING_GET(INDEX) _ring_data[(INDEX) & (RING_SIZE-1)]
 
+// events that did not fit in the ring, owned by the emulator and moved into
+// the ring in order as it drains so nothing is lost
+//
+// The backlog is capped so a stalled audio thread cannot eat all memory.
+// Once it is full, a write to an adlib register that is still waiting in
+// the backlog from the same slice just replaces the data.  Anything else
+// ends the slice early, and the emulator runs no more slices until the
+// audio thread has caught up, see audio_backlog_full().  An instruction
+// raises at most a couple of events, so the reserve past full is never
+// used up.
+#define BACKLOG_MAX (RING_SIZE * 16)
+#define BACKLOG_FULL (BACKLOG_MAX - RING_SIZE)
+static struct audio_event_t _backlog[BACKLOG_MAX];
+static uint32_t _backlog_head, _backlog_tail;
+// cycles of idle events folded into the next event while backlogged
+static uint32_t _carry_cycles;
+// last backlogged write to each adlib register, valid for one slice
+static uint32_t _backlog_reg[256];
+static uint32_t _backlog_reg_slice[256];
+static uint32_t _backlog_slice;
+
+#define BACKLOG_GET(INDEX) _backlog[(INDEX) & (BACKLOG_MAX-1)]
+
 static bool _pop_event(struct audio_event_t *out) {
-  assert(_audio_mux && out);
-  SDL_mutexP(_audio_mux);
+  assert(out);
+  const uint32_t tail = _ring_tail;
   // if ring is empty
-  if (&RING_GET(_ring_tail) == &RING_GET(_ring_head)) {
-    SDL_mutexV(_audio_mux);
+  if (tail == atomic_load_acquire(&_ring_head)) {
     return false;
   }
   // recv event
-  const struct audio_event_t *e = &RING_GET(_ring_tail++);
-  memcpy(out, e, sizeof(struct audio_event_t));
-  // success
-  SDL_mutexV(_audio_mux);
+  memcpy(out, &RING_GET(tail), sizeof(struct audio_event_t));
+  atomic_store_release(&_cycles_out, _cycles_out + out->cycle_delta);
+  // hand the slot back to the emulator
+  atomic_store_release(&_ring_tail, tail + 1);
   return true;
 }
 
-static bool _push_event(const struct audio_event_t *event) {
-  if (!audio_enable) {
-    return true;
-  }
-  assert(_audio_mux && event);
-  SDL_mutexP(_audio_mux);
+static bool _ring_push(const struct audio_event_t *event) {
+  const uint32_t head = _ring_head;
   // if ring is full
-  if (&RING_GET(_ring_head + 1) == &RING_GET(_ring_tail)) {
-    SDL_mutexV(_audio_mux);
+  if (head - atomic_load_acquire(&_ring_tail) >= RING_SIZE) {
     return false;
   }
   // send event
-  struct audio_event_t *e = &RING_GET(_ring_head++);
-  memcpy(e, event, sizeof(struct audio_event_t));
-  // success
-  SDL_mutexV(_audio_mux);
+  memcpy(&RING_GET(head), event, sizeof(struct audio_event_t));
+  atomic_store_release(&_ring_head, head + 1);
   return true;
 }
 
+// move as much of the backlog into the ring as will fit
+static void _backlog_flush(void) {
+  for (; _backlog_tail != _backlog_head; ++_backlog_tail) {
+    if (!_ring_push(&BACKLOG_GET(_backlog_tail))) {
+      return;
+    }
+  }
+}
+
+static uint32_t _backlog_count(void) {
+  return _backlog_head - _backlog_tail;
+}
+
+static void _backlog_push(const struct audio_event_t *event) {
+  // the slice ends once the backlog is full so the reserve always has room
+  assert(_backlog_count() < BACKLOG_MAX);
+  if (event->type == event_adlib) {
+    _backlog_reg[event->adlib.reg] = _backlog_head;
+    _backlog_reg_slice[event->adlib.reg] = _backlog_slice;
+  }
+  BACKLOG_GET(_backlog_head++) = *event;
+}
+
+// replace the data of a write to the same register still in the backlog
+// from this slice, the cycles of the event ride on the next one so no time
+// is lost
+static bool _backlog_coalesce(const struct audio_event_t *event) {
+  if (event->type != event_adlib) {
+    return false;
+  }
+  const uint8_t reg = event->adlib.reg;
+  const uint32_t pos = _backlog_reg[reg];
+  if (_backlog_reg_slice[reg] != _backlog_slice ||
+      pos - _backlog_tail >= _backlog_count()) {
+    return false;
+  }
+  struct audio_event_t *e = &BACKLOG_GET(pos);
+  if (e->type != event_adlib || e->adlib.reg != reg) {
+    return false;
+  }
+  e->adlib.data = event->adlib.data;
+  _carry_cycles = event->cycle_delta;
+  return true;
+}
+
+static void _push_event(const struct audio_event_t *event) {
+  if (!audio_enable) {
+    return;
+  }
+  assert(event);
+  struct audio_event_t e = *event;
+  e.cycle_delta += _carry_cycles;
+  _carry_cycles = 0;
+  // events must stay behind any that are already waiting
+  _backlog_flush();
+  if (_backlog_tail == _backlog_head && _ring_push(&e)) {
+    atomic_store_release(&_cycles_in, _cycles_in + e.cycle_delta);
+    return;
+  }
+  // an idle event only marks time passing so it can ride on the next one
+  if (e.type == event_none) {
+    _carry_cycles = e.cycle_delta;
+    return;
+  }
+  if (_backlog_count() >= BACKLOG_FULL) {
+    if (_backlog_coalesce(&e)) {
+      return;
+    }
+    // stop producing events until the audio thread has caught up
+    cpu_slice_end();
+  }
+  _backlog_push(&e);
+  atomic_store_release(&_cycles_in, _cycles_in + e.cycle_delta);
+}
+
 struct audio_adlib_t {
   uint8_t address;
   uint8_t status;
@@ -137,6 +215,8 @@ struct audio_adlib_t {
 static struct audio_adlib_t _adlib;
 
 static void push_event_adlib(const uint8_t addr, const uint8_t data) {
+  speaker_sync();
+  blaster_sync();
   struct audio_event_t event;
   const uint64_t new_update = cpu_slice_ticks();
   event.cycle_delta = (uint32_t)(new_update - _last_update);
@@ -144,9 +224,7 @@ static void push_event_adlib(const uint8_t addr, const uint8_t data) {
   event.type = event_adlib;
   event.adlib.reg = addr;
   event.adlib.data = data;
-  if (!_push_event(&event)) {
-    __debugbreak();
-  }
+  _push_event(&event);
 }
 
 static void adlib_port_write(uint16_t port, uint8_t value) {
@@ -172,38 +250,11 @@ static uint8_t adlib_port_read(uint16_t port) {
   }
 }
 
-void audio_init(uint32_t rate) {
-  // we shouldnt initalize otherwise
-  assert(audio_enable);
-
-  // create audio event stream mutex
-  _audio_mux = SDL_CreateMutex();
-  assert(_audio_mux);
-
-  _sample_rate = rate;
-  _cycles_per_sample = CYCLES_PER_SECOND / rate;
-
-#if USE_AUDIO_ADLIB
-  memset(&_adlib_chip, 0, sizeof(_adlib_chip));
-  OPL3_Reset(&_adlib_chip, rate);
-
-  set_port_read_redirector(0x388, 0x388, adlib_port_read);
-  set_port_write_redirector(0x388, 0x389, adlib_port_write);
-#endif
-}
-
-void audio_close(void) {
-  if (_audio_mux) {
-    SDL_DestroyMutex(_audio_mux);
-  }
-}
-
 static int32_t _pending_samples;
 
-static bool _at_spk_enable;
-static uint32_t _at_spk_freq;
-static uint32_t _at_spk_delta;
-static uint32_t _at_spk_accum;
+// cycles of the events taken but not yet rendered, the speaker bit stream
+// is read in step with them
+static uint32_t _pending_cycles;
 
 static uint32_t _at_adjust = 1000;
 
@@ -211,53 +262,91 @@ uint16_t _at_fd_accum;
 uint32_t _at_fd_enable;
 const uint32_t _at_fd_delta = (0xffff * 475) / 22100;
 
+// Synthesis runs on a worker thread that works through the event stream
+// and renders ahead into a ring of pcm, so that the audio callback only has
+// to mix and expensive opl3 synthesis never races the callback deadline.
+// The whole event timeline lives on the worker, not just the opl3, to keep
+// the speaker and floppy in step with it.  Each mixer source has its own
+// plane of interleaved stereo in the ring so the callback can mix straight
+// out of it.
+#define PCM_RING 4096
+static int16_t _pcm[MIXER_NUM_SOURCES][PCM_RING * 2];
+// in stereo frames, written by the worker and callback only
+static volatile uint32_t _pcm_head, _pcm_tail;
+// frames to render ahead of the callback
+static uint32_t _lookahead;
+// per source, the frame after the last one rendered with sound in it, so the
+// callback can pass over sources that are silent for all it has to mix
+static volatile uint32_t _pcm_loud[MIXER_NUM_SOURCES];
+
+// rendering on the emulator thread to a file rather than to a device
+static bool _offline;
+
+static SDL_Thread *_synth_thread;
+static SDL_sem *_synth_wake;
+static volatile uint32_t _synth_quit;
+static uint32_t _underruns;
+
+// When the audio clock is the timebase the emulator runs only the cycles
+// the device has played since, keeping the events a lookahead in front of
+// it, so there is no rate to adjust and the ring neither drains nor fills.
+// frames handed to the device, written by the callback only
+static volatile uint32_t _clock_frames;
+static uint32_t _clock_seen, _clock_frac;
+// cycles the emulator can run before it gets ahead of the device
+static uint32_t _clock_due;
+static SDL_sem *_clock_wake;
+
 uint32_t cycles_to_samples(uint32_t cycles) {
   const uint32_t todo = (cycles * _sample_rate) / CYCLES_PER_SECOND;
   return (todo * _at_adjust) / 1000;
 }
 
-static void _next_event(void) {
+// as cycles_to_samples but carrying the remainder on to the next event, so
+// that no time is lost however finely the events divide it
+static uint32_t _sample_frac;
+static uint32_t _event_samples(const uint32_t cycles) {
+  const uint64_t den = (uint64_t)CYCLES_PER_SECOND * 1000;
+  const uint64_t num = (uint64_t)cycles * _sample_rate * _at_adjust +
+                       _sample_frac;
+  _sample_frac = (uint32_t)(num % den);
+  return (uint32_t)(num / den);
+}
+
+static bool _next_event(void) {
   struct audio_event_t event;
   if (!_pop_event(&event)) {
-    return;
+    return false;
   }
 
-  _pending_samples += cycles_to_samples(event.cycle_delta);
+  _pending_samples += _event_samples(event.cycle_delta);
+  _pending_cycles += event.cycle_delta;
 
   switch (event.type) {
-  case event_speaker:
-    _at_spk_enable = event.spk.enable;
-    _at_spk_freq = event.spk.freq;
-    _at_spk_delta = ((uint64_t)_at_spk_freq * (uint64_t)0xffffffff / _sample_rate);
-    break;
   case event_adlib:
-    OPL3_WriteRegBuffered(&_adlib_chip, event.adlib.reg, event.adlib.data);
+    OPL3V_WriteRegBuffered(&_adlib_chip, event.adlib.reg, event.adlib.data);
     break;
   case event_floppy:
     _at_fd_enable = (_sample_rate * 5) / 1000;
     break;
   }
+  return true;
 }
 
 static uint32_t last_eval = 0;
 
 void adjust_rate(void) {
-  SDL_mutexP(_audio_mux);
 
   // check remaining cycles in buffer
-  uint64_t accum = 0;
-  uint32_t i = _ring_tail;
-  for (;&RING_GET(i) != &RING_GET(_ring_head); ++i) {
-    accum += RING_GET(i).cycle_delta;
-  }
+  const uint32_t accum = atomic_load_acquire(&_cycles_in) - _cycles_out;
 
-  // target number of samples we want in the buffer
-  const uint32_t target_samples = _sample_rate / 100;
+  // samples rendered ahead also count as buffered
+  const uint32_t ahead = _pcm_head - atomic_load_acquire(&_pcm_tail);
 
   // adjust based on samples left in the buffer
-  const uint32_t samples = cycles_to_samples((uint32_t)accum);
-  _at_adjust -= (samples > target_samples);
-  _at_adjust += (samples < target_samples);
+  const uint32_t samples = cycles_to_samples((uint32_t)accum) + ahead;
+  _at_adjust -= (samples > _lookahead);
+  _at_adjust += (samples < _lookahead);
 
 #if 0
   printf("adjust %d\n", _at_adjust);
@@ -266,111 +355,265 @@ void adjust_rate(void) {
   // limit to +/- 10%
   _at_adjust = SDL_min(_at_adjust, 1100);
   _at_adjust = SDL_max(_at_adjust, 900);
-
-  SDL_mutexV(_audio_mux);
 }
 
-uint32_t audio_callback(int16_t *samples, uint32_t num_samples) {
+// render `frames` stereo frames of each source into the ring at `head`,
+// covering `cycles` of emulated time, silent sources are filled with zeros
+// rather than synthesised
+static void _synth_render(const uint32_t head, const uint32_t frames,
+                          const uint32_t cycles) {
+  const uint32_t pos = head & (PCM_RING - 1);
+  int16_t *dst;
 
-  // TODO: we should use a 32bit mixdown buffer here and use some nice
-  //       SSE clipping, etc.
+  dst = &_pcm[MIXER_ADLIB][pos * 2];
+#if USE_AUDIO_ADLIB
+  // with nothing keyed on the chip stays silent until the next register
+  // write, which is applied between renders so synthesis resumes on time
+  if (!OPL3V_IsIdle(&_adlib_chip)) {
+    OPL3V_GenerateStream(&_adlib_chip, dst, frames);
+    atomic_store_release(&_pcm_loud[MIXER_ADLIB], head + frames);
+  }
+  else {
+    OPL3V_SkipStream(&_adlib_chip, frames);
+    memset(dst, 0, frames * 2 * sizeof(int16_t));
+  }
+#else
+  memset(dst, 0, frames * 2 * sizeof(int16_t));
+#endif
 
-  // rapid quit when not running (system is going down)
-  if (!cpu_running) {
-    return num_samples;
+  dst = &_pcm[MIXER_SPEAKER][pos * 2];
+#if USE_AUDIO_SPEAKER
+  if (speaker_render(dst, frames, cycles)) {
+    atomic_store_release(&_pcm_loud[MIXER_SPEAKER], head + frames);
+  }
+#else
+  memset(dst, 0, frames * 2 * sizeof(int16_t));
+#endif
+
+  dst = &_pcm[MIXER_FLOPPY][pos * 2];
+  memset(dst, 0, frames * 2 * sizeof(int16_t));
+#if USE_AUDIO_FLOPPY
+  if (_at_fd_enable) {
+    atomic_store_release(&_pcm_loud[MIXER_FLOPPY], head + frames);
   }
+  for (uint32_t i = 0; i < frames * 2; i += 2) {
+    _at_fd_enable -= (_at_fd_enable > 0);
+    if (_at_fd_enable == 0) {
+      break;
+    }
+    _at_fd_accum += _at_fd_delta;
+    const int16_t out = (_at_fd_accum & 0x8000) ? -0x0800 : 0x800;
+    // fill left and right
+    dst[i + 0] = out;
+    dst[i + 1] = out;
+  }
+#endif
 
+  dst = &_pcm[MIXER_BLASTER][pos * 2];
+#if USE_AUDIO_BLASTER
+  if (blaster_render(dst, frames, cycles)) {
+    atomic_store_release(&_pcm_loud[MIXER_BLASTER], head + frames);
+  }
+#else
+  memset(dst, 0, frames * 2 * sizeof(int16_t));
+#endif
+}
+
+// render as far ahead as the event stream and lookahead allow
+static void _synth_run(void) {
   // todo: make this sample based
-  if (!cpu_halt) {
+  // offline rendering keeps to emulated time so is never adjusted
+  if (!cpu_halt && !_offline && !audio_clock) {
     const uint32_t next_eval = SDL_GetTicks();
     if ((next_eval - last_eval) > 10) {
       adjust_rate();
       last_eval = next_eval;
     }
   }
-  else {
-    // just keep rendering as we can
-    _pending_samples = num_samples / 2;
+  for (;;) {
+    const uint32_t head = _pcm_head;
+    const uint32_t ahead = head - atomic_load_acquire(&_pcm_tail);
+    if (ahead >= _lookahead) {
+      break;
+    }
+    if (cpu_halt && !_offline) {
+      // just keep rendering as we can
+      _pending_samples = _lookahead - ahead;
+    }
+    // if there are no more samples to render
+    if (_pending_samples == 0) {
+      // get the next event
+      if (!_next_event()) {
+        break;
+      }
+      continue;
+    }
+    // stop at the end of the ring so each source renders in one span
+    const uint32_t pos = head & (PCM_RING - 1);
+    uint32_t to_do = SDL_min((uint32_t)_pending_samples, _lookahead - ahead);
+    to_do = SDL_min(to_do, PCM_RING - pos);
+    // these frames cover their share of the pending cycles
+    const uint32_t cycles =
+      (uint32_t)(((uint64_t)_pending_cycles * to_do) / _pending_samples);
+    _pending_cycles -= cycles;
+    _synth_render(head, to_do, cycles);
+    _pending_samples -= to_do;
+    atomic_store_release(&_pcm_head, head + to_do);
   }
+}
 
-  // if there are no more samples to render
-  if (_pending_samples == 0) {
-    // get the next event
-    _next_event();
+static int _synth_thread_main(void *arg) {
+  while (!atomic_load_acquire(&_synth_quit)) {
+    _synth_run();
+    // woken by the callback, the timeout picks up new events
+    SDL_SemWaitTimeout(_synth_wake, 2);
   }
-  // number of samples we should render
-  const int32_t to_do = SDL_min(_pending_samples * 2, (int32_t)num_samples);
-  _pending_samples -= to_do / 2;
+  return 0;
+}
 
-  // wipe our buffer
-  memset(samples, 0, to_do * sizeof(uint16_t));
+static void _audio_setup(uint32_t rate) {
+  // we shouldnt initalize otherwise
+  assert(audio_enable);
+
+  _sample_rate = rate;
+  _cycles_per_sample = CYCLES_PER_SECOND / rate;
+  // 30ms, enough to ride out a slice of events arriving at once
+  _lookahead = SDL_min((rate * 3) / 100, PCM_RING);
+
+#if USE_AUDIO_SPEAKER
+  speaker_init(rate);
+#endif
+
+#if USE_AUDIO_BLASTER
+  blaster_audio_init(rate);
+#endif
 
 #if USE_AUDIO_ADLIB
-  if (to_do) {
-    OPL3_GenerateStream(&_adlib_chip, samples, to_do / 2);
-  }
+  memset(&_adlib_chip, 0, sizeof(_adlib_chip));
+  OPL3V_Reset(&_adlib_chip, rate);
+
+  set_port_read_redirector(0x388, 0x388, adlib_port_read);
+  set_port_write_redirector(0x388, 0x389, adlib_port_write);
 #endif
+}
 
-#if USE_AUDIO_SPEAKER
-  // render internal speaker
-  if (_at_spk_freq > 10 && _at_spk_freq < 18000) {
-    if (_at_spk_enable) {
-      for (int32_t i = 0; i < to_do; i += 2) {
-        const int16_t out = (_at_spk_accum & 0x80000000) ? -0x7000 : 0x7000;
-        _at_spk_accum += _at_spk_delta;
-        // fill left and right
-        samples[i + 0] += out;
-        samples[i + 1] += out;
-      }
-    }
+void audio_init(uint32_t rate) {
+  _audio_setup(rate);
+  if (audio_clock) {
+    _clock_wake = SDL_CreateSemaphore(0);
+    // start with a full lookahead to render
+    _clock_due = (uint32_t)(((uint64_t)_lookahead * CYCLES_PER_SECOND) / rate);
   }
-#endif
+  _synth_wake = SDL_CreateSemaphore(0);
+  _synth_thread = _synth_wake ?
+                  SDL_CreateThread(_synth_thread_main, NULL) : NULL;
+  if (!_synth_thread) {
+    log_printf(LOG_CHAN_AUDIO, "unable to start audio thread");
+    // nothing would drain the events, and the backlog would stop emulation
+    audio_enable = false;
+  }
+}
 
-#if USE_AUDIO_FLOPPY
-  for (int32_t i = 0; i < to_do; i += 2) {
-    _at_fd_enable -= (_at_fd_enable > 0);
-    if (_at_fd_enable == 0) {
-      break;
-    }
-    _at_fd_accum += _at_fd_delta;
-    const int16_t out = (_at_fd_accum & 0x8000) ? -0x0800 : 0x800;
-    // fill left and right
-    samples[i + 0] += out;
-    samples[i + 1] += out;
+void audio_init_offline(uint32_t rate) {
+  _offline = true;
+  _audio_setup(rate);
+}
+
+void audio_close(void) {
+  if (_synth_thread) {
+    atomic_store_release(&_synth_quit, 1);
+    SDL_SemPost(_synth_wake);
+    SDL_WaitThread(_synth_thread, NULL);
+    _synth_thread = NULL;
+    log_printf(LOG_CHAN_AUDIO, "%u audio underruns", _underruns);
   }
+#if USE_AUDIO_SPEAKER
+  speaker_close();
 #endif
-
-  return to_do;
+#if USE_AUDIO_BLASTER
+  blaster_audio_close();
+#endif
+  if (_synth_wake) {
+    SDL_DestroySemaphore(_synth_wake);
+    _synth_wake = NULL;
+  }
+  if (_clock_wake) {
+    SDL_DestroySemaphore(_clock_wake);
+    _clock_wake = NULL;
+  }
+  _backlog_head = _backlog_tail = 0;
+  _sample_frac = 0;
+  _offline = false;
 }
 
-static void push_event_spk(void) {
-  struct audio_event_t event;
-  const uint64_t new_update = cpu_slice_ticks();
-  event.cycle_delta = (uint32_t)(new_update - _last_update);
-  _last_update = new_update;
-  event.type = event_speaker;
-  event.spk.freq = _spk_freq;
-  event.spk.enable = _spk_enable;
-  if (!_push_event(&event)) {
-//    log_printf(LOG_CHAN_AUDIO, "dropped audio event");
+// mix `count` samples out of the pcm ring, returns the frames that were
+// ready, anything past them is silent
+static uint32_t _audio_mix(int16_t *samples, const uint32_t count) {
+  const uint32_t tail = _pcm_tail;
+  const uint32_t ready = atomic_load_acquire(&_pcm_head) - tail;
+  const uint32_t frames = SDL_min(count / 2, ready);
+
+  // only sources that made a sound since the tail need mixing
+  bool loud[MIXER_NUM_SOURCES];
+  bool any = false;
+  for (int i = 0; i < MIXER_NUM_SOURCES; ++i) {
+    loud[i] = (int32_t)(atomic_load_acquire(&_pcm_loud[i]) - tail) > 0;
+    any |= loud[i];
+  }
+
+  if (any) {
+    int32_t *mix = mixer_begin(count);
+    // mix what the worker has rendered, in two spans if it wraps the ring
+    for (uint32_t done = 0; done < frames;) {
+      const uint32_t pos = (tail + done) & (PCM_RING - 1);
+      const uint32_t span = SDL_min(frames - done, PCM_RING - pos);
+      for (int i = 0; i < MIXER_NUM_SOURCES; ++i) {
+        if (loud[i]) {
+          mixer_add(mix + done * 2, &_pcm[i][pos * 2], span * 2,
+                    (enum mixer_source_t)i);
+        }
+      }
+      done += span;
+    }
+    mixer_end(samples, mix, count);
+  }
+  else {
+    memset(samples, 0, count * sizeof(int16_t));
   }
+  atomic_store_release(&_pcm_tail, tail + frames);
+  return frames;
 }
 
-void audio_pc_speaker_freq(const uint32_t freq) {
-  _spk_freq = freq;
-  push_event_spk();
+uint32_t audio_callback(int16_t *samples, uint32_t num_samples) {
 
-  if (_sample_rate == 0) {
-    return;
+  // rapid quit when not running (system is going down)
+  if (!cpu_running) {
+    return num_samples;
+  }
+
+  const uint32_t count = SDL_min(num_samples, MIXER_MAX_SAMPLES);
+  const uint32_t frames = _audio_mix(samples, count);
+  SDL_SemPost(_synth_wake);
+
+  // the device has played these whether or not they were ready in time
+  if (_clock_wake) {
+    atomic_store_release(&_clock_frames, _clock_frames + count / 2);
+    SDL_SemPost(_clock_wake);
   }
 
-  // set per sample oscillator delta
-  _spk_delta = ((uint64_t)freq * (uint64_t)0xffffffff / (uint64_t)_sample_rate);
+  // the worker fell behind, the rest of the mixdown stays silent
+  _underruns += (frames < count / 2);
+
+  return count;
 }
 
-void audio_pc_speaker_enable(bool enable) {
-  _spk_enable = enable;
-  push_event_spk();
+uint32_t audio_render(int16_t *samples, uint32_t num_samples) {
+  assert(_offline);
+  _synth_run();
+  const uint32_t ready = _pcm_head - _pcm_tail;
+  const uint32_t todo = SDL_min(num_samples, MIXER_MAX_SAMPLES) & ~1u;
+  const uint32_t count = SDL_min(todo, ready * 2);
+  return count ? _audio_mix(samples, count) * 2 : 0;
 }
 
 void audio_tick(const uint64_t cycles) {
@@ -380,6 +623,12 @@ void audio_tick(const uint64_t cycles) {
 
   assert(_last_update <= cycles);
 
+  speaker_tick(cycles);
+
+  if (audio_clock) {
+    _clock_due -= (uint32_t)SDL_min(cycles, (uint64_t)_clock_due);
+  }
+
   struct audio_event_t event;
   event.cycle_delta = (uint32_t)(cycles - _last_update);
   event.type = event_none;
@@ -388,17 +637,57 @@ void audio_tick(const uint64_t cycles) {
   if (event.cycle_delta) {
     _push_event(&event);
   }
+  else {
+    _backlog_flush();
+  }
 
   _last_update = 0;
+  // adlib writes in later slices are never merged with these
+  ++_backlog_slice;
+}
+
+bool audio_backlog_full(void) {
+  if (!audio_enable) {
+    return false;
+  }
+  _backlog_flush();
+  if (_backlog_count() < BACKLOG_FULL) {
+    return false;
+  }
+  // the audio thread has fallen far behind, hurry it along
+  if (_synth_wake) {
+    SDL_SemPost(_synth_wake);
+  }
+  return true;
+}
+
+uint32_t audio_clock_due(void) {
+  const uint32_t frames = atomic_load_acquire(&_clock_frames);
+  const uint64_t num = (uint64_t)(frames - _clock_seen) * CYCLES_PER_SECOND +
+                       _clock_frac;
+  _clock_seen = frames;
+  _clock_frac = (uint32_t)(num % _sample_rate);
+  // never try to catch up past the lookahead, as after the cpu was halted or
+  // the host fell behind, it would only overrun the ring
+  const uint64_t limit =
+    ((uint64_t)_lookahead * CYCLES_PER_SECOND) / _sample_rate;
+  _clock_due = (uint32_t)SDL_min(_clock_due + num / _sample_rate, limit);
+  return _clock_due;
+}
+
+void audio_clock_wait(void) {
+  if (_clock_wake) {
+    SDL_SemWaitTimeout(_clock_wake, 10);
+  }
 }
 
 void audio_disk_seek(const uint32_t sects) {
+  speaker_sync();
+  blaster_sync();
   struct audio_event_t event;
   const uint64_t new_update = cpu_slice_ticks();
   event.cycle_delta = (uint32_t)(new_update - _last_update);
   _last_update = new_update;
   event.type = event_floppy;
-  if (!_push_event(&event)) {
-//    log_printf(LOG_CHAN_AUDIO, "dropped audio event");
-  }
+  _push_event(&event);
 }
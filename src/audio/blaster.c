@@ -0,0 +1,500 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Sound Blaster.
+//
+// The DSP of a Sound Blaster 2.0 at ports 0x220 to 0x22F, playing 8bit
+// samples written directly or by single cycle and auto init dma on channel
+// 1, with an irq at the end of each block.  The dsp takes a sample from the
+// dma controller at every tick of its time constant, but rather than move
+// each byte as it plays the emulator pulls all those that have fallen due
+// in one block with i8237_read_block(), whenever the dsp is accessed and at
+// the end of each slice.  The main loop ends a slice where a block runs out
+// so that its irq is raised on time.
+//
+// The dac output goes to the audio thread through a ring of its own, as
+// runs of a level lasting some number of cycles.  The audio thread averages
+// the runs over each output sample and, as for the speaker, reads them at
+// a steady rate that is only slowly pulled into line with the event
+// timeline so that the rate adjustment does not bend the pitch.
+
+#include "../common/common.h"
+#include "../cpu/cpu.h"
+
+
+#define SB_PORT 0x220
+#define SB_DMA 1
+// runs in the ring, ~370ms of 44khz samples
+#define SB_RUNS 16384
+// longest run in 16.8 cycles
+#define SB_RUN_MAX 0xffffff
+// cycles the output stays behind the read position, so that the runs it
+// needs have been sent even when reading runs a little ahead of the timeline
+#define SB_DELAY 4096
+// 8bit samples come out at +/-0x6000, the same as the speaker
+#define SB_AMP 0xc0
+
+enum {
+  DMA_IDLE,
+  DMA_SINGLE,
+  DMA_AUTO,
+  // a block timed as dma but played as silence, without any transfer
+  DMA_SILENCE,
+};
+
+// params
+uint8_t blaster_irq = 7;
+
+static uint32_t _runs[SB_RUNS];
+// in runs, each written only by one side
+static volatile uint32_t _runs_head, _runs_tail;
+static bool _enabled;
+
+// ---- emulator side
+
+// reset line, held high
+static bool _reset;
+// bytes waiting at the read data port
+static uint8_t _out[16];
+static uint32_t _out_head, _out_tail;
+// command being collected and its arguments
+static uint8_t _cmd;
+static uint8_t _args[2];
+static uint32_t _nargs, _need;
+static uint8_t _test;
+static bool _speaker;
+static uint8_t _dac;
+static uint8_t _dma;
+static bool _paused, _exit_auto;
+// samples left in this block, and the block size for auto init
+static uint32_t _block, _block_len;
+// cycles per sample, 24.8 fixed point
+static int64_t _period;
+// next sample and the point up to which the output has been recorded, in
+// 24.8 cycles of the slice
+static int64_t _next;
+static int64_t _cursor;
+// run not yet sent
+static uint8_t _run_level;
+static uint32_t _run_len;
+static uint32_t _dropped;
+
+// ---- audio side
+
+// start of the run at the tail, in 24.8 cycles of the stream
+static uint64_t _run_start;
+// level of the last run read, held while no more have been sent
+static int32_t _hold;
+// cycles of the event timeline that have been rendered
+static uint64_t _target;
+// cycles of the stream that have been read, 24.8 fixed point
+static uint64_t _read;
+// cycles per output sample, 24.8 fixed point
+static int64_t _step;
+static uint32_t _rate;
+// dc blocker state, `_hp_y` has 8 fractional bits
+static int32_t _hp_x, _hp_y;
+static int32_t _hp_r;
+
+
+static void _put_word(const uint32_t word) {
+  const uint32_t head = _runs_head;
+  // a run lost when the audio thread has fallen this far behind shortens
+  // the stream, the read position jumps back into step soon after
+  if (head - atomic_load_acquire(&_runs_tail) >= SB_RUNS) {
+    ++_dropped;
+    return;
+  }
+  _runs[head & (SB_RUNS - 1)] = word;
+  atomic_store_release(&_runs_head, head + 1);
+}
+
+static void _flush_run(void) {
+  if (_run_len) {
+    _put_word((_run_len << 8) | _run_level);
+    _run_len = 0;
+  }
+}
+
+// append `len` 24.8 cycles of the output at `level`
+static void _put_run(const uint8_t level, int64_t len) {
+  if (!_enabled || len <= 0) {
+    return;
+  }
+  if (level != _run_level) {
+    _flush_run();
+    _run_level = level;
+  }
+  while (len) {
+    const uint32_t take =
+      (uint32_t)SDL_min(len, (int64_t)(SB_RUN_MAX - _run_len));
+    _run_len += take;
+    len -= take;
+    if (_run_len == SB_RUN_MAX) {
+      _flush_run();
+    }
+  }
+}
+
+// the dac level as it reaches the output, which the speaker switch mutes
+static uint8_t _level(void) {
+  return _speaker ? _dac : 0x80;
+}
+
+static bool _dma_active(void) {
+  return _dma != DMA_IDLE && !_paused;
+}
+
+static void _block_end(void) {
+  i8259_doirq(blaster_irq);
+  if (_dma == DMA_AUTO && !_exit_auto) {
+    _block = _block_len;
+  }
+  else {
+    _dma = DMA_IDLE;
+  }
+}
+
+// play the dsp from the cursor up to `cycle` in the slice
+static void _fill_to(const int32_t cycle) {
+  const int64_t end = (int64_t)cycle << 8;
+  while (_cursor < end) {
+    if (!_dma_active() || _next >= end) {
+      _put_run(_level(), end - _cursor);
+      _cursor = end;
+      break;
+    }
+    // the samples due before `end`, taken from the dma controller in one go
+    uint8_t buf[256];
+    uint32_t due = (uint32_t)((end - 1 - _next) / _period) + 1;
+    due = SDL_min(SDL_min(due, _block), (uint32_t)sizeof(buf));
+    uint32_t got = due;
+    if (_dma == DMA_SILENCE) {
+      memset(buf, 0x80, due);
+    }
+    else {
+      got = i8237_read_block(SB_DMA, buf, due);
+    }
+    for (uint32_t i = 0; i < got; ++i) {
+      _put_run(_level(), _next - _cursor);
+      _cursor = _next;
+      _dac = buf[i];
+      _next += _period;
+    }
+    // the dsp waits on a masked or finished channel, but keeps its clock
+    _next += (int64_t)(due - got) * _period;
+    _block -= got;
+    if (_block == 0) {
+      _block_end();
+    }
+  }
+}
+
+void blaster_sync(void) {
+  _fill_to((int32_t)cpu_slice_ticks());
+}
+
+void blaster_tick(const uint64_t cycles) {
+  _fill_to((int32_t)cycles);
+  _flush_run();
+  // the next slice counts from zero
+  _cursor -= (int64_t)cycles << 8;
+  _next -= (int64_t)cycles << 8;
+}
+
+int64_t blaster_cycles_before_irq(void) {
+  if (!_dma_active() || _block == 0) {
+    return 0xffffff;
+  }
+  // the slice must end just past the last sample of the block
+  const int64_t last = _next + (int64_t)(_block - 1) * _period;
+  return SDL_max((last >> 8) + 1, 1);
+}
+
+static void _out_push(const uint8_t value) {
+  if (_out_head - _out_tail < sizeof(_out)) {
+    _out[_out_head++ & (sizeof(_out) - 1)] = value;
+  }
+}
+
+static void _dsp_reset(void) {
+  _dma = DMA_IDLE;
+  _paused = _exit_auto = false;
+  _block = 0;
+  _speaker = false;
+  _dac = 0x80;
+  _need = _nargs = 0;
+  _out_head = _out_tail = 0;
+  _out_push(0xaa);
+}
+
+static void _dma_start(const uint8_t mode, const uint32_t length) {
+  _dma = mode;
+  _block = length;
+  _paused = _exit_auto = false;
+  // the first sample is taken straight away
+  _next = _cursor;
+}
+
+// arguments each command takes
+static uint32_t _dsp_args(const uint8_t cmd) {
+  switch (cmd) {
+  case 0x10: // direct dac
+  case 0x40: // time constant
+  case 0xe0: // identify
+  case 0xe4: // write test register
+    return 1;
+  case 0x14: // single cycle dma
+  case 0x48: // block size
+  case 0x80: // silence
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+static void _dsp_command(void) {
+  const uint32_t length = (_args[0] | ((uint32_t)_args[1] << 8)) + 1;
+  switch (_cmd) {
+  case 0x10:
+    _dac = _args[0];
+    break;
+  case 0x14:
+    _dma_start(DMA_SINGLE, length);
+    break;
+  case 0x1c: // auto init dma
+    _dma_start(DMA_AUTO, _block_len);
+    break;
+  case 0x20: // direct adc, nothing is plugged in
+    _out_push(0x80);
+    break;
+  case 0x40:
+    _period = ((int64_t)(256 - _args[0]) * CYCLES_PER_SECOND << 8) / 1000000;
+    break;
+  case 0x48:
+    _block_len = length;
+    break;
+  case 0x80:
+    _dma_start(DMA_SILENCE, length);
+    break;
+  case 0x90: // high speed auto init dma
+    _dma_start(DMA_AUTO, _block_len);
+    break;
+  case 0x91: // high speed single cycle dma
+    _dma_start(DMA_SINGLE, _block_len);
+    break;
+  case 0xd0: // halt dma
+    _paused = true;
+    break;
+  case 0xd1: // speaker on
+    _speaker = true;
+    break;
+  case 0xd3: // speaker off
+    _speaker = false;
+    break;
+  case 0xd4: // continue dma
+    if (_paused) {
+      _paused = false;
+      _next = _cursor;
+    }
+    break;
+  case 0xd8: // speaker status
+    _out_push(_speaker ? 0xff : 0x00);
+    break;
+  case 0xda: // exit auto init after this block
+    _exit_auto = true;
+    break;
+  case 0xe0:
+    _out_push(~_args[0]);
+    break;
+  case 0xe1: // version 2.01
+    _out_push(0x02);
+    _out_push(0x01);
+    break;
+  case 0xe4:
+    _test = _args[0];
+    break;
+  case 0xe8: // read test register
+    _out_push(_test);
+    break;
+  case 0xf2: // force irq
+    i8259_doirq(blaster_irq);
+    break;
+  default:
+    log_printf(LOG_CHAN_AUDIO, "unknown dsp command %02x", _cmd);
+    break;
+  }
+}
+
+static void blaster_port_write(uint16_t port, uint8_t value) {
+  _fill_to((int32_t)cpu_slice_ticks());
+  switch (port & 0xf) {
+  case 0x6: // reset, on the falling edge
+    if (_reset && !(value & 1)) {
+      _dsp_reset();
+    }
+    _reset = value & 1;
+    break;
+  case 0xc: // command and data
+    if (_need) {
+      _args[_nargs++] = value;
+      if (_nargs == _need) {
+        _need = 0;
+        _dsp_command();
+      }
+      break;
+    }
+    _cmd = value;
+    _nargs = 0;
+    _need = _dsp_args(value);
+    if (!_need) {
+      _dsp_command();
+    }
+    break;
+  }
+}
+
+static uint8_t blaster_port_read(uint16_t port) {
+  _fill_to((int32_t)cpu_slice_ticks());
+  switch (port & 0xf) {
+  case 0xa: // read data, the last byte repeats once they run out
+    if (_out_head != _out_tail) {
+      ++_out_tail;
+    }
+    return _out[(_out_tail - 1) & (sizeof(_out) - 1)];
+  case 0xc: // write status, always ready
+    return 0x7f;
+  case 0xe: // read status, bit 7 while data is waiting
+    return (_out_head != _out_tail) ? 0xff : 0x7f;
+  default:
+    return 0xff;
+  }
+}
+
+void blaster_init(void) {
+  _reset = false;
+  _dsp_reset();
+  _out_head = _out_tail = 0;
+  _test = 0;
+  // 22khz until told otherwise
+  _period = ((int64_t)(256 - 211) * CYCLES_PER_SECOND << 8) / 1000000;
+  _block_len = 0x800;
+  _cursor = _next = 0;
+  set_port_read_redirector(SB_PORT, SB_PORT + 0xf, blaster_port_read);
+  set_port_write_redirector(SB_PORT, SB_PORT + 0xf, blaster_port_write);
+}
+
+void blaster_audio_init(const uint32_t rate) {
+  // dc blocker pole for a corner of about 20Hz, 1 - 2 * pi * 20 / rate
+  _hp_r = 65536 - (int32_t)(8235417u / rate);
+  _hp_x = _hp_y = 0;
+
+  _runs_head = _runs_tail = 0;
+  // the stream starts a delay into the read position
+  _run_start = (uint64_t)SB_DELAY << 8;
+  _hold = 0;
+  _target = 0;
+  _read = 0;
+  _rate = rate;
+  _step = ((int64_t)CYCLES_PER_SECOND << 8) / rate;
+  _run_len = 0;
+  _enabled = true;
+}
+
+void blaster_audio_close(void) {
+  if (_dropped) {
+    log_printf(LOG_CHAN_AUDIO, "%u blaster runs dropped", _dropped);
+  }
+  _enabled = false;
+}
+
+// the level summed over [a, b) of the stream, consuming the runs before it
+static int64_t _level_sum(uint64_t a, const uint64_t b, uint32_t *tail,
+                          const uint32_t head) {
+  int64_t sum = 0;
+  while (a < b) {
+    // before the stream starts, or past what has been sent
+    if (a < _run_start || *tail == head) {
+      const uint64_t upto = (a < _run_start) ? SDL_min(b, _run_start) : b;
+      sum += (int64_t)_hold * (int64_t)(upto - a);
+      a = upto;
+      continue;
+    }
+    const uint32_t run = _runs[*tail & (SB_RUNS - 1)];
+    const uint64_t end = _run_start + (run >> 8);
+    const int32_t level = (int32_t)(run & 0xff) - 0x80;
+    if (end <= a) {
+      _run_start = end;
+      _hold = level;
+      ++*tail;
+      continue;
+    }
+    const uint64_t upto = SDL_min(end, b);
+    sum += (int64_t)level * (int64_t)(upto - a);
+    a = upto;
+  }
+  return sum;
+}
+
+bool blaster_render(int16_t *dst, const uint32_t frames,
+                    const uint32_t cycles) {
+  const uint32_t head = atomic_load_acquire(&_runs_head);
+  uint32_t tail = _runs_tail;
+
+  _target += cycles;
+  const int64_t target = (int64_t)(_target << 8);
+  int64_t error = target - (int64_t)_read;
+  // far out of step, after a pause say, jump rather than slew
+  const int64_t far = ((int64_t)CYCLES_PER_SECOND << 8) / 10;
+  if (error > far || error < -far) {
+    _read = (uint64_t)target;
+    error = 0;
+  }
+  // close the gap over about half a second, within an eighth of the pitch
+  int64_t step = _step + error / (_rate / 2);
+  step = SDL_max(SDL_min(step, _step + _step / 8), _step - _step / 8);
+  // never read past half the delay ahead of the timeline
+  const int64_t limit = target + ((int64_t)(SB_DELAY / 2) << 8);
+  if ((int64_t)_read + step * frames > limit) {
+    step = SDL_max(limit - (int64_t)_read, 0) / frames;
+  }
+
+  bool loud = false;
+  for (uint32_t i = 0; i < frames; ++i) {
+    const uint64_t a = _read + step * i;
+    int32_t x = 0;
+    if (step > 0) {
+      const int64_t sum = _level_sum(a, a + step, &tail, head);
+      x = (int32_t)((sum * SB_AMP) / step);
+    }
+    // divide rather than shift so the tail decays to zero, not to -1
+    _hp_y = ((x - _hp_x) << 8) + (int32_t)(((int64_t)_hp_y * _hp_r) / 65536);
+    _hp_x = x;
+    const int32_t out = _hp_y / 256;
+    loud |= (out != 0);
+    dst[i * 2 + 0] = dst[i * 2 + 1] = (int16_t)SDL_max(SDL_min(out, 0x7fff),
+                                                      -0x8000);
+  }
+
+  _read += step * frames;
+  atomic_store_release(&_runs_tail, tail);
+  return loud;
+}
@@ -0,0 +1,109 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Audio mixdown.
+//
+// Every source adds its samples, scaled by its gain, into a shared 32bit
+// buffer so that sources can sum past the range of an int16 without
+// wrapping.  Gains are 8.8 fixed point, leaving room for 256 full scale
+// sources before the accumulator itself could overflow.  Once all sources
+// have been added the buffer is scaled back down and saturated to int16 in
+// a single pass.
+//
+// A source that synthesises sample by sample should add straight into the
+// buffer from mixer_begin() using mixer_gain(), one that produces a block of
+// int16 samples can hand it to mixer_add().
+
+#include "../common/common.h"
+
+#if USE_SIMD && (defined(__SSE2__) || defined(_M_X64) || \
+                 (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #define MIXER_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+
+static int32_t _mix[MIXER_MAX_SAMPLES];
+
+static int32_t _gain[MIXER_NUM_SOURCES] = {
+  MIXER_UNITY,  // MIXER_ADLIB
+  MIXER_UNITY,  // MIXER_SPEAKER
+  MIXER_UNITY,  // MIXER_FLOPPY
+  MIXER_UNITY,  // MIXER_BLASTER
+};
+
+void mixer_set_gain(const enum mixer_source_t source, const uint32_t percent) {
+  assert(source < MIXER_NUM_SOURCES);
+  // keep the gain within an int16 for the multiply in mixer_add
+  _gain[source] = (int32_t)SDL_min((percent * MIXER_UNITY) / 100, 0x7fffu);
+}
+
+int32_t mixer_gain(const enum mixer_source_t source) {
+  assert(source < MIXER_NUM_SOURCES);
+  return _gain[source];
+}
+
+int32_t *mixer_begin(const uint32_t count) {
+  assert(count <= MIXER_MAX_SAMPLES);
+  memset(_mix, 0, count * sizeof(int32_t));
+  return _mix;
+}
+
+void mixer_add(int32_t *mix, const int16_t *src, uint32_t count,
+               const enum mixer_source_t source) {
+  const int32_t gain = mixer_gain(source);
+  if (gain == 0) {
+    return;
+  }
+#if MIXER_SSE2
+  // each 32bit lane of `g` holds the gain in its low half and zero in its
+  // high half, so madd against a sample paired with zero gives sample * gain
+  const __m128i g = _mm_set1_epi32(gain);
+  const __m128i zero = _mm_setzero_si128();
+  for (; count >= 8; count -= 8, src += 8, mix += 8) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)src);
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(s, zero), g);
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(s, zero), g);
+    __m128i *m = (__m128i*)mix;
+    _mm_storeu_si128(m + 0, _mm_add_epi32(_mm_loadu_si128(m + 0), lo));
+    _mm_storeu_si128(m + 1, _mm_add_epi32(_mm_loadu_si128(m + 1), hi));
+  }
+#endif
+  for (uint32_t i = 0; i < count; ++i) {
+    mix[i] += src[i] * gain;
+  }
+}
+
+void mixer_end(int16_t *dst, const int32_t *mix, uint32_t count) {
+#if MIXER_SSE2
+  // packs saturates each 32bit value to int16
+  for (; count >= 8; count -= 8, dst += 8, mix += 8) {
+    const __m128i *m = (const __m128i*)mix;
+    const __m128i lo = _mm_srai_epi32(_mm_loadu_si128(m + 0), MIXER_SHIFT);
+    const __m128i hi = _mm_srai_epi32(_mm_loadu_si128(m + 1), MIXER_SHIFT);
+    _mm_storeu_si128((__m128i*)dst, _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (uint32_t i = 0; i < count; ++i) {
+    const int32_t v = mix[i] >> MIXER_SHIFT;
+    dst[i] = (int16_t)SDL_max(SDL_min(v, 0x7fff), -0x8000);
+  }
+}
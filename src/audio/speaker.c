@@ -0,0 +1,423 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// PC speaker.
+//
+// The speaker cone is driven by PB1 of the i8255 anded with the output of
+// PIT channel 2, which is itself gated by PB0.  Rather than sending an audio
+// event for every change, the emulator records the line as one bit per
+// SPK_CYCLES cpu cycles and hands whole words of bits to the audio thread
+// through a ring of its own.  Traffic is then fixed by the emulated time
+// that passes, so a game toggling the speaker to play samples costs no more
+// than one playing a tone.
+//
+// The audio thread filters the bit stream down to the output rate with a
+// windowed sinc, applied a byte at a time through tables of the kernel
+// summed over each bit pattern, and then removes the dc offset the way the
+// speaker itself would.  Bits are read at a steady rate that is only slowly
+// pulled into line with the event timeline, otherwise the rate adjustment
+// of the audio thread would bend the pitch of every tone.
+
+#include "../common/common.h"
+#include "../cpu/cpu.h"
+
+
+// cpu cycles per bit, ~1.3us at 3Mhz which is finer than a pit tick
+#define SPK_CYCLES 4
+#define SPK_RATE (CYCLES_PER_SECOND / SPK_CYCLES)
+// words of bits in the ring, ~350ms
+#define SPK_WORDS 8192
+// longest filter kernel in bits, taken at the lowest output rates
+#define SPK_TAPS_MAX 2048
+// bits the kernel stays behind the read position, so that the bits it needs
+// have been sent even when reading runs a little ahead of the timeline
+#define SPK_DELAY 1024
+// zero words the stream starts with so the first kernel has history
+#define SPK_PAD ((SPK_TAPS_MAX + SPK_DELAY) / 32)
+// peak to peak amplitude, a square wave comes out at +/-0x6000 leaving room
+// for the overshoot of the filter
+#define SPK_AMP 0xc000
+
+// pit input clock
+static const uint64_t _pit_speed = 1193182;
+
+static uint32_t _bits[SPK_WORDS];
+// in words, each written only by one side
+static volatile uint32_t _bits_head, _bits_tail;
+static bool _enabled;
+
+// ---- emulator side
+
+// port b lines, bit 0 gates pit channel 2 and bit 1 drives the speaker
+static uint8_t _port;
+// pit channel 2 mode and count, 0 while no count has been loaded
+static uint8_t _pit_mode;
+static uint32_t _pit_count;
+// pit ticks counted since the count was loaded, 16.16 fixed point
+static uint64_t _pit_phase;
+static uint32_t _pit_step;
+// cycle in the slice up to which bits have been recorded
+static int32_t _cursor;
+// bits not yet making up a whole word
+static uint32_t _acc, _acc_bits;
+static uint32_t _dropped;
+
+// ---- audio side
+
+static int32_t _lut[SPK_TAPS_MAX / 8][256];
+static uint32_t _taps;
+// cycles of the event timeline that have been rendered
+static uint64_t _target;
+// cycles of the stream that have been read, 24.8 fixed point
+static uint64_t _read;
+// cycles per output sample, 24.8 fixed point
+static int64_t _step;
+static uint32_t _rate;
+// dc blocker state, `_hp_y` has 8 fractional bits
+static int32_t _hp_x, _hp_y;
+static int32_t _hp_r;
+
+
+static void _put_word(const uint32_t word) {
+  const uint32_t head = _bits_head;
+  // when the audio thread has fallen this far behind the word is lost, the
+  // head still moves so the stream stays in step with the audio events
+  if (head - atomic_load_acquire(&_bits_tail) < SPK_WORDS) {
+    _bits[head & (SPK_WORDS - 1)] = word;
+  }
+  else {
+    ++_dropped;
+  }
+  atomic_store_release(&_bits_head, head + 1);
+}
+
+// append `count` bits of the same level
+static void _put_bits(const bool level, uint32_t count) {
+  while (count) {
+    const uint32_t take = SDL_min(count, 32 - _acc_bits);
+    if (level) {
+      _acc |= (take == 32 ? ~0u : ((1u << take) - 1)) << _acc_bits;
+    }
+    _acc_bits += take;
+    count -= take;
+    if (_acc_bits == 32) {
+      _put_word(_acc);
+      _acc = 0;
+      _acc_bits = 0;
+    }
+  }
+}
+
+// output of pit channel 2 at the current phase
+static bool _pit_out(void) {
+  const uint32_t tick = (uint32_t)(_pit_phase >> 16);
+  switch (_pit_mode) {
+  case 0:
+  case 1:
+    // one shot, low until the count runs out
+    return _pit_count && tick >= _pit_count;
+  case 2:
+  case 6:
+    // rate generator, low for one tick in each count
+    return !_pit_count || (tick % _pit_count) != _pit_count - 1;
+  case 3:
+  case 7:
+    // square wave, high for the first half of each count
+    return !_pit_count || (tick % _pit_count) < (_pit_count + 1) / 2;
+  default:
+    return true;
+  }
+}
+
+// first tick after `tick` at which the output of pit channel 2 changes
+static uint64_t _pit_next(const uint64_t tick) {
+  if (!_pit_count) {
+    return UINT64_MAX;
+  }
+  const uint64_t base = tick - (tick % _pit_count);
+  const uint32_t p = (uint32_t)(tick - base);
+  switch (_pit_mode) {
+  case 0:
+  case 1:
+    return (tick < _pit_count) ? _pit_count : UINT64_MAX;
+  case 2:
+  case 6:
+    return base + ((p < _pit_count - 1) ? _pit_count - 1 : _pit_count);
+  case 3:
+  case 7:
+    return base + ((p < (_pit_count + 1) / 2) ? (_pit_count + 1) / 2 :
+                                                 _pit_count);
+  default:
+    return UINT64_MAX;
+  }
+}
+
+// record the speaker line from the cursor up to `cycle` in the slice
+static void _fill_to(const int32_t cycle) {
+  if (cycle <= _cursor) {
+    return;
+  }
+  const uint32_t bits = (uint32_t)(cycle - _cursor) / SPK_CYCLES;
+  _cursor += bits * SPK_CYCLES;
+
+  // without pb1 the cone does not move whatever the pit does
+  if (!(_port & 2)) {
+    _put_bits(false, bits);
+    return;
+  }
+  // without a gate the count holds, modes 2 and 3 force their output high
+  if (!(_port & 1)) {
+    const uint8_t mode = _pit_mode & 3;
+    _put_bits(mode == 2 || mode == 3 || _pit_out(), bits);
+    return;
+  }
+  // write a run of bits up to each change of the pit output
+  for (uint32_t done = 0; done < bits;) {
+    const uint64_t next = _pit_next(_pit_phase >> 16);
+    uint32_t run = bits - done;
+    if (next != UINT64_MAX) {
+      const uint64_t until = ((next << 16) - _pit_phase + _pit_step - 1) /
+                             _pit_step;
+      run = (uint32_t)SDL_min(until, (uint64_t)run);
+    }
+    _put_bits(_pit_out(), run);
+    _pit_phase += (uint64_t)run * _pit_step;
+    done += run;
+  }
+  // keep the periodic modes from running the phase out of range
+  if (_pit_count && _pit_mode >= 2) {
+    _pit_phase %= (uint64_t)_pit_count << 16;
+  }
+}
+
+void speaker_sync(void) {
+  if (_enabled) {
+    _fill_to((int32_t)cpu_slice_ticks());
+  }
+}
+
+void audio_pc_speaker_port(const uint8_t value) {
+  if (!_enabled) {
+    return;
+  }
+  _fill_to((int32_t)cpu_slice_ticks());
+  // a rising gate restarts the count in every mode but 0, which it pauses
+  if ((value & 1) && !(_port & 1) && _pit_mode != 0) {
+    _pit_phase = 0;
+  }
+  _port = value & 3;
+}
+
+void audio_pc_speaker_count(const uint8_t mode, const uint32_t count) {
+  if (!_enabled) {
+    return;
+  }
+  _fill_to((int32_t)cpu_slice_ticks());
+  _pit_mode = mode;
+  _pit_count = count;
+  _pit_phase = 0;
+}
+
+void speaker_tick(const uint64_t cycles) {
+  if (!_enabled) {
+    return;
+  }
+  _fill_to((int32_t)cycles);
+  // the next slice counts from zero
+  _cursor -= (int32_t)cycles;
+}
+
+// sin(pi * x)
+static double _sin_pi(double x) {
+  // reduce to -0.5 <= x <= 0.5
+  x -= 2.0 * (double)(int64_t)(x / 2.0);
+  if (x > 1.0) {
+    x -= 2.0;
+  }
+  if (x < -1.0) {
+    x += 2.0;
+  }
+  if (x > 0.5) {
+    x = 1.0 - x;
+  }
+  if (x < -0.5) {
+    x = -1.0 - x;
+  }
+  const double r = x * 3.14159265358979323846;
+  const double r2 = r * r;
+  double term = r, sum = r;
+  for (int n = 1; n < 8; ++n) {
+    term *= -r2 / (double)((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+static double _cos_pi(const double x) {
+  return _sin_pi(x + 0.5);
+}
+
+// windowed sinc low pass, from bits down to `rate` samples per second
+static void _build_kernel(const uint32_t rate) {
+  // sixteen output samples of support sets the transition band
+  _taps = ((SPK_RATE / rate) * 16 + 7) & ~7u;
+  _taps = SDL_min(SDL_max(_taps, 64u), (uint32_t)SPK_TAPS_MAX);
+  // cut off a little under nyquist
+  const double fc = (0.45 * rate) / SPK_RATE;
+
+  static double kernel[SPK_TAPS_MAX];
+  double sum = 0.0;
+  for (uint32_t i = 0; i < _taps; ++i) {
+    const double t = (double)i - (double)(_taps - 1) / 2.0;
+    const double sinc = (t == 0.0) ? 1.0 : _sin_pi(2.0 * fc * t) /
+                                           (3.14159265358979323846 * 2.0 * fc * t);
+    // blackman
+    const double w = (double)i / (double)(_taps - 1);
+    const double win = 0.42 - 0.5 * _cos_pi(2.0 * w) + 0.08 * _cos_pi(4.0 * w);
+    kernel[i] = sinc * win;
+    sum += kernel[i];
+  }
+
+  // sum the kernel over every pattern of eight bits, unity gain is 1 << 15
+  for (uint32_t j = 0; j < _taps / 8; ++j) {
+    for (uint32_t pattern = 0; pattern < 256; ++pattern) {
+      double v = 0.0;
+      for (uint32_t b = 0; b < 8; ++b) {
+        if (pattern & (1u << b)) {
+          v += kernel[j * 8 + b];
+        }
+      }
+      _lut[j][pattern] = (int32_t)(v * 32768.0 / sum + (v < 0 ? -0.5 : 0.5));
+    }
+  }
+}
+
+void speaker_init(const uint32_t rate) {
+  _build_kernel(rate);
+  // dc blocker pole for a corner of about 20Hz, 1 - 2 * pi * 20 / rate
+  _hp_r = 65536 - (int32_t)(8235417u / rate);
+  _hp_x = _hp_y = 0;
+
+  memset(_bits, 0, sizeof(_bits));
+  _bits_head = SPK_PAD;
+  _bits_tail = 0;
+  _target = 0;
+  _read = 0;
+  _rate = rate;
+  _step = ((int64_t)CYCLES_PER_SECOND << 8) / rate;
+  _pit_step = (uint32_t)((SPK_CYCLES * _pit_speed << 16) / CYCLES_PER_SECOND);
+  _cursor = 0;
+  _acc = _acc_bits = 0;
+  _enabled = true;
+}
+
+void speaker_close(void) {
+  if (_dropped) {
+    log_printf(LOG_CHAN_AUDIO, "%u speaker words dropped", _dropped);
+  }
+  _enabled = false;
+}
+
+// eight bits of the stream starting at bit `bit`, zero where not yet sent
+static uint32_t _get_byte(const uint64_t bit, const uint32_t head) {
+  const uint32_t word = (uint32_t)(bit >> 5);
+  const uint32_t shift = (uint32_t)bit & 31;
+  const uint32_t lo = ((int32_t)(word - head) < 0) ?
+                      _bits[word & (SPK_WORDS - 1)] : 0;
+  uint32_t out = lo >> shift;
+  if (shift > 24) {
+    const uint32_t hi = ((int32_t)(word + 1 - head) < 0) ?
+                        _bits[(word + 1) & (SPK_WORDS - 1)] : 0;
+    out |= hi << (32 - shift);
+  }
+  return out & 0xff;
+}
+
+// first bit of the kernel for the sample at `pos`, in 24.8 cycles
+static uint64_t _window(const uint64_t pos) {
+  return (uint64_t)SPK_PAD * 32 + (pos >> 8) / SPK_CYCLES - SPK_DELAY - _taps;
+}
+
+bool speaker_render(int16_t *dst, const uint32_t frames,
+                    const uint32_t cycles) {
+  const uint32_t head = atomic_load_acquire(&_bits_head);
+
+  _target += cycles;
+  const int64_t target = (int64_t)(_target << 8);
+  int64_t error = target - (int64_t)_read;
+  // far out of step, after a pause say, jump rather than slew
+  const int64_t far = ((int64_t)CYCLES_PER_SECOND << 8) / 10;
+  if (error > far || error < -far) {
+    _read = (uint64_t)target;
+    error = 0;
+  }
+  // close the gap over about half a second, within an eighth of the pitch
+  int64_t step = _step + error / (_rate / 2);
+  step = SDL_max(SDL_min(step, _step + _step / 8), _step - _step / 8);
+  // never read past half the delay ahead of the timeline
+  const int64_t limit = target + ((int64_t)(SPK_DELAY / 2) * SPK_CYCLES << 8);
+  if ((int64_t)_read + step * frames > limit) {
+    step = SDL_max(limit - (int64_t)_read, 0) / frames;
+  }
+  const uint64_t start = _read;
+
+  // all the bits this span reads are zero and the filter has settled
+  bool silent = (_hp_x == 0 && _hp_y == 0);
+  if (silent) {
+    const uint64_t first = _window(start + step) >> 5;
+    const uint64_t last = (_window(start + step * frames) + _taps) >> 5;
+    for (uint64_t w = first; w <= last && silent; ++w) {
+      if ((int32_t)((uint32_t)w - head) < 0) {
+        silent = _bits[w & (SPK_WORDS - 1)] == 0;
+      }
+    }
+  }
+
+  if (silent) {
+    memset(dst, 0, frames * 2 * sizeof(int16_t));
+  }
+  else {
+    for (uint32_t i = 0; i < frames; ++i) {
+      const uint64_t bit = _window(start + step * (i + 1));
+      int32_t acc = 0;
+      for (uint32_t j = 0; j < _taps / 8; ++j) {
+        acc += _lut[j][_get_byte(bit + j * 8, head)];
+      }
+      const int32_t x = (int32_t)(((int64_t)acc * SPK_AMP) >> 15);
+      // divide rather than shift so the tail decays to zero, not to -1
+      _hp_y = ((x - _hp_x) << 8) + (int32_t)(((int64_t)_hp_y * _hp_r) / 65536);
+      _hp_x = x;
+      const int32_t out = _hp_y / 256;
+      dst[i * 2 + 0] = dst[i * 2 + 1] = (int16_t)SDL_max(SDL_min(out, 0x7fff),
+                                                        -0x8000);
+    }
+  }
+
+  _read = start + step * frames;
+  // hand back the words that no later kernel will read, but none that the
+  // emulator has yet to send
+  uint32_t tail = (uint32_t)(_window(_read) >> 5);
+  if ((int32_t)(tail - head) > 0) {
+    tail = head;
+  }
+  atomic_store_release(&_bits_tail, tail);
+  return !silent;
+}
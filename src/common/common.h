@@ -51,16 +51,107 @@
   #endif
 #endif
 
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- atomics
+
+// acquire load and release store, enough to hand data between a single
+// producer and a single consumer thread without a lock
+#ifdef _MSC_VER
+  #include <intrin.h>
+  // x86 loads and stores are already ordered so only the compiler needs
+  // to be stopped from moving them
+  static inline uint32_t atomic_load_acquire(const volatile uint32_t *p) {
+    const uint32_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+  }
+  static inline void atomic_store_release(volatile uint32_t *p, uint32_t v) {
+    _ReadWriteBarrier();
+    *p = v;
+  }
+#else
+  static inline uint32_t atomic_load_acquire(const volatile uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+  static inline void atomic_store_release(volatile uint32_t *p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+  }
+#endif
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- audio.c
 void audio_init(uint32_t sample_rate);
+// render on the emulator thread against emulated time, with audio_render
+void audio_init_offline(uint32_t sample_rate);
 void audio_close(void);
 uint32_t audio_callback(int16_t *samples, uint32_t num_samples);
+// render and mix up to `num_samples` of the events sent so far, returns the
+// number of samples written
+uint32_t audio_render(int16_t *samples, uint32_t num_samples);
 void audio_tick(const uint64_t cycles);
-void audio_pc_speaker_freq(const uint32_t freq);
-void audio_pc_speaker_enable(bool enable);
+// the audio thread is too far behind for another slice to be run
+bool audio_backlog_full(void);
 void audio_disk_seek(const uint32_t sects);
+// cycles to emulate for the audio device to stay a lookahead behind, when
+// paced by the audio clock
+uint32_t audio_clock_due(void);
+// block until the audio device has played another period
+void audio_clock_wait(void);
 
 extern bool audio_enable;
+extern bool audio_clock;
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- speaker.c
+// i8255 port b was written
+void audio_pc_speaker_port(const uint8_t value);
+// i8253 channel 2 was loaded with `count` ticks, 0 while it is not counting
+void audio_pc_speaker_count(const uint8_t mode, const uint32_t count);
+// record the speaker up to the current cycle, before sending an audio event
+void speaker_sync(void);
+void speaker_tick(const uint64_t cycles);
+void speaker_init(const uint32_t rate);
+void speaker_close(void);
+// filter the bits recorded over `cycles` into `frames` stereo frames,
+// returns false if they were all silent
+bool speaker_render(int16_t *dst, const uint32_t frames,
+                    const uint32_t cycles);
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- blaster.c
+extern uint8_t blaster_irq;
+void blaster_init(void);
+// play the dsp up to the current cycle, before sending an audio event
+void blaster_sync(void);
+void blaster_tick(const uint64_t cycles);
+// cycles until the current dma block ends and raises its irq
+int64_t blaster_cycles_before_irq(void);
+void blaster_audio_init(const uint32_t rate);
+void blaster_audio_close(void);
+// as speaker_render, for the dac output over `cycles`
+bool blaster_render(int16_t *dst, const uint32_t frames,
+                    const uint32_t cycles);
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- mixer.c
+enum mixer_source_t {
+  MIXER_ADLIB,
+  MIXER_SPEAKER,
+  MIXER_FLOPPY,
+  MIXER_BLASTER,
+  MIXER_NUM_SOURCES,
+};
+
+// gains are 8.8 fixed point
+#define MIXER_SHIFT 8
+#define MIXER_UNITY (1 << MIXER_SHIFT)
+// interleaved samples per mixdown
+#define MIXER_MAX_SAMPLES 4096
+
+void mixer_set_gain(const enum mixer_source_t source, const uint32_t percent);
+int32_t mixer_gain(const enum mixer_source_t source);
+// clear and return the 32bit mixdown buffer for `count` samples
+int32_t *mixer_begin(const uint32_t count);
+// add a block of int16 samples scaled by the source gain
+void mixer_add(int32_t *mix, const int16_t *src, uint32_t count,
+               const enum mixer_source_t source);
+// scale down and saturate the mixdown to int16
+void mixer_end(int16_t *dst, const int32_t *mix, uint32_t count);
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- i8259.c
 struct structpic {
@@ -122,6 +213,7 @@ uint32_t mem_loadrom(uint32_t addr32, const char *filename, uint8_t failure_fata
 uint32_t mem_loadbios(const char *filename);
 void mem_dump(const char *path);
 void mem_write(uint32_t addr, const uint8_t *src, size_t size);
+void mem_read(uint8_t *dst, uint32_t addr, size_t size);
 void mem_state_save(FILE *fd);
 void mem_state_load(FILE *fd);
 
@@ -136,6 +228,8 @@ struct dmachan_s {
   uint8_t writemode;
   uint8_t masked;
 };
+// move up to `size` bytes of a memory read transfer, returns those moved
+uint32_t i8237_read_block(uint8_t channel, uint8_t *dst, uint32_t size);
 void i8237_tick(uint64_t cycles);
 bool i8237_init(void);
 void i8237_state_save(FILE *fd);
@@ -225,7 +319,12 @@ bool rom_insert();
 
 // memory access for video cards
 uint8_t neo_mem_read_A0000(uint32_t addr);
+uint16_t neo_mem_read_A0000_w(uint32_t addr);
+void neo_mem_read_A0000_block(uint8_t *dst, uint32_t addr, uint32_t size);
 void neo_mem_write_A0000(uint32_t addr, uint8_t value);
+void neo_mem_write_A0000_w(uint32_t addr, uint16_t value);
+void neo_mem_write_A0000_block(uint32_t addr, const uint8_t *src,
+                               uint32_t size);
 
 bool neo_init(void);
 bool neo_int10_handler(void);
@@ -235,13 +334,33 @@ int neo_get_video_mode(void);
 void neo_state_save(FILE *fd);
 void neo_state_load(FILE *fd);
 
+// video memory dirty bitmap, one bit per 16 byte block of 0xA0000-0xBFFFF
+#define NEO_DIRTY_MAP_SIZE (0x20000 / 16 / 32)
+extern uint32_t neo_dirty_map[NEO_DIRTY_MAP_SIZE];
+
+static inline void neo_mark_dirty(uint32_t addr) {
+  const uint32_t blk = (addr - 0xA0000) >> 4;
+  neo_dirty_map[blk >> 5] |= 1u << (blk & 31);
+}
+
+void neo_mark_dirty_span(uint32_t addr, uint32_t size);
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- vga_timing.c
 
+// scanlines before vblank
+#define VGA_VISIBLE_LINES 400
+
 void vga_timing_init(void);
 void vga_timing_advance(const uint64_t cycles);
 uint8_t vga_timing_get_3da(void);
+// scanline the beam is on, lines from VGA_VISIBLE_LINES are in vblank
+uint32_t vga_timing_get_line(void);
 bool vga_timing_should_flip(void);
 void vga_timing_did_flip(void);
+// vertical refreshes since power on
+uint32_t vga_timing_frame_count(void);
+// real time between emulated vertical refreshes
+uint32_t vga_timing_frame_us(void);
 
 void vga_timing_state_save(FILE *fd);
 void vga_timing_state_load(FILE *fd);
@@ -81,10 +81,14 @@
 #define USE_AUDIO_ADLIB   1
 #define USE_AUDIO_SPEAKER 1
 #define USE_AUDIO_FLOPPY  0
+#define USE_AUDIO_BLASTER 1
 
 // emulate disk delay
 #define USE_DISK_DELAY    1
 
 #define USE_CPU_REDUX     1
 
+// use SSE2/AVX2 kernels when the compiler is targeting them
+#define USE_SIMD          1
+
 #define VERBOSE           0
@@ -0,0 +1,416 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vidrec.h"
+
+
+// frames between key frames so a damaged stream recovers
+#define VIDREC_KEY_INTERVAL 600
+// shortest run worth breaking a literal for
+#define VIDREC_MIN_RUN 3
+
+
+static void _put_u16(uint8_t *dst, const uint32_t v) {
+  dst[0] = (uint8_t)(v >> 0);
+  dst[1] = (uint8_t)(v >> 8);
+}
+
+static void _put_u32(uint8_t *dst, const uint32_t v) {
+  dst[0] = (uint8_t)(v >> 0);
+  dst[1] = (uint8_t)(v >> 8);
+  dst[2] = (uint8_t)(v >> 16);
+  dst[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t _get_u16(const uint8_t *src) {
+  return src[0] | (src[1] << 8);
+}
+
+static uint32_t _get_u32(const uint8_t *src) {
+  return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint8_t *_put_leb(uint8_t *dst, uint32_t v) {
+  while (v >= 0x80) {
+    *dst++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *dst++ = (uint8_t)v;
+  return dst;
+}
+
+static uint8_t *_rle_literal(uint8_t *dst, const uint8_t *src,
+                             const uint32_t size) {
+  if (size) {
+    dst = _put_leb(dst, (size - 1) << 1);
+    memcpy(dst, src, size);
+    dst += size;
+  }
+  return dst;
+}
+
+// run length code `size` bytes, returns the bytes written to `dst` which
+// must hold at least size + size / 64 + 8
+static uint32_t _rle_encode(uint8_t *dst, const uint8_t *src,
+                            const uint32_t size) {
+  uint8_t *out = dst;
+  uint32_t lit = 0, i = 0;
+  while (i < size) {
+    uint32_t run = 1;
+    while (i + run < size && src[i + run] == src[i]) {
+      ++run;
+    }
+    if (run < VIDREC_MIN_RUN) {
+      i += run;
+      continue;
+    }
+    out = _rle_literal(out, src + lit, i - lit);
+    out = _put_leb(out, ((run - 1) << 1) | 1);
+    *out++ = src[i];
+    i += run;
+    lit = i;
+  }
+  out = _rle_literal(out, src + lit, size - lit);
+  return (uint32_t)(out - dst);
+}
+
+static bool _rle_decode(uint8_t *dst, const uint32_t size,
+                        const uint8_t *src, const uint32_t src_size) {
+  const uint8_t *end = src + src_size;
+  uint32_t i = 0;
+  while (src < end) {
+    uint32_t ctl = 0, shift = 0;
+    for (;;) {
+      if (src >= end || shift > 28) {
+        return false;
+      }
+      const uint8_t b = *src++;
+      ctl |= (uint32_t)(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80)) {
+        break;
+      }
+    }
+    const uint32_t len = (ctl >> 1) + 1;
+    if (len > size - i) {
+      return false;
+    }
+    if (ctl & 1) {
+      if (src >= end) {
+        return false;
+      }
+      memset(dst + i, *src++, len);
+    }
+    else {
+      if (len > (uint32_t)(end - src)) {
+        return false;
+      }
+      memcpy(dst + i, src, len);
+      src += len;
+    }
+    i += len;
+  }
+  return i == size;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- encoder
+
+static void _enc_reset_palette(struct vidrec_enc_t *enc) {
+  memset(enc->map_val, 0xff, sizeof(enc->map_val));
+  enc->pal_num = 0;
+  enc->pal_sent = 0;
+}
+
+// palette index for `rgb`, adding it if there is room, otherwise -1
+static int _enc_lookup(struct vidrec_enc_t *enc, const uint32_t rgb) {
+  uint32_t h = (rgb * 2654435761u) >> 23;
+  while (enc->map_val[h] >= 0) {
+    if (enc->map_key[h] == rgb) {
+      return enc->map_val[h];
+    }
+    h = (h + 1) & 511;
+  }
+  if (enc->pal_num >= 256) {
+    return -1;
+  }
+  enc->map_key[h] = rgb;
+  enc->map_val[h] = (int16_t)enc->pal_num;
+  enc->pal[enc->pal_num] = rgb;
+  return enc->pal_num++;
+}
+
+// map a frame onto the palette, false if it ran out of entries
+static bool _enc_quantize(struct vidrec_enc_t *enc, const uint32_t *src,
+                          const uint32_t pitch) {
+  uint8_t *dst = enc->index;
+  for (uint32_t y = 0; y < enc->h; ++y) {
+    const uint32_t *row = src + y * pitch;
+    // neighbouring pixels are mostly the same colour
+    uint32_t last_rgb = ~row[0];
+    int last = 0;
+    for (uint32_t x = 0; x < enc->w; ++x) {
+      const uint32_t rgb = row[x] & 0xffffff;
+      if (rgb != last_rgb) {
+        last = _enc_lookup(enc, rgb);
+        if (last < 0) {
+          return false;
+        }
+        last_rgb = rgb;
+      }
+      *dst++ = (uint8_t)last;
+    }
+  }
+  return true;
+}
+
+static bool _enc_alloc(struct vidrec_enc_t *enc, const uint32_t w,
+                       const uint32_t h) {
+  free(enc->index);
+  free(enc->last);
+  free(enc->rgb);
+  free(enc->out);
+  enc->w = w;
+  enc->h = h;
+  // rgb frames are the largest payload
+  const uint32_t size = w * h * 3;
+  enc->out_size = size + size / 64 + 8;
+  enc->index = malloc(w * h);
+  enc->last = calloc(1, w * h);
+  enc->rgb = malloc(size);
+  enc->out = malloc(enc->out_size);
+  return enc->index && enc->last && enc->rgb && enc->out;
+}
+
+static bool _enc_write(struct vidrec_enc_t *enc, const uint8_t type,
+                       const uint32_t refresh, const uint32_t size) {
+  // new palette entries since the last frame
+  const uint32_t first = enc->pal_sent;
+  const uint32_t count = enc->pal_num - enc->pal_sent;
+  uint8_t head[13];
+  head[0] = type;
+  _put_u32(head + 1, refresh);
+  _put_u16(head + 5, enc->w);
+  _put_u16(head + 7, enc->h);
+  _put_u16(head + 9, first);
+  _put_u16(head + 11, count);
+  fwrite(head, 1, sizeof(head), enc->fd);
+  for (uint32_t i = first; i < enc->pal_num; ++i) {
+    const uint8_t rgb[3] = {
+      (uint8_t)(enc->pal[i] >> 16),
+      (uint8_t)(enc->pal[i] >> 8),
+      (uint8_t)(enc->pal[i] >> 0)
+    };
+    fwrite(rgb, 1, 3, enc->fd);
+  }
+  enc->pal_sent = enc->pal_num;
+  _put_u32(head, size);
+  fwrite(head, 1, 4, enc->fd);
+  fwrite(enc->out, 1, size, enc->fd);
+  return !ferror(enc->fd);
+}
+
+// store a frame with too many colours for a palette as rgb
+static bool _enc_frame_rgb(struct vidrec_enc_t *enc, const uint32_t *src,
+                           const uint32_t pitch, const uint32_t refresh) {
+  uint8_t *rgb = enc->rgb;
+  for (uint32_t y = 0; y < enc->h; ++y) {
+    for (uint32_t x = 0; x < enc->w; ++x) {
+      const uint32_t c = src[y * pitch + x];
+      *rgb++ = (uint8_t)(c >> 16);
+      *rgb++ = (uint8_t)(c >> 8);
+      *rgb++ = (uint8_t)(c >> 0);
+    }
+  }
+  const uint32_t size = _rle_encode(enc->out, enc->rgb, enc->w * enc->h * 3);
+  // there is no indexed reference so the next frame must be a key frame
+  _enc_reset_palette(enc);
+  enc->need_key = true;
+  enc->since_key = 0;
+  return _enc_write(enc, VIDREC_KEY_RGB, refresh, size);
+}
+
+bool vidrec_enc_open(struct vidrec_enc_t *enc, FILE *fd) {
+  memset(enc, 0, sizeof(*enc));
+  enc->fd = fd;
+  enc->need_key = true;
+  _enc_reset_palette(enc);
+  uint8_t head[8] = {'F', '8', '6', 'V'};
+  _put_u32(head + 4, VIDREC_VERSION);
+  return fwrite(head, 1, sizeof(head), fd) == sizeof(head);
+}
+
+bool vidrec_enc_frame(struct vidrec_enc_t *enc, const uint32_t *src,
+                      const uint32_t w, const uint32_t h, const uint32_t pitch,
+                      const uint32_t refresh) {
+  if (w != enc->w || h != enc->h) {
+    if (w > 0xffff || h > 0xffff || !_enc_alloc(enc, w, h)) {
+      return false;
+    }
+    enc->need_key = true;
+  }
+  if (enc->since_key >= VIDREC_KEY_INTERVAL) {
+    enc->need_key = true;
+  }
+  // start a fresh palette when this one is full
+  if (!_enc_quantize(enc, src, pitch)) {
+    _enc_reset_palette(enc);
+    enc->need_key = true;
+    if (!_enc_quantize(enc, src, pitch)) {
+      return _enc_frame_rgb(enc, src, pitch, refresh);
+    }
+  }
+  uint8_t type = VIDREC_KEY;
+  uint32_t size;
+  if (enc->need_key) {
+    size = _rle_encode(enc->out, enc->index, w * h);
+    enc->need_key = false;
+    enc->since_key = 0;
+  }
+  else {
+    type = VIDREC_DELTA;
+    // xor in place so `last` is left holding the delta
+    for (uint32_t i = 0; i < w * h; ++i) {
+      enc->last[i] ^= enc->index[i];
+    }
+    size = _rle_encode(enc->out, enc->last, w * h);
+    ++enc->since_key;
+  }
+  // this frame is the reference for the next
+  uint8_t *tmp = enc->last;
+  enc->last = enc->index;
+  enc->index = tmp;
+  return _enc_write(enc, type, refresh, size);
+}
+
+void vidrec_enc_close(struct vidrec_enc_t *enc) {
+  if (enc->fd) {
+    fclose(enc->fd);
+  }
+  free(enc->index);
+  free(enc->last);
+  free(enc->rgb);
+  free(enc->out);
+  memset(enc, 0, sizeof(*enc));
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- decoder
+
+bool vidrec_dec_open(struct vidrec_dec_t *dec, FILE *fd) {
+  memset(dec, 0, sizeof(*dec));
+  dec->fd = fd;
+  uint8_t head[8];
+  if (fread(head, 1, sizeof(head), fd) != sizeof(head)) {
+    return false;
+  }
+  return memcmp(head, "F86V", 4) == 0 && _get_u32(head + 4) == VIDREC_VERSION;
+}
+
+static bool _dec_alloc(struct vidrec_dec_t *dec, const uint32_t w,
+                       const uint32_t h) {
+  free(dec->index);
+  free(dec->tmp);
+  free(dec->rgb);
+  dec->w = w;
+  dec->h = h;
+  dec->index = calloc(1, w * h);
+  dec->tmp = malloc(w * h * 3);
+  dec->rgb = calloc(w * h, sizeof(uint32_t));
+  return dec->index && dec->tmp && dec->rgb;
+}
+
+bool vidrec_dec_frame(struct vidrec_dec_t *dec) {
+  uint8_t head[13];
+  if (fread(head, 1, sizeof(head), dec->fd) != sizeof(head)) {
+    return false;
+  }
+  dec->type = head[0];
+  dec->refresh = _get_u32(head + 1);
+  const uint32_t w = _get_u16(head + 5);
+  const uint32_t h = _get_u16(head + 7);
+  const uint32_t first = _get_u16(head + 9);
+  const uint32_t count = _get_u16(head + 11);
+  if (dec->type > VIDREC_KEY_RGB || first + count > 256) {
+    return false;
+  }
+  if (w != dec->w || h != dec->h) {
+    // the size may only change on a key frame
+    if (dec->type == VIDREC_DELTA || !_dec_alloc(dec, w, h)) {
+      return false;
+    }
+  }
+  for (uint32_t i = first; i < first + count; ++i) {
+    uint8_t rgb[3];
+    if (fread(rgb, 1, 3, dec->fd) != 3) {
+      return false;
+    }
+    dec->pal[i] = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+  }
+  uint8_t sz[4];
+  if (fread(sz, 1, 4, dec->fd) != 4) {
+    return false;
+  }
+  const uint32_t size = _get_u32(sz);
+  uint8_t *payload = malloc(size ? size : 1);
+  if (!payload || fread(payload, 1, size, dec->fd) != size) {
+    free(payload);
+    return false;
+  }
+  const uint32_t pixels = w * h;
+  bool ok = true;
+  switch (dec->type) {
+  case VIDREC_KEY_RGB:
+    ok = _rle_decode(dec->tmp, pixels * 3, payload, size);
+    for (uint32_t i = 0; ok && i < pixels; ++i) {
+      const uint8_t *c = dec->tmp + i * 3;
+      dec->rgb[i] = (c[0] << 16) | (c[1] << 8) | c[2];
+    }
+    break;
+  case VIDREC_KEY:
+    ok = _rle_decode(dec->index, pixels, payload, size);
+    break;
+  case VIDREC_DELTA:
+    ok = _rle_decode(dec->tmp, pixels, payload, size);
+    for (uint32_t i = 0; ok && i < pixels; ++i) {
+      dec->index[i] ^= dec->tmp[i];
+    }
+    break;
+  }
+  free(payload);
+  if (ok && dec->type != VIDREC_KEY_RGB) {
+    for (uint32_t i = 0; i < pixels; ++i) {
+      dec->rgb[i] = dec->pal[dec->index[i]];
+    }
+  }
+  return ok;
+}
+
+void vidrec_dec_close(struct vidrec_dec_t *dec) {
+  if (dec->fd) {
+    fclose(dec->fd);
+  }
+  free(dec->index);
+  free(dec->tmp);
+  free(dec->rgb);
+  memset(dec, 0, sizeof(*dec));
+}
@@ -0,0 +1,104 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Lossless video recording format (.f86v).
+//
+// Frames are mapped onto a palette of up to 256 colours that grows as new
+// colours appear, and stored either whole (key frames) or as the xor with
+// the frame before (delta frames).  Both are run length coded, so areas of
+// the screen that did not change cost next to nothing.  A frame with more
+// than 256 colours is stored as a run length coded rgb key frame.
+//
+//   file   "F86V", u32 version
+//   frame  u8 type, u32 refresh, u16 width, u16 height,
+//          u16 first palette entry, u16 palette entries, u8 rgb[entries][3],
+//          u32 payload size, u8 payload[size]
+//
+// All values are little endian.  A payload is a series of LEB128 controls,
+// bit 0 clear is followed by (control >> 1) + 1 literal bytes, and bit 0 set
+// by a single byte repeated (control >> 1) + 1 times.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+
+#define VIDREC_VERSION 1
+
+enum vidrec_type_t {
+  // palette indices
+  VIDREC_KEY,
+  // palette indices xor the previous frame
+  VIDREC_DELTA,
+  // rgb, used when a frame has more than 256 colours
+  VIDREC_KEY_RGB,
+};
+
+struct vidrec_enc_t {
+  FILE *fd;
+  uint32_t w, h;
+  // palette indices of this and the last frame
+  uint8_t *index, *last;
+  // staging for rgb frames
+  uint8_t *rgb;
+  // payload output
+  uint8_t *out;
+  uint32_t out_size;
+  // colour to palette index, open addressed
+  uint32_t map_key[512];
+  int16_t map_val[512];
+  uint32_t pal[256];
+  uint32_t pal_num;
+  // palette entries already written
+  uint32_t pal_sent;
+  // frames since the last key frame
+  uint32_t since_key;
+  bool need_key;
+};
+
+struct vidrec_dec_t {
+  FILE *fd;
+  uint32_t w, h;
+  uint8_t *index, *tmp;
+  uint32_t pal[256];
+  // decoded frame as 0x00RRGGBB
+  uint32_t *rgb;
+  // refresh the frame was recorded on and its type
+  uint32_t refresh;
+  uint8_t type;
+};
+
+// takes ownership of `fd`
+bool vidrec_enc_open(struct vidrec_enc_t *enc, FILE *fd);
+// encode a 0x00RRGGBB frame
+bool vidrec_enc_frame(struct vidrec_enc_t *enc, const uint32_t *src,
+                      uint32_t w, uint32_t h, uint32_t pitch,
+                      uint32_t refresh);
+void vidrec_enc_close(struct vidrec_enc_t *enc);
+
+// takes ownership of `fd`
+bool vidrec_dec_open(struct vidrec_dec_t *dec, FILE *fd);
+// decode the next frame into `dec->rgb`, false at the end of the stream or
+// if it is corrupt
+bool vidrec_dec_frame(struct vidrec_dec_t *dec);
+void vidrec_dec_close(struct vidrec_dec_t *dec);
@@ -50,11 +50,16 @@ bool cpu_step = false;
 
 static uint64_t _cycles;
 static uint32_t _delay_cycles;
+static bool _slice_end;
 
 uint64_t cpu_slice_ticks(void) {
   return _cycles;
 }
 
+void cpu_slice_end(void) {
+  _slice_end = true;
+}
+
 #define modregrm()                                                             \
   {                                                                            \
     addrbyte = _read_code_u8();                                                \
@@ -1327,12 +1332,13 @@ int32_t cpu_exec86(int32_t target) {
 
   static uint16_t trap_toggle = 0;
   _cycles = 0;
+  _slice_end = false;
 
   const bool in_cpu_halt = cpu_halt;
 
   while (cpu_running && _cycles < target) {
 
-    if (in_cpu_halt != cpu_halt) {
+    if (in_cpu_halt != cpu_halt || _slice_end) {
       break;
     }
 
@@ -54,6 +54,8 @@ int32_t cpu_exec86(int32_t cycle_target);
 
 // get the current tick count of this slice
 uint64_t cpu_slice_ticks(void);
+// return from cpu_exec86 after the current instruction
+void cpu_slice_end(void);
 
 bool cpu_in_hlt_state(void);
 
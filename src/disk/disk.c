@@ -260,7 +260,7 @@ static void _disk_write(uint8_t drivenum,
   assert(d);
   uint8_t sectorbuffer[512];
 
-  uint32_t memdest, cursect, sectoffset;
+  uint32_t memdest, cursect;
   if (!sect) {
     goto error;
   }
@@ -280,9 +280,8 @@ static void _disk_write(uint8_t drivenum,
   _seek(drivenum, fileoffset);
   memdest = ((uint32_t)dstseg << 4) + (uint32_t)dstoff;
   for (cursect = 0; cursect < sectcount; cursect++) {
-    for (sectoffset = 0; sectoffset < 512; sectoffset++) {
-      sectorbuffer[sectoffset] = read86(memdest++);
-    }
+    mem_read(sectorbuffer, memdest, 512);
+    memdest += 512;
     if (!_write(drivenum, sectorbuffer, 512)) {
       goto error;
     }
@@ -0,0 +1,1585 @@
+//
+// Copyright (C) 2013-2016 Alexey Khokholov (Nuke.YKT)
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+//  Nuked OPL3 emulator, structure of arrays variant.
+//
+//  This follows opl3.c step for step, with these differences:
+//  - Feedback, phase and envelope have no dependency between slots within
+//    a sample, so they are evaluated for all slots up front, eight 16 bit
+//    or four 32 bit lanes at a time.
+//  - The phase step, including vibrato, is cached per slot and only worked
+//    out again when a register or the vibrato position changes.
+//  - Waveforms are looked up from a table built once instead of being
+//    selected through a function pointer, which leaves the sine generation
+//    free of branches.  It stays scalar as each group of three slots
+//    modulates the next.
+//  - The envelope increment is worked out once per rate per sample rather
+//    than once per slot.
+//  - A chip with every envelope off can skip ahead without generating,
+//    see OPL3V_SkipStream.
+//
+// version: 1.7.4
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opl3v.h"
+
+#if !defined(OPL3V_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define OPL3V_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define RSM_FRAC    10
+
+// Channel types
+
+enum {
+    ch_2op = 0,
+    ch_4op = 1,
+    ch_4op2 = 2,
+    ch_drum = 3
+};
+
+// Envelope key types
+
+enum {
+    egk_norm = 0x01,
+    egk_drum = 0x02
+};
+
+
+//
+// logsin table
+//
+
+static const Bit16u logsinrom[256] = {
+    0x859, 0x6c3, 0x607, 0x58b, 0x52e, 0x4e4, 0x4a6, 0x471,
+    0x443, 0x41a, 0x3f5, 0x3d3, 0x3b5, 0x398, 0x37e, 0x365,
+    0x34e, 0x339, 0x324, 0x311, 0x2ff, 0x2ed, 0x2dc, 0x2cd,
+    0x2bd, 0x2af, 0x2a0, 0x293, 0x286, 0x279, 0x26d, 0x261,
+    0x256, 0x24b, 0x240, 0x236, 0x22c, 0x222, 0x218, 0x20f,
+    0x206, 0x1fd, 0x1f5, 0x1ec, 0x1e4, 0x1dc, 0x1d4, 0x1cd,
+    0x1c5, 0x1be, 0x1b7, 0x1b0, 0x1a9, 0x1a2, 0x19b, 0x195,
+    0x18f, 0x188, 0x182, 0x17c, 0x177, 0x171, 0x16b, 0x166,
+    0x160, 0x15b, 0x155, 0x150, 0x14b, 0x146, 0x141, 0x13c,
+    0x137, 0x133, 0x12e, 0x129, 0x125, 0x121, 0x11c, 0x118,
+    0x114, 0x10f, 0x10b, 0x107, 0x103, 0x0ff, 0x0fb, 0x0f8,
+    0x0f4, 0x0f0, 0x0ec, 0x0e9, 0x0e5, 0x0e2, 0x0de, 0x0db,
+    0x0d7, 0x0d4, 0x0d1, 0x0cd, 0x0ca, 0x0c7, 0x0c4, 0x0c1,
+    0x0be, 0x0bb, 0x0b8, 0x0b5, 0x0b2, 0x0af, 0x0ac, 0x0a9,
+    0x0a7, 0x0a4, 0x0a1, 0x09f, 0x09c, 0x099, 0x097, 0x094,
+    0x092, 0x08f, 0x08d, 0x08a, 0x088, 0x086, 0x083, 0x081,
+    0x07f, 0x07d, 0x07a, 0x078, 0x076, 0x074, 0x072, 0x070,
+    0x06e, 0x06c, 0x06a, 0x068, 0x066, 0x064, 0x062, 0x060,
+    0x05e, 0x05c, 0x05b, 0x059, 0x057, 0x055, 0x053, 0x052,
+    0x050, 0x04e, 0x04d, 0x04b, 0x04a, 0x048, 0x046, 0x045,
+    0x043, 0x042, 0x040, 0x03f, 0x03e, 0x03c, 0x03b, 0x039,
+    0x038, 0x037, 0x035, 0x034, 0x033, 0x031, 0x030, 0x02f,
+    0x02e, 0x02d, 0x02b, 0x02a, 0x029, 0x028, 0x027, 0x026,
+    0x025, 0x024, 0x023, 0x022, 0x021, 0x020, 0x01f, 0x01e,
+    0x01d, 0x01c, 0x01b, 0x01a, 0x019, 0x018, 0x017, 0x017,
+    0x016, 0x015, 0x014, 0x014, 0x013, 0x012, 0x011, 0x011,
+    0x010, 0x00f, 0x00f, 0x00e, 0x00d, 0x00d, 0x00c, 0x00c,
+    0x00b, 0x00a, 0x00a, 0x009, 0x009, 0x008, 0x008, 0x007,
+    0x007, 0x007, 0x006, 0x006, 0x005, 0x005, 0x005, 0x004,
+    0x004, 0x004, 0x003, 0x003, 0x003, 0x002, 0x002, 0x002,
+    0x002, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001,
+    0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000
+};
+
+//
+// exp table
+//
+
+static const Bit16u exprom[256] = {
+    0x000, 0x003, 0x006, 0x008, 0x00b, 0x00e, 0x011, 0x014,
+    0x016, 0x019, 0x01c, 0x01f, 0x022, 0x025, 0x028, 0x02a,
+    0x02d, 0x030, 0x033, 0x036, 0x039, 0x03c, 0x03f, 0x042,
+    0x045, 0x048, 0x04b, 0x04e, 0x051, 0x054, 0x057, 0x05a,
+    0x05d, 0x060, 0x063, 0x066, 0x069, 0x06c, 0x06f, 0x072,
+    0x075, 0x078, 0x07b, 0x07e, 0x082, 0x085, 0x088, 0x08b,
+    0x08e, 0x091, 0x094, 0x098, 0x09b, 0x09e, 0x0a1, 0x0a4,
+    0x0a8, 0x0ab, 0x0ae, 0x0b1, 0x0b5, 0x0b8, 0x0bb, 0x0be,
+    0x0c2, 0x0c5, 0x0c8, 0x0cc, 0x0cf, 0x0d2, 0x0d6, 0x0d9,
+    0x0dc, 0x0e0, 0x0e3, 0x0e7, 0x0ea, 0x0ed, 0x0f1, 0x0f4,
+    0x0f8, 0x0fb, 0x0ff, 0x102, 0x106, 0x109, 0x10c, 0x110,
+    0x114, 0x117, 0x11b, 0x11e, 0x122, 0x125, 0x129, 0x12c,
+    0x130, 0x134, 0x137, 0x13b, 0x13e, 0x142, 0x146, 0x149,
+    0x14d, 0x151, 0x154, 0x158, 0x15c, 0x160, 0x163, 0x167,
+    0x16b, 0x16f, 0x172, 0x176, 0x17a, 0x17e, 0x181, 0x185,
+    0x189, 0x18d, 0x191, 0x195, 0x199, 0x19c, 0x1a0, 0x1a4,
+    0x1a8, 0x1ac, 0x1b0, 0x1b4, 0x1b8, 0x1bc, 0x1c0, 0x1c4,
+    0x1c8, 0x1cc, 0x1d0, 0x1d4, 0x1d8, 0x1dc, 0x1e0, 0x1e4,
+    0x1e8, 0x1ec, 0x1f0, 0x1f5, 0x1f9, 0x1fd, 0x201, 0x205,
+    0x209, 0x20e, 0x212, 0x216, 0x21a, 0x21e, 0x223, 0x227,
+    0x22b, 0x230, 0x234, 0x238, 0x23c, 0x241, 0x245, 0x249,
+    0x24e, 0x252, 0x257, 0x25b, 0x25f, 0x264, 0x268, 0x26d,
+    0x271, 0x276, 0x27a, 0x27f, 0x283, 0x288, 0x28c, 0x291,
+    0x295, 0x29a, 0x29e, 0x2a3, 0x2a8, 0x2ac, 0x2b1, 0x2b5,
+    0x2ba, 0x2bf, 0x2c4, 0x2c8, 0x2cd, 0x2d2, 0x2d6, 0x2db,
+    0x2e0, 0x2e5, 0x2e9, 0x2ee, 0x2f3, 0x2f8, 0x2fd, 0x302,
+    0x306, 0x30b, 0x310, 0x315, 0x31a, 0x31f, 0x324, 0x329,
+    0x32e, 0x333, 0x338, 0x33d, 0x342, 0x347, 0x34c, 0x351,
+    0x356, 0x35b, 0x360, 0x365, 0x36a, 0x370, 0x375, 0x37a,
+    0x37f, 0x384, 0x38a, 0x38f, 0x394, 0x399, 0x39f, 0x3a4,
+    0x3a9, 0x3ae, 0x3b4, 0x3b9, 0x3bf, 0x3c4, 0x3c9, 0x3cf,
+    0x3d4, 0x3da, 0x3df, 0x3e4, 0x3ea, 0x3ef, 0x3f5, 0x3fa
+};
+
+//
+// freq mult table multiplied by 2
+//
+// 1/2, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 10, 12, 12, 15, 15
+//
+
+static const Bit8u mt[16] = {
+    1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+//
+// ksl table
+//
+
+static const Bit8u kslrom[16] = {
+    0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+static const Bit8u kslshift[4] = {
+    8, 1, 2, 0
+};
+
+//
+// envelope generator constants
+//
+
+static const Bit8u eg_incstep[3][4][8] = {
+    {
+        { 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 0, 0, 0, 0, 0, 0, 0, 0 }
+    },
+    {
+        { 0, 1, 0, 1, 0, 1, 0, 1 },
+        { 0, 1, 0, 1, 1, 1, 0, 1 },
+        { 0, 1, 1, 1, 0, 1, 1, 1 },
+        { 0, 1, 1, 1, 1, 1, 1, 1 }
+    },
+    {
+        { 1, 1, 1, 1, 1, 1, 1, 1 },
+        { 2, 2, 1, 1, 1, 1, 1, 1 },
+        { 2, 2, 1, 1, 2, 2, 1, 1 },
+        { 2, 2, 2, 2, 2, 2, 1, 1 }
+    }
+};
+
+static const Bit8u eg_incdesc[16] = {
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2
+};
+
+static const Bit8s eg_incsh[16] = {
+    0, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0, -1, -2
+};
+
+//
+// address decoding
+//
+
+static const Bit8s ad_slot[0x20] = {
+    0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1,
+    12, 13, 14, 15, 16, 17, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const Bit8u ch_slot[18] = {
+    0, 1, 2, 6, 7, 8, 12, 13, 14, 18, 19, 20, 24, 25, 26, 30, 31, 32
+};
+
+
+//
+// Envelope generator
+//
+
+enum envelope_gen_num
+{
+    envelope_gen_num_off = 0,
+    envelope_gen_num_attack = 1,
+    envelope_gen_num_decay = 2,
+    envelope_gen_num_sustain = 3,
+    envelope_gen_num_release = 4
+};
+
+//
+// Waveforms by phase, the low bits hold the log sine attenuation and bit 15
+// the sign of the output
+//
+
+static Bit16u wf_table[8][1024];
+
+//
+// eg_incstep with the four low rate bits packed one per byte
+//
+
+static Bit32u eg_incpack[3][8];
+
+static int tables_valid;
+
+static void OPL3V_BuildTables(void)
+{
+    Bit16u phase;
+    Bit16u out;
+    Bit16u neg;
+    Bit8u desc;
+    Bit8u step;
+
+    for (phase = 0; phase < 1024; phase++)
+    {
+        //sine
+        if (phase & 0x100)
+        {
+            out = logsinrom[(phase & 0xff) ^ 0xff];
+        }
+        else
+        {
+            out = logsinrom[phase & 0xff];
+        }
+        neg = (phase & 0x200) ? 0x8000 : 0;
+        wf_table[0][phase] = out | neg;
+        //half sine
+        wf_table[1][phase] = (phase & 0x200) ? 0x1000 : out;
+        //abs sine
+        wf_table[2][phase] = out;
+        //pulse sine
+        wf_table[3][phase] = (phase & 0x100) ? 0x1000 : logsinrom[phase & 0xff];
+        //sine, even periods only
+        if (phase & 0x200)
+        {
+            out = 0x1000;
+        }
+        else if (phase & 0x80)
+        {
+            out = logsinrom[((phase ^ 0xff) << 1) & 0xff];
+        }
+        else
+        {
+            out = logsinrom[(phase << 1) & 0xff];
+        }
+        neg = ((phase & 0x300) == 0x100) ? 0x8000 : 0;
+        wf_table[4][phase] = out | neg;
+        //abs sine, even periods only
+        wf_table[5][phase] = out;
+        //square
+        wf_table[6][phase] = (phase & 0x200) ? 0x8000 : 0;
+        //derived square
+        if (phase & 0x200)
+        {
+            wf_table[7][phase] = ((((phase & 0x1ff) ^ 0x1ff) << 3)) | 0x8000;
+        }
+        else
+        {
+            wf_table[7][phase] = phase << 3;
+        }
+    }
+
+    for (desc = 0; desc < 3; desc++)
+    {
+        for (step = 0; step < 8; step++)
+        {
+            eg_incpack[desc][step] = (eg_incstep[desc][0][step] << 0)
+                                   | (eg_incstep[desc][1][step] << 8)
+                                   | (eg_incstep[desc][2][step] << 16)
+                                   | ((Bit32u)eg_incstep[desc][3][step] << 24);
+        }
+    }
+    tables_valid = 1;
+}
+
+static Bit8u OPL3V_EnvelopeCalcRate(opl3v_chip *chip, Bit8u slot, Bit8u reg_rate)
+{
+    opl3v_channel *channel = &chip->channel[chip->slot_channel[slot]];
+    Bit8u rate;
+    if (reg_rate == 0x00)
+    {
+        return 0x00;
+    }
+    rate = (reg_rate << 2)
+         + (chip->reg_ksr[slot] ? channel->ksv : (channel->ksv >> 2));
+    if (rate > 0x3c)
+    {
+        rate = 0x3c;
+    }
+    return rate;
+}
+
+static void OPL3V_EnvelopeUpdateBase(opl3v_chip *chip, Bit8u slot)
+{
+    chip->eg_base[slot] = (chip->reg_tl[slot] << 2)
+                        + (chip->eg_ksl[slot] >> kslshift[chip->reg_ksl[slot]]);
+}
+
+static void OPL3V_EnvelopeUpdateKSL(opl3v_chip *chip, Bit8u slot)
+{
+    opl3v_channel *channel = &chip->channel[chip->slot_channel[slot]];
+    Bit16s ksl = (kslrom[channel->f_num >> 6] << 2)
+               - ((0x08 - channel->block) << 5);
+    if (ksl < 0)
+    {
+        ksl = 0;
+    }
+    chip->eg_ksl[slot] = (Bit8u)ksl;
+    OPL3V_EnvelopeUpdateBase(chip, slot);
+}
+
+static void OPL3V_EnvelopeUpdateRate(opl3v_chip *chip, Bit8u slot)
+{
+    switch (chip->eg_gen[slot])
+    {
+    case envelope_gen_num_off:
+    case envelope_gen_num_attack:
+        chip->eg_rate[slot] = OPL3V_EnvelopeCalcRate(chip, slot, chip->reg_ar[slot]);
+        break;
+    case envelope_gen_num_decay:
+        chip->eg_rate[slot] = OPL3V_EnvelopeCalcRate(chip, slot, chip->reg_dr[slot]);
+        break;
+    case envelope_gen_num_sustain:
+    case envelope_gen_num_release:
+        chip->eg_rate[slot] = OPL3V_EnvelopeCalcRate(chip, slot, chip->reg_rr[slot]);
+        break;
+    }
+}
+
+static void OPL3V_EnvelopeGenRelease(opl3v_chip *chip, Bit8u slot)
+{
+    if (chip->eg_rout[slot] >= 0x1ff)
+    {
+        chip->eg_gen[slot] = envelope_gen_num_off;
+        chip->eg_rout[slot] = 0x1ff;
+        OPL3V_EnvelopeUpdateRate(chip, slot);
+        return;
+    }
+    chip->eg_rout[slot] += chip->eg_inc[slot];
+}
+
+// one envelope step of one slot
+static void OPL3V_EnvelopeGen(opl3v_chip *chip, Bit8u slot)
+{
+    switch (chip->eg_gen[slot])
+    {
+    case envelope_gen_num_off:
+        chip->eg_rout[slot] = 0x1ff;
+        break;
+    case envelope_gen_num_attack:
+        if (chip->eg_rout[slot] == 0x00)
+        {
+            chip->eg_gen[slot] = envelope_gen_num_decay;
+            OPL3V_EnvelopeUpdateRate(chip, slot);
+            break;
+        }
+        chip->eg_rout[slot] += ((~chip->eg_rout[slot]) * chip->eg_inc[slot]) >> 3;
+        if (chip->eg_rout[slot] < 0x00)
+        {
+            chip->eg_rout[slot] = 0x00;
+        }
+        break;
+    case envelope_gen_num_decay:
+        if (chip->eg_rout[slot] >= chip->eg_sl[slot])
+        {
+            chip->eg_gen[slot] = envelope_gen_num_sustain;
+            OPL3V_EnvelopeUpdateRate(chip, slot);
+            break;
+        }
+        chip->eg_rout[slot] += chip->eg_inc[slot];
+        break;
+    case envelope_gen_num_sustain:
+        if (!chip->reg_type[slot])
+        {
+            OPL3V_EnvelopeGenRelease(chip, slot);
+        }
+        break;
+    case envelope_gen_num_release:
+        OPL3V_EnvelopeGenRelease(chip, slot);
+        break;
+    }
+}
+
+// the increment only depends on the rate and the timer, so work it out
+// once for each rate rather than for each slot
+static void OPL3V_EnvelopeCalcInc(opl3v_chip *chip)
+{
+    Bit8u inc[64];
+    Bit8u rate_h;
+    Bit8u slot;
+    Bit32u word;
+
+    for (rate_h = 0; rate_h < 16; rate_h++)
+    {
+        word = 0;
+        if (eg_incsh[rate_h] > 0)
+        {
+            if ((chip->timer & ((1 << eg_incsh[rate_h]) - 1)) == 0)
+            {
+                word = eg_incpack[eg_incdesc[rate_h]]
+                                 [((chip->timer) >> eg_incsh[rate_h]) & 0x07];
+            }
+        }
+        else
+        {
+            // no byte exceeds 2 so the shift cannot carry between them
+            word = eg_incpack[eg_incdesc[rate_h]][chip->timer & 0x07]
+                 << (-eg_incsh[rate_h]);
+        }
+        inc[(rate_h << 2) | 0] = (Bit8u)(word >> 0);
+        inc[(rate_h << 2) | 1] = (Bit8u)(word >> 8);
+        inc[(rate_h << 2) | 2] = (Bit8u)(word >> 16);
+        inc[(rate_h << 2) | 3] = (Bit8u)(word >> 24);
+    }
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        chip->eg_inc[slot] = inc[chip->eg_rate[slot]];
+    }
+}
+
+static void OPL3V_EnvelopeCalc(opl3v_chip *chip)
+{
+    Bit8u slot;
+#if OPL3V_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(-1);
+    const __m128i level_max = _mm_set1_epi16(0x1ff);
+    const __m128i trem = _mm_set1_epi16(chip->tremolo);
+    const __m128i gen_off = _mm_set1_epi16(envelope_gen_num_off);
+    const __m128i gen_attack = _mm_set1_epi16(envelope_gen_num_attack);
+    const __m128i gen_decay = _mm_set1_epi16(envelope_gen_num_decay);
+    const __m128i gen_sustain = _mm_set1_epi16(envelope_gen_num_sustain);
+    const __m128i gen_release = _mm_set1_epi16(envelope_gen_num_release);
+    Bit8u lane;
+    int mask;
+
+    for (slot = 0; slot < OPL3V_LANES; slot += 8)
+    {
+        const __m128i rout = _mm_loadu_si128((const __m128i*)&chip->eg_rout[slot]);
+        const __m128i inc = _mm_loadu_si128((const __m128i*)&chip->eg_inc[slot]);
+        const __m128i gen = _mm_loadu_si128((const __m128i*)&chip->eg_gen[slot]);
+        const __m128i sl = _mm_loadu_si128((const __m128i*)&chip->eg_sl[slot]);
+        const __m128i hold = _mm_loadu_si128((const __m128i*)&chip->eg_hold[slot]);
+        const __m128i base = _mm_loadu_si128((const __m128i*)&chip->eg_base[slot]);
+        const __m128i am = _mm_loadu_si128((const __m128i*)&chip->eg_trem[slot]);
+        __m128i is_off, is_attack, is_decay, is_release, step, attack, next, trans;
+
+        _mm_storeu_si128((__m128i*)&chip->eg_out[slot],
+            _mm_add_epi16(_mm_add_epi16(rout, base), _mm_and_si128(trem, am)));
+
+        is_off = _mm_cmpeq_epi16(gen, gen_off);
+        is_attack = _mm_cmpeq_epi16(gen, gen_attack);
+        is_decay = _mm_cmpeq_epi16(gen, gen_decay);
+        // sustain behaves as release unless the envelope holds
+        is_release = _mm_or_si128(_mm_cmpeq_epi16(gen, gen_release),
+            _mm_andnot_si128(hold, _mm_cmpeq_epi16(gen, gen_sustain)));
+
+        // attack approaches zero exponentially, the rest step linearly
+        attack = _mm_add_epi16(rout, _mm_srai_epi16(
+            _mm_mullo_epi16(_mm_xor_si128(rout, ones), inc), 3));
+        attack = _mm_max_epi16(attack, zero);
+        step = _mm_add_epi16(rout, inc);
+
+        next = _mm_or_si128(_mm_and_si128(is_attack, attack),
+                            _mm_andnot_si128(is_attack, rout));
+        is_decay = _mm_or_si128(is_decay, is_release);
+        next = _mm_or_si128(_mm_and_si128(is_decay, step),
+                            _mm_andnot_si128(is_decay, next));
+        next = _mm_or_si128(_mm_and_si128(is_off, level_max),
+                            _mm_andnot_si128(is_off, next));
+
+        // lanes that change state keep their level and take the scalar path
+        trans = _mm_and_si128(is_attack, _mm_cmpeq_epi16(rout, zero));
+        trans = _mm_or_si128(trans, _mm_andnot_si128(_mm_cmplt_epi16(rout, sl),
+            _mm_cmpeq_epi16(gen, gen_decay)));
+        trans = _mm_or_si128(trans, _mm_andnot_si128(
+            _mm_cmplt_epi16(rout, level_max), is_release));
+        next = _mm_or_si128(_mm_and_si128(trans, rout),
+                            _mm_andnot_si128(trans, next));
+        _mm_storeu_si128((__m128i*)&chip->eg_rout[slot], next);
+
+        mask = _mm_movemask_epi8(trans);
+        for (lane = 0; mask; lane++, mask >>= 2)
+        {
+            if (mask & 1)
+            {
+                OPL3V_EnvelopeGen(chip, slot + lane);
+            }
+        }
+    }
+#else
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        chip->eg_out[slot] = chip->eg_rout[slot] + chip->eg_base[slot]
+                           + (chip->tremolo & chip->eg_trem[slot]);
+        OPL3V_EnvelopeGen(chip, slot);
+    }
+#endif
+}
+
+static void OPL3V_EnvelopeKeyOn(opl3v_chip *chip, Bit8u slot, Bit8u type)
+{
+    if (!chip->key[slot])
+    {
+        chip->eg_gen[slot] = envelope_gen_num_attack;
+        OPL3V_EnvelopeUpdateRate(chip, slot);
+        if ((chip->eg_rate[slot] >> 2) == 0x0f)
+        {
+            chip->eg_gen[slot] = envelope_gen_num_decay;
+            OPL3V_EnvelopeUpdateRate(chip, slot);
+            chip->eg_rout[slot] = 0x00;
+        }
+        chip->pg_phase[slot] = 0x00;
+    }
+    chip->key[slot] |= type;
+}
+
+static void OPL3V_EnvelopeKeyOff(opl3v_chip *chip, Bit8u slot, Bit8u type)
+{
+    if (chip->key[slot])
+    {
+        chip->key[slot] &= (~type);
+        if (!chip->key[slot])
+        {
+            chip->eg_gen[slot] = envelope_gen_num_release;
+            OPL3V_EnvelopeUpdateRate(chip, slot);
+        }
+    }
+}
+
+//
+// Phase Generator
+//
+
+// the phase step only changes on a register write or vibrato step so it is
+// kept per slot rather than worked out every sample
+static void OPL3V_PhaseUpdate(opl3v_chip *chip, Bit8u slot)
+{
+    opl3v_channel *channel = &chip->channel[chip->slot_channel[slot]];
+    Bit16u f_num;
+    Bit32u basefreq;
+
+    f_num = channel->f_num;
+    if (chip->reg_vib[slot])
+    {
+        Bit8s range;
+        Bit8u vibpos;
+
+        range = (f_num >> 7) & 7;
+        vibpos = chip->vibpos;
+
+        if (!(vibpos & 3))
+        {
+            range = 0;
+        }
+        else if (vibpos & 1)
+        {
+            range >>= 1;
+        }
+        range >>= chip->vibshift;
+
+        if (vibpos & 4)
+        {
+            range = -range;
+        }
+        f_num += range;
+    }
+    basefreq = (f_num << channel->block) >> 1;
+    chip->pg_inc[slot] = (basefreq * mt[chip->reg_mult[slot]]) >> 1;
+}
+
+static void OPL3V_PhaseUpdateAll(opl3v_chip *chip)
+{
+    Bit8u slot;
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        OPL3V_PhaseUpdate(chip, slot);
+    }
+}
+
+static void OPL3V_PhaseUpdateChannel(opl3v_chip *chip, opl3v_channel *channel)
+{
+    OPL3V_PhaseUpdate(chip, channel->slots[0]);
+    OPL3V_PhaseUpdate(chip, channel->slots[1]);
+}
+
+static void OPL3V_PhaseGenerate(opl3v_chip *chip)
+{
+    Bit8u slot;
+#if OPL3V_SSE2
+    for (slot = 0; slot < OPL3V_SLOTS; slot += 4)
+    {
+        __m128i *phase = (__m128i*)&chip->pg_phase[slot];
+        const __m128i inc = _mm_loadu_si128((const __m128i*)&chip->pg_inc[slot]);
+        _mm_storeu_si128(phase, _mm_add_epi32(_mm_loadu_si128(phase), inc));
+    }
+#else
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        chip->pg_phase[slot] += chip->pg_inc[slot];
+    }
+#endif
+}
+
+//
+// Noise Generator
+//
+
+static void OPL3V_NoiseGenerate(opl3v_chip *chip)
+{
+    if (chip->noise & 0x01)
+    {
+        chip->noise ^= 0x800302;
+    }
+    chip->noise >>= 1;
+}
+
+//
+// Slot
+//
+
+static void OPL3V_SlotWrite20(opl3v_chip *chip, Bit8u slot, Bit8u data)
+{
+    chip->eg_trem[slot] = ((data >> 7) & 0x01) ? ~0 : 0;
+    chip->reg_vib[slot] = (data >> 6) & 0x01;
+    chip->reg_type[slot] = (data >> 5) & 0x01;
+    chip->eg_hold[slot] = chip->reg_type[slot] ? ~0 : 0;
+    chip->reg_ksr[slot] = (data >> 4) & 0x01;
+    chip->reg_mult[slot] = data & 0x0f;
+    OPL3V_EnvelopeUpdateRate(chip, slot);
+    OPL3V_PhaseUpdate(chip, slot);
+}
+
+static void OPL3V_SlotWrite40(opl3v_chip *chip, Bit8u slot, Bit8u data)
+{
+    chip->reg_ksl[slot] = (data >> 6) & 0x03;
+    chip->reg_tl[slot] = data & 0x3f;
+    OPL3V_EnvelopeUpdateKSL(chip, slot);
+}
+
+static void OPL3V_SlotWrite60(opl3v_chip *chip, Bit8u slot, Bit8u data)
+{
+    chip->reg_ar[slot] = (data >> 4) & 0x0f;
+    chip->reg_dr[slot] = data & 0x0f;
+    OPL3V_EnvelopeUpdateRate(chip, slot);
+}
+
+static void OPL3V_SlotWrite80(opl3v_chip *chip, Bit8u slot, Bit8u data)
+{
+    chip->reg_sl[slot] = (data >> 4) & 0x0f;
+    if (chip->reg_sl[slot] == 0x0f)
+    {
+        chip->reg_sl[slot] = 0x1f;
+    }
+    chip->eg_sl[slot] = chip->reg_sl[slot] << 4;
+    chip->reg_rr[slot] = data & 0x0f;
+    OPL3V_EnvelopeUpdateRate(chip, slot);
+}
+
+static void OPL3V_SlotWriteE0(opl3v_chip *chip, Bit8u slot, Bit8u data)
+{
+    chip->reg_wf[slot] = data & 0x07;
+    if (chip->newm == 0x00)
+    {
+        chip->reg_wf[slot] &= 0x03;
+    }
+}
+
+static void OPL3V_SlotGeneratePhase(opl3v_chip *chip, Bit8u slot, Bit16u phase)
+{
+    const Bit16u wf = wf_table[chip->reg_wf[slot]][phase & 0x3ff];
+    Bit32u level = (wf & 0x7fff) + ((Bit16u)chip->eg_out[slot] << 3);
+    if (level > 0x1fff)
+    {
+        level = 0x1fff;
+    }
+    chip->out[slot] = (Bit16s)((((exprom[(level & 0xff) ^ 0xff] | 0x400) << 1)
+                                >> (level >> 8)) ^ -(wf >> 15));
+}
+
+static void OPL3V_SlotGenerate(opl3v_chip *chip, Bit8u slot)
+{
+    OPL3V_SlotGeneratePhase(chip, slot,
+                            (Bit16u)(chip->pg_phase[slot] >> 9) + *chip->mod[slot]);
+}
+
+static void OPL3V_SlotGenerateZM(opl3v_chip *chip, Bit8u slot)
+{
+    OPL3V_SlotGeneratePhase(chip, slot, (Bit16u)(chip->pg_phase[slot] >> 9));
+}
+
+// fbmul is a power of two so the high half of the product is the shift
+static void OPL3V_SlotCalcFB(opl3v_chip *chip)
+{
+    Bit8u slot;
+#if OPL3V_SSE2
+    for (slot = 0; slot < OPL3V_LANES; slot += 8)
+    {
+        const __m128i out = _mm_loadu_si128((const __m128i*)&chip->out[slot]);
+        const __m128i prout = _mm_loadu_si128((const __m128i*)&chip->prout[slot]);
+        const __m128i fbmul = _mm_loadu_si128((const __m128i*)&chip->fbmul[slot]);
+        _mm_storeu_si128((__m128i*)&chip->fbmod[slot],
+                         _mm_mulhi_epi16(_mm_add_epi16(prout, out), fbmul));
+        _mm_storeu_si128((__m128i*)&chip->prout[slot], out);
+    }
+#else
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        chip->fbmod[slot] = (Bit16s)(((chip->prout[slot] + chip->out[slot])
+                                      * chip->fbmul[slot]) >> 16);
+        chip->prout[slot] = chip->out[slot];
+    }
+#endif
+}
+
+//
+// Channel
+//
+
+static void OPL3V_ChannelSetupAlg(opl3v_chip *chip, opl3v_channel *channel);
+
+static void OPL3V_ChannelUpdateRhythm(opl3v_chip *chip, Bit8u data)
+{
+    opl3v_channel *channel6;
+    opl3v_channel *channel7;
+    opl3v_channel *channel8;
+    Bit8u chnum;
+
+    chip->rhy = data & 0x3f;
+    if (chip->rhy & 0x20)
+    {
+        channel6 = &chip->channel[6];
+        channel7 = &chip->channel[7];
+        channel8 = &chip->channel[8];
+        channel6->out[0] = &chip->out[channel6->slots[1]];
+        channel6->out[1] = &chip->out[channel6->slots[1]];
+        channel6->out[2] = &chip->zeromod;
+        channel6->out[3] = &chip->zeromod;
+        channel7->out[0] = &chip->out[channel7->slots[0]];
+        channel7->out[1] = &chip->out[channel7->slots[0]];
+        channel7->out[2] = &chip->out[channel7->slots[1]];
+        channel7->out[3] = &chip->out[channel7->slots[1]];
+        channel8->out[0] = &chip->out[channel8->slots[0]];
+        channel8->out[1] = &chip->out[channel8->slots[0]];
+        channel8->out[2] = &chip->out[channel8->slots[1]];
+        channel8->out[3] = &chip->out[channel8->slots[1]];
+        for (chnum = 6; chnum < 9; chnum++)
+        {
+            chip->channel[chnum].chtype = ch_drum;
+        }
+        OPL3V_ChannelSetupAlg(chip, channel6);
+        //hh
+        if (chip->rhy & 0x01)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel7->slots[0], egk_drum);
+        }
+        else
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel7->slots[0], egk_drum);
+        }
+        //tc
+        if (chip->rhy & 0x02)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel8->slots[1], egk_drum);
+        }
+        else
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel8->slots[1], egk_drum);
+        }
+        //tom
+        if (chip->rhy & 0x04)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel8->slots[0], egk_drum);
+        }
+        else
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel8->slots[0], egk_drum);
+        }
+        //sd
+        if (chip->rhy & 0x08)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel7->slots[1], egk_drum);
+        }
+        else
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel7->slots[1], egk_drum);
+        }
+        //bd
+        if (chip->rhy & 0x10)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel6->slots[0], egk_drum);
+            OPL3V_EnvelopeKeyOn(chip, channel6->slots[1], egk_drum);
+        }
+        else
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel6->slots[0], egk_drum);
+            OPL3V_EnvelopeKeyOff(chip, channel6->slots[1], egk_drum);
+        }
+    }
+    else
+    {
+        for (chnum = 6; chnum < 9; chnum++)
+        {
+            chip->channel[chnum].chtype = ch_2op;
+            OPL3V_ChannelSetupAlg(chip, &chip->channel[chnum]);
+            OPL3V_EnvelopeKeyOff(chip, chip->channel[chnum].slots[0], egk_drum);
+            OPL3V_EnvelopeKeyOff(chip, chip->channel[chnum].slots[1], egk_drum);
+        }
+    }
+}
+
+static void OPL3V_ChannelUpdateKSLRate(opl3v_chip *chip, opl3v_channel *channel)
+{
+    OPL3V_EnvelopeUpdateKSL(chip, channel->slots[0]);
+    OPL3V_EnvelopeUpdateKSL(chip, channel->slots[1]);
+    OPL3V_EnvelopeUpdateRate(chip, channel->slots[0]);
+    OPL3V_EnvelopeUpdateRate(chip, channel->slots[1]);
+    OPL3V_PhaseUpdateChannel(chip, channel);
+}
+
+static void OPL3V_ChannelWriteA0(opl3v_chip *chip, opl3v_channel *channel, Bit8u data)
+{
+    if (chip->newm && channel->chtype == ch_4op2)
+    {
+        return;
+    }
+    channel->f_num = (channel->f_num & 0x300) | data;
+    channel->ksv = (channel->block << 1)
+                 | ((channel->f_num >> (0x09 - chip->nts)) & 0x01);
+    OPL3V_ChannelUpdateKSLRate(chip, channel);
+    if (chip->newm && channel->chtype == ch_4op)
+    {
+        channel->pair->f_num = channel->f_num;
+        channel->pair->ksv = channel->ksv;
+        OPL3V_ChannelUpdateKSLRate(chip, channel->pair);
+    }
+}
+
+static void OPL3V_ChannelWriteB0(opl3v_chip *chip, opl3v_channel *channel, Bit8u data)
+{
+    if (chip->newm && channel->chtype == ch_4op2)
+    {
+        return;
+    }
+    channel->f_num = (channel->f_num & 0xff) | ((data & 0x03) << 8);
+    channel->block = (data >> 2) & 0x07;
+    channel->ksv = (channel->block << 1)
+                 | ((channel->f_num >> (0x09 - chip->nts)) & 0x01);
+    OPL3V_ChannelUpdateKSLRate(chip, channel);
+    if (chip->newm && channel->chtype == ch_4op)
+    {
+        channel->pair->f_num = channel->f_num;
+        channel->pair->block = channel->block;
+        channel->pair->ksv = channel->ksv;
+        OPL3V_ChannelUpdateKSLRate(chip, channel->pair);
+    }
+}
+
+static void OPL3V_ChannelSetupAlg(opl3v_chip *chip, opl3v_channel *channel)
+{
+    const Bit8u s0 = channel->slots[0];
+    const Bit8u s1 = channel->slots[1];
+    Bit8u p0;
+    Bit8u p1;
+
+    if (channel->chtype == ch_drum)
+    {
+        switch (channel->alg & 0x01)
+        {
+        case 0x00:
+            chip->mod[s0] = &chip->fbmod[s0];
+            chip->mod[s1] = &chip->out[s0];
+            break;
+        case 0x01:
+            chip->mod[s0] = &chip->fbmod[s0];
+            chip->mod[s1] = &chip->zeromod;
+            break;
+        }
+        return;
+    }
+    if (channel->alg & 0x08)
+    {
+        return;
+    }
+    if (channel->alg & 0x04)
+    {
+        p0 = channel->pair->slots[0];
+        p1 = channel->pair->slots[1];
+        channel->pair->out[0] = &chip->zeromod;
+        channel->pair->out[1] = &chip->zeromod;
+        channel->pair->out[2] = &chip->zeromod;
+        channel->pair->out[3] = &chip->zeromod;
+        switch (channel->alg & 0x03)
+        {
+        case 0x00:
+            chip->mod[p0] = &chip->fbmod[p0];
+            chip->mod[p1] = &chip->out[p0];
+            chip->mod[s0] = &chip->out[p1];
+            chip->mod[s1] = &chip->out[s0];
+            channel->out[0] = &chip->out[s1];
+            channel->out[1] = &chip->zeromod;
+            channel->out[2] = &chip->zeromod;
+            channel->out[3] = &chip->zeromod;
+            break;
+        case 0x01:
+            chip->mod[p0] = &chip->fbmod[p0];
+            chip->mod[p1] = &chip->out[p0];
+            chip->mod[s0] = &chip->zeromod;
+            chip->mod[s1] = &chip->out[s0];
+            channel->out[0] = &chip->out[p1];
+            channel->out[1] = &chip->out[s1];
+            channel->out[2] = &chip->zeromod;
+            channel->out[3] = &chip->zeromod;
+            break;
+        case 0x02:
+            chip->mod[p0] = &chip->fbmod[p0];
+            chip->mod[p1] = &chip->zeromod;
+            chip->mod[s0] = &chip->out[p1];
+            chip->mod[s1] = &chip->out[s0];
+            channel->out[0] = &chip->out[p0];
+            channel->out[1] = &chip->out[s1];
+            channel->out[2] = &chip->zeromod;
+            channel->out[3] = &chip->zeromod;
+            break;
+        case 0x03:
+            chip->mod[p0] = &chip->fbmod[p0];
+            chip->mod[p1] = &chip->zeromod;
+            chip->mod[s0] = &chip->out[p1];
+            chip->mod[s1] = &chip->zeromod;
+            channel->out[0] = &chip->out[p0];
+            channel->out[1] = &chip->out[s0];
+            channel->out[2] = &chip->out[s1];
+            channel->out[3] = &chip->zeromod;
+            break;
+        }
+    }
+    else
+    {
+        switch (channel->alg & 0x01)
+        {
+        case 0x00:
+            chip->mod[s0] = &chip->fbmod[s0];
+            chip->mod[s1] = &chip->out[s0];
+            channel->out[0] = &chip->out[s1];
+            channel->out[1] = &chip->zeromod;
+            channel->out[2] = &chip->zeromod;
+            channel->out[3] = &chip->zeromod;
+            break;
+        case 0x01:
+            chip->mod[s0] = &chip->fbmod[s0];
+            chip->mod[s1] = &chip->zeromod;
+            channel->out[0] = &chip->out[s0];
+            channel->out[1] = &chip->out[s1];
+            channel->out[2] = &chip->zeromod;
+            channel->out[3] = &chip->zeromod;
+            break;
+        }
+    }
+}
+
+static void OPL3V_ChannelWriteC0(opl3v_chip *chip, opl3v_channel *channel, Bit8u data)
+{
+    channel->fb = (data & 0x0e) >> 1;
+    chip->fbmul[channel->slots[0]] = channel->fb ? (1 << (channel->fb + 7)) : 0;
+    chip->fbmul[channel->slots[1]] = chip->fbmul[channel->slots[0]];
+    channel->con = data & 0x01;
+    channel->alg = channel->con;
+    if (chip->newm)
+    {
+        if (channel->chtype == ch_4op)
+        {
+            channel->pair->alg = 0x04 | (channel->con << 1) | (channel->pair->con);
+            channel->alg = 0x08;
+            OPL3V_ChannelSetupAlg(chip, channel->pair);
+        }
+        else if (channel->chtype == ch_4op2)
+        {
+            channel->alg = 0x04 | (channel->pair->con << 1) | (channel->con);
+            channel->pair->alg = 0x08;
+            OPL3V_ChannelSetupAlg(chip, channel);
+        }
+        else
+        {
+            OPL3V_ChannelSetupAlg(chip, channel);
+        }
+    }
+    else
+    {
+        OPL3V_ChannelSetupAlg(chip, channel);
+    }
+    if (chip->newm)
+    {
+        channel->cha = ((data >> 4) & 0x01) ? ~0 : 0;
+        channel->chb = ((data >> 5) & 0x01) ? ~0 : 0;
+    }
+    else
+    {
+        channel->cha = channel->chb = ~0;
+    }
+}
+
+static void OPL3V_ChannelKeyOn(opl3v_chip *chip, opl3v_channel *channel)
+{
+    if (chip->newm)
+    {
+        if (channel->chtype == ch_4op)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel->slots[0], egk_norm);
+            OPL3V_EnvelopeKeyOn(chip, channel->slots[1], egk_norm);
+            OPL3V_EnvelopeKeyOn(chip, channel->pair->slots[0], egk_norm);
+            OPL3V_EnvelopeKeyOn(chip, channel->pair->slots[1], egk_norm);
+        }
+        else if (channel->chtype == ch_2op || channel->chtype == ch_drum)
+        {
+            OPL3V_EnvelopeKeyOn(chip, channel->slots[0], egk_norm);
+            OPL3V_EnvelopeKeyOn(chip, channel->slots[1], egk_norm);
+        }
+    }
+    else
+    {
+        OPL3V_EnvelopeKeyOn(chip, channel->slots[0], egk_norm);
+        OPL3V_EnvelopeKeyOn(chip, channel->slots[1], egk_norm);
+    }
+}
+
+static void OPL3V_ChannelKeyOff(opl3v_chip *chip, opl3v_channel *channel)
+{
+    if (chip->newm)
+    {
+        if (channel->chtype == ch_4op)
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel->slots[0], egk_norm);
+            OPL3V_EnvelopeKeyOff(chip, channel->slots[1], egk_norm);
+            OPL3V_EnvelopeKeyOff(chip, channel->pair->slots[0], egk_norm);
+            OPL3V_EnvelopeKeyOff(chip, channel->pair->slots[1], egk_norm);
+        }
+        else if (channel->chtype == ch_2op || channel->chtype == ch_drum)
+        {
+            OPL3V_EnvelopeKeyOff(chip, channel->slots[0], egk_norm);
+            OPL3V_EnvelopeKeyOff(chip, channel->slots[1], egk_norm);
+        }
+    }
+    else
+    {
+        OPL3V_EnvelopeKeyOff(chip, channel->slots[0], egk_norm);
+        OPL3V_EnvelopeKeyOff(chip, channel->slots[1], egk_norm);
+    }
+}
+
+static void OPL3V_ChannelSet4Op(opl3v_chip *chip, Bit8u data)
+{
+    Bit8u bit;
+    Bit8u chnum;
+    for (bit = 0; bit < 6; bit++)
+    {
+        chnum = bit;
+        if (bit >= 3)
+        {
+            chnum += 9 - 3;
+        }
+        if ((data >> bit) & 0x01)
+        {
+            chip->channel[chnum].chtype = ch_4op;
+            chip->channel[chnum + 3].chtype = ch_4op2;
+        }
+        else
+        {
+            chip->channel[chnum].chtype = ch_2op;
+            chip->channel[chnum + 3].chtype = ch_2op;
+        }
+    }
+}
+
+static Bit16s OPL3V_ClipSample(Bit32s sample)
+{
+    if (sample > 32767)
+    {
+        sample = 32767;
+    }
+    else if (sample < -32768)
+    {
+        sample = -32768;
+    }
+    return (Bit16s)sample;
+}
+
+// `phase17_prev` is the top cymbal phase from before this sample's phase step
+static void OPL3V_GenerateRhythm1(opl3v_chip *chip, Bit32u phase17_prev)
+{
+    opl3v_channel *channel6;
+    opl3v_channel *channel7;
+    opl3v_channel *channel8;
+    Bit16u phase14;
+    Bit16u phase17;
+    Bit16u phase;
+    Bit16u phasebit;
+
+    channel6 = &chip->channel[6];
+    channel7 = &chip->channel[7];
+    channel8 = &chip->channel[8];
+    OPL3V_SlotGenerate(chip, channel6->slots[0]);
+    phase14 = (chip->pg_phase[channel7->slots[0]] >> 9) & 0x3ff;
+    phase17 = (phase17_prev >> 9) & 0x3ff;
+    phase = 0x00;
+    //hh tc phase bit
+    phasebit = ((phase14 & 0x08) | (((phase14 >> 5) ^ phase14) & 0x04)
+             | (((phase17 >> 2) ^ phase17) & 0x08)) ? 0x01 : 0x00;
+    //hh
+    phase = (phasebit << 9)
+          | (0x34 << ((phasebit ^ (chip->noise & 0x01)) << 1));
+    OPL3V_SlotGeneratePhase(chip, channel7->slots[0], phase);
+    //tt
+    OPL3V_SlotGenerateZM(chip, channel8->slots[0]);
+}
+
+static void OPL3V_GenerateRhythm2(opl3v_chip *chip)
+{
+    opl3v_channel *channel6;
+    opl3v_channel *channel7;
+    opl3v_channel *channel8;
+    Bit16u phase14;
+    Bit16u phase17;
+    Bit16u phase;
+    Bit16u phasebit;
+
+    channel6 = &chip->channel[6];
+    channel7 = &chip->channel[7];
+    channel8 = &chip->channel[8];
+    OPL3V_SlotGenerate(chip, channel6->slots[1]);
+    phase14 = (chip->pg_phase[channel7->slots[0]] >> 9) & 0x3ff;
+    phase17 = (chip->pg_phase[channel8->slots[1]] >> 9) & 0x3ff;
+    phase = 0x00;
+    //hh tc phase bit
+    phasebit = ((phase14 & 0x08) | (((phase14 >> 5) ^ phase14) & 0x04)
+             | (((phase17 >> 2) ^ phase17) & 0x08)) ? 0x01 : 0x00;
+    //sd
+    phase = (0x100 << ((phase14 >> 8) & 0x01)) ^ ((chip->noise & 0x01) << 8);
+    OPL3V_SlotGeneratePhase(chip, channel7->slots[1], phase);
+    //tc
+    phase = 0x100 | (phasebit << 9);
+    OPL3V_SlotGeneratePhase(chip, channel8->slots[1], phase);
+}
+
+static Bit32s OPL3V_MixChannels(opl3v_chip *chip, const int right)
+{
+    Bit8u ii;
+    Bit8u jj;
+    Bit16s accm;
+    Bit32s mix = 0;
+
+    for (ii = 0; ii < 18; ii++)
+    {
+        accm = 0;
+        for (jj = 0; jj < 4; jj++)
+        {
+            accm += *chip->channel[ii].out[jj];
+        }
+        mix += (Bit16s)(accm & (right ? chip->channel[ii].chb : chip->channel[ii].cha));
+    }
+    return mix;
+}
+
+void OPL3V_Generate(opl3v_chip *chip, Bit16s *buf)
+{
+    Bit8u ii;
+    Bit32u phase17;
+
+    buf[1] = OPL3V_ClipSample(chip->mixbuff[1]);
+
+    // opl3.c steps each slot just before it is generated, here every slot
+    // is stepped up front which only the rhythm section can observe
+    phase17 = chip->pg_phase[17];
+    OPL3V_SlotCalcFB(chip);
+    OPL3V_PhaseGenerate(chip);
+    OPL3V_EnvelopeCalcInc(chip);
+    OPL3V_EnvelopeCalc(chip);
+
+    for (ii = 0; ii < 12; ii++)
+    {
+        OPL3V_SlotGenerate(chip, ii);
+    }
+
+    if (chip->rhy & 0x20)
+    {
+        OPL3V_GenerateRhythm1(chip, phase17);
+    }
+    else
+    {
+        OPL3V_SlotGenerate(chip, 12);
+        OPL3V_SlotGenerate(chip, 13);
+        OPL3V_SlotGenerate(chip, 14);
+    }
+
+    chip->mixbuff[0] = OPL3V_MixChannels(chip, 0);
+
+    if (chip->rhy & 0x20)
+    {
+        OPL3V_GenerateRhythm2(chip);
+    }
+    else
+    {
+        OPL3V_SlotGenerate(chip, 15);
+        OPL3V_SlotGenerate(chip, 16);
+        OPL3V_SlotGenerate(chip, 17);
+    }
+
+    buf[0] = OPL3V_ClipSample(chip->mixbuff[0]);
+
+    for (ii = 18; ii < 33; ii++)
+    {
+        OPL3V_SlotGenerate(chip, ii);
+    }
+
+    chip->mixbuff[1] = OPL3V_MixChannels(chip, 1);
+
+    for (ii = 33; ii < 36; ii++)
+    {
+        OPL3V_SlotGenerate(chip, ii);
+    }
+
+    OPL3V_NoiseGenerate(chip);
+
+    if ((chip->timer & 0x3f) == 0x3f)
+    {
+        chip->tremolopos = (chip->tremolopos + 1) % 210;
+    }
+    if (chip->tremolopos < 105)
+    {
+        chip->tremolo = chip->tremolopos >> chip->tremoloshift;
+    }
+    else
+    {
+        chip->tremolo = (210 - chip->tremolopos) >> chip->tremoloshift;
+    }
+
+    if ((chip->timer & 0x3ff) == 0x3ff)
+    {
+        chip->vibpos = (chip->vibpos + 1) & 7;
+        OPL3V_PhaseUpdateAll(chip);
+    }
+
+    chip->timer++;
+
+    while (chip->writebuf[chip->writebuf_cur].time <= chip->writebuf_samplecnt)
+    {
+        if (!(chip->writebuf[chip->writebuf_cur].reg & 0x200))
+        {
+            break;
+        }
+        chip->writebuf[chip->writebuf_cur].reg &= 0x1ff;
+        OPL3V_WriteReg(chip, chip->writebuf[chip->writebuf_cur].reg,
+                       chip->writebuf[chip->writebuf_cur].data);
+        chip->writebuf_cur = (chip->writebuf_cur + 1) % OPL_WRITEBUF_SIZE;
+    }
+    chip->writebuf_samplecnt++;
+}
+
+void OPL3V_GenerateResampled(opl3v_chip *chip, Bit16s *buf)
+{
+    while (chip->samplecnt >= chip->rateratio)
+    {
+        chip->oldsamples[0] = chip->samples[0];
+        chip->oldsamples[1] = chip->samples[1];
+        OPL3V_Generate(chip, chip->samples);
+        chip->samplecnt -= chip->rateratio;
+    }
+    buf[0] = (Bit16s)((chip->oldsamples[0] * (chip->rateratio - chip->samplecnt)
+                     + chip->samples[0] * chip->samplecnt) / chip->rateratio);
+    buf[1] = (Bit16s)((chip->oldsamples[1] * (chip->rateratio - chip->samplecnt)
+                     + chip->samples[1] * chip->samplecnt) / chip->rateratio);
+    chip->samplecnt += 1 << RSM_FRAC;
+}
+
+void OPL3V_Reset(opl3v_chip *chip, Bit32u samplerate)
+{
+    Bit8u slotnum;
+    Bit8u channum;
+
+    if (!tables_valid)
+    {
+        OPL3V_BuildTables();
+    }
+
+    memset(chip, 0, sizeof(opl3v_chip));
+    // the padding lanes sit in the off state where they never change
+    for (slotnum = 0; slotnum < OPL3V_LANES; slotnum++)
+    {
+        chip->eg_rout[slotnum] = 0x1ff;
+        chip->eg_out[slotnum] = 0x1ff;
+        chip->eg_gen[slotnum] = envelope_gen_num_off;
+    }
+    for (slotnum = 0; slotnum < OPL3V_SLOTS; slotnum++)
+    {
+        chip->mod[slotnum] = &chip->zeromod;
+    }
+    for (channum = 0; channum < 18; channum++)
+    {
+        chip->channel[channum].slots[0] = ch_slot[channum];
+        chip->channel[channum].slots[1] = ch_slot[channum] + 3;
+        chip->slot_channel[ch_slot[channum]] = channum;
+        chip->slot_channel[ch_slot[channum] + 3] = channum;
+        if ((channum % 9) < 3)
+        {
+            chip->channel[channum].pair = &chip->channel[channum + 3];
+        }
+        else if ((channum % 9) < 6)
+        {
+            chip->channel[channum].pair = &chip->channel[channum - 3];
+        }
+        chip->channel[channum].out[0] = &chip->zeromod;
+        chip->channel[channum].out[1] = &chip->zeromod;
+        chip->channel[channum].out[2] = &chip->zeromod;
+        chip->channel[channum].out[3] = &chip->zeromod;
+        chip->channel[channum].chtype = ch_2op;
+        chip->channel[channum].cha = ~0;
+        chip->channel[channum].chb = ~0;
+        OPL3V_ChannelSetupAlg(chip, &chip->channel[channum]);
+    }
+    chip->noise = 0x306600;
+    chip->rateratio = (samplerate << RSM_FRAC) / 49716;
+    chip->tremoloshift = 4;
+    chip->vibshift = 1;
+}
+
+void OPL3V_WriteReg(opl3v_chip *chip, Bit16u reg, Bit8u v)
+{
+    Bit8u high = (reg >> 8) & 0x01;
+    Bit8u regm = reg & 0xff;
+    switch (regm & 0xf0)
+    {
+    case 0x00:
+        if (high)
+        {
+            switch (regm & 0x0f)
+            {
+            case 0x04:
+                OPL3V_ChannelSet4Op(chip, v);
+                break;
+            case 0x05:
+                chip->newm = v & 0x01;
+                break;
+            }
+        }
+        else
+        {
+            switch (regm & 0x0f)
+            {
+            case 0x08:
+                chip->nts = (v >> 6) & 0x01;
+                break;
+            }
+        }
+        break;
+    case 0x20:
+    case 0x30:
+        if (ad_slot[regm & 0x1f] >= 0)
+        {
+            OPL3V_SlotWrite20(chip, 18 * high + ad_slot[regm & 0x1f], v);
+        }
+        break;
+    case 0x40:
+    case 0x50:
+        if (ad_slot[regm & 0x1f] >= 0)
+        {
+            OPL3V_SlotWrite40(chip, 18 * high + ad_slot[regm & 0x1f], v);
+        }
+        break;
+    case 0x60:
+    case 0x70:
+        if (ad_slot[regm & 0x1f] >= 0)
+        {
+            OPL3V_SlotWrite60(chip, 18 * high + ad_slot[regm & 0x1f], v);
+        }
+        break;
+    case 0x80:
+    case 0x90:
+        if (ad_slot[regm & 0x1f] >= 0)
+        {
+            OPL3V_SlotWrite80(chip, 18 * high + ad_slot[regm & 0x1f], v);
+        }
+        break;
+    case 0xe0:
+    case 0xf0:
+        if (ad_slot[regm & 0x1f] >= 0)
+        {
+            OPL3V_SlotWriteE0(chip, 18 * high + ad_slot[regm & 0x1f], v);
+        }
+        break;
+    case 0xa0:
+        if ((regm & 0x0f) < 9)
+        {
+            OPL3V_ChannelWriteA0(chip, &chip->channel[9 * high + (regm & 0x0f)], v);
+        }
+        break;
+    case 0xb0:
+        if (regm == 0xbd && !high)
+        {
+            chip->tremoloshift = (((v >> 7) ^ 1) << 1) + 2;
+            chip->vibshift = ((v >> 6) & 0x01) ^ 1;
+            OPL3V_PhaseUpdateAll(chip);
+            OPL3V_ChannelUpdateRhythm(chip, v);
+        }
+        else if ((regm & 0x0f) < 9)
+        {
+            OPL3V_ChannelWriteB0(chip, &chip->channel[9 * high + (regm & 0x0f)], v);
+            if (v & 0x20)
+            {
+                OPL3V_ChannelKeyOn(chip, &chip->channel[9 * high + (regm & 0x0f)]);
+            }
+            else
+            {
+                OPL3V_ChannelKeyOff(chip, &chip->channel[9 * high + (regm & 0x0f)]);
+            }
+        }
+        break;
+    case 0xc0:
+        if ((regm & 0x0f) < 9)
+        {
+            OPL3V_ChannelWriteC0(chip, &chip->channel[9 * high + (regm & 0x0f)], v);
+        }
+        break;
+    }
+}
+
+void OPL3V_WriteRegBuffered(opl3v_chip *chip, Bit16u reg, Bit8u v)
+{
+    Bit64u time1, time2;
+
+    if (chip->writebuf[chip->writebuf_last].reg & 0x200)
+    {
+        OPL3V_WriteReg(chip, chip->writebuf[chip->writebuf_last].reg & 0x1ff,
+                       chip->writebuf[chip->writebuf_last].data);
+
+        chip->writebuf_cur = (chip->writebuf_last + 1) % OPL_WRITEBUF_SIZE;
+        chip->writebuf_samplecnt = chip->writebuf[chip->writebuf_last].time;
+    }
+
+    chip->writebuf[chip->writebuf_last].reg = reg | 0x200;
+    chip->writebuf[chip->writebuf_last].data = v;
+    time1 = chip->writebuf_lasttime + OPL_WRITEBUF_DELAY;
+    time2 = chip->writebuf_samplecnt;
+
+    if (time1 < time2)
+    {
+        time1 = time2;
+    }
+
+    chip->writebuf[chip->writebuf_last].time = time1;
+    chip->writebuf_lasttime = time1;
+    chip->writebuf_last = (chip->writebuf_last + 1) % OPL_WRITEBUF_SIZE;
+}
+
+void OPL3V_GenerateStream(opl3v_chip *chip, Bit16s *sndptr, Bit32u numsamples)
+{
+    Bit32u i;
+
+    for(i = 0; i < numsamples; i++)
+    {
+        OPL3V_GenerateResampled(chip, sndptr);
+        sndptr += 2;
+    }
+}
+
+int OPL3V_IsIdle(const opl3v_chip *chip)
+{
+    Bit8u slot;
+    if (chip->writebuf[chip->writebuf_cur].reg & 0x200)
+    {
+        return 0;
+    }
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        if (chip->eg_gen[slot] != envelope_gen_num_off)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// step the chip state that runs while silent, as OPL3V_Generate would
+static void OPL3V_Skip(opl3v_chip *chip, Bit32u samples)
+{
+    Bit32u steps = 0;
+    Bit8u slot;
+
+    for (; samples; samples--)
+    {
+        OPL3V_NoiseGenerate(chip);
+        if ((chip->timer & 0x3f) == 0x3f)
+        {
+            chip->tremolopos = (chip->tremolopos + 1) % 210;
+        }
+        steps++;
+        if ((chip->timer & 0x3ff) == 0x3ff)
+        {
+            // the phase steps change with the vibrato position
+            for (slot = 0; slot < OPL3V_SLOTS; slot++)
+            {
+                chip->pg_phase[slot] += chip->pg_inc[slot] * steps;
+            }
+            steps = 0;
+            chip->vibpos = (chip->vibpos + 1) & 7;
+            OPL3V_PhaseUpdateAll(chip);
+        }
+        chip->timer++;
+        chip->writebuf_samplecnt++;
+    }
+    for (slot = 0; slot < OPL3V_SLOTS; slot++)
+    {
+        chip->pg_phase[slot] += chip->pg_inc[slot] * steps;
+    }
+    if (chip->tremolopos < 105)
+    {
+        chip->tremolo = chip->tremolopos >> chip->tremoloshift;
+    }
+    else
+    {
+        chip->tremolo = (210 - chip->tremolopos) >> chip->tremoloshift;
+    }
+    // drop the residue a silent chip leaves in its outputs
+    memset(chip->out, 0, sizeof(chip->out));
+    memset(chip->prout, 0, sizeof(chip->prout));
+    memset(chip->fbmod, 0, sizeof(chip->fbmod));
+    chip->mixbuff[0] = 0;
+    chip->mixbuff[1] = 0;
+}
+
+void OPL3V_SkipStream(opl3v_chip *chip, Bit32u numsamples)
+{
+    Bit32u samples = 0;
+    Bit32u i;
+
+    // count the samples the resampler would have asked for
+    for (i = 0; i < numsamples; i++)
+    {
+        while (chip->samplecnt >= chip->rateratio)
+        {
+            chip->samplecnt -= chip->rateratio;
+            samples++;
+        }
+        chip->samplecnt += 1 << RSM_FRAC;
+    }
+    if (samples)
+    {
+        chip->oldsamples[0] = chip->oldsamples[1] = 0;
+        chip->samples[0] = chip->samples[1] = 0;
+        OPL3V_Skip(chip, samples);
+    }
+}
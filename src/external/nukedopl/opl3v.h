@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2013-2016 Alexey Khokholov (Nuke.YKT)
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+//  Nuked OPL3 emulator, structure of arrays variant.
+//
+//  Slot state is held in arrays indexed by slot number rather than one
+//  struct per slot, so that feedback, phase and envelope can be evaluated
+//  for all 36 slots at once in SIMD lanes.  Output is bit exact with
+//  opl3.c, which tests/opl3 checks.
+//
+// version: 1.7.4
+//
+
+#ifndef OPL_OPL3V_H
+#define OPL_OPL3V_H
+
+#include "opl3.h"
+
+#define OPL3V_SLOTS 36
+// slots rounded up to a whole number of 8 lane vectors
+#define OPL3V_LANES 40
+
+typedef struct _opl3v_channel opl3v_channel;
+typedef struct _opl3v_chip opl3v_chip;
+
+struct _opl3v_channel {
+    Bit8u slots[2];
+    opl3v_channel *pair;
+    Bit16s *out[4];
+    Bit8u chtype;
+    Bit16u f_num;
+    Bit8u block;
+    Bit8u fb;
+    Bit8u con;
+    Bit8u alg;
+    Bit8u ksv;
+    Bit16u cha, chb;
+};
+
+struct _opl3v_chip {
+    // lane state, 16 bit so eight slots fit in a vector
+    Bit16s out[OPL3V_LANES];
+    Bit16s prout[OPL3V_LANES];
+    Bit16s fbmod[OPL3V_LANES];
+    // feedback as a multiplier, (1 << (fb + 7)) or 0 for none
+    Bit16s fbmul[OPL3V_LANES];
+    Bit16s eg_rout[OPL3V_LANES];
+    Bit16s eg_out[OPL3V_LANES];
+    Bit16s eg_inc[OPL3V_LANES];
+    Bit16s eg_gen[OPL3V_LANES];
+    // total level and key scale attenuation
+    Bit16s eg_base[OPL3V_LANES];
+    // sustain level << 4
+    Bit16s eg_sl[OPL3V_LANES];
+    // ~0 when tremolo is enabled
+    Bit16s eg_trem[OPL3V_LANES];
+    // ~0 when the envelope holds at sustain
+    Bit16s eg_hold[OPL3V_LANES];
+    Bit32u pg_phase[OPL3V_SLOTS];
+    // phase step including vibrato at the current position
+    Bit32u pg_inc[OPL3V_SLOTS];
+
+    Bit16s *mod[OPL3V_SLOTS];
+    Bit8u slot_channel[OPL3V_SLOTS];
+    Bit8u eg_rate[OPL3V_SLOTS];
+    Bit8u eg_ksl[OPL3V_SLOTS];
+    Bit8u reg_vib[OPL3V_SLOTS];
+    Bit8u reg_type[OPL3V_SLOTS];
+    Bit8u reg_ksr[OPL3V_SLOTS];
+    Bit8u reg_mult[OPL3V_SLOTS];
+    Bit8u reg_ksl[OPL3V_SLOTS];
+    Bit8u reg_tl[OPL3V_SLOTS];
+    Bit8u reg_ar[OPL3V_SLOTS];
+    Bit8u reg_dr[OPL3V_SLOTS];
+    Bit8u reg_sl[OPL3V_SLOTS];
+    Bit8u reg_rr[OPL3V_SLOTS];
+    Bit8u reg_wf[OPL3V_SLOTS];
+    Bit8u key[OPL3V_SLOTS];
+
+    opl3v_channel channel[18];
+    Bit16u timer;
+    Bit8u newm;
+    Bit8u nts;
+    Bit8u rhy;
+    Bit8u vibpos;
+    Bit8u vibshift;
+    Bit8u tremolo;
+    Bit8u tremolopos;
+    Bit8u tremoloshift;
+    Bit32u noise;
+    Bit16s zeromod;
+    Bit32s mixbuff[2];
+    //OPL3L
+    Bit32s rateratio;
+    Bit32s samplecnt;
+    Bit16s oldsamples[2];
+    Bit16s samples[2];
+
+    Bit64u writebuf_samplecnt;
+    Bit32u writebuf_cur;
+    Bit32u writebuf_last;
+    Bit64u writebuf_lasttime;
+    opl3_writebuf writebuf[OPL_WRITEBUF_SIZE];
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+  void OPL3V_Generate(opl3v_chip *chip, Bit16s *buf);
+  void OPL3V_GenerateResampled(opl3v_chip *chip, Bit16s *buf);
+  void OPL3V_Reset(opl3v_chip *chip, Bit32u samplerate);
+  void OPL3V_WriteReg(opl3v_chip *chip, Bit16u reg, Bit8u v);
+  void OPL3V_WriteRegBuffered(opl3v_chip *chip, Bit16u reg, Bit8u v);
+
+  // generate a stereo interleaved audio stream
+  void OPL3V_GenerateStream(opl3v_chip *chip, Bit16s *sndptr, Bit32u numsamples);
+
+  // every envelope is off and no buffered write is waiting, so the chip
+  // outputs nothing but rounding residue until the next register write
+  int OPL3V_IsIdle(const opl3v_chip *chip);
+  // advance an idle chip past `numsamples` stream samples of silence without
+  // generating them, its timer, lfos, noise and phases keep exact step
+  void OPL3V_SkipStream(opl3v_chip *chip, Bit32u numsamples);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif
@@ -26,50 +26,75 @@
 
 struct dmachan_s dmachan[4];
 static uint8_t flipflop = 0;
+// terminal count reached, per channel, cleared when read
+static uint8_t status;
 
-// used by blaster.c
-uint8_t read8237(uint8_t channel) {
-  uint8_t ret;
-  if (dmachan[channel].masked)
-    return (128);
-  if (dmachan[channel].autoinit &&
-      (dmachan[channel].count > dmachan[channel].reload))
-    dmachan[channel].count = 0;
-  if (dmachan[channel].count > dmachan[channel].reload)
-    return (128);
-  if (dmachan[channel].direction == 0)
-    ret = RAM[dmachan[channel].page + dmachan[channel].addr +
-              dmachan[channel].count];
+// page register port for each channel
+static const uint8_t page_port[4] = {0x87, 0x83, 0x81, 0x82};
+
+// byte of the channel address or count register at the flipflop
+static void write_word(uint32_t *reg, uint8_t value) {
+  if (flipflop == 1)
+    *reg = (*reg & 0x00FF) | ((uint32_t)value << 8);
   else
-    ret = RAM[dmachan[channel].page + dmachan[channel].addr -
-              dmachan[channel].count];
-  dmachan[channel].count++;
-  return (ret);
+    *reg = (*reg & 0xFF00) | value;
+  flipflop = ~flipflop & 1;
+}
+
+static uint8_t read_word(uint32_t value) {
+  const uint8_t ret = (flipflop == 1) ? (uint8_t)(value >> 8) : (uint8_t)value;
+  flipflop = ~flipflop & 1;
+  return ret;
+}
+
+// Move up to `size` bytes of a memory read transfer on `channel` into `dst`
+// in as few blocks as the address wrap allows, rather than a byte at a
+// time, returns the bytes moved.  A channel stops at terminal count unless
+// it is set to auto initialize, in which case it carries on from the start.
+uint32_t i8237_read_block(uint8_t channel, uint8_t *dst, uint32_t size) {
+  struct dmachan_s *c = &dmachan[channel & 3];
+  uint32_t done = 0;
+  while (done < size && !c->masked && c->count <= c->reload) {
+    // the address counts within its 64k page
+    uint32_t span = SDL_min(size - done, c->reload + 1 - c->count);
+    if (c->direction == 0) {
+      const uint32_t addr = (c->addr + c->count) & 0xFFFF;
+      span = SDL_min(span, 0x10000 - addr);
+      mem_read(dst + done, c->page + addr, span);
+    }
+    else {
+      for (uint32_t i = 0; i < span; ++i) {
+        const uint32_t addr = (c->addr - c->count - i) & 0xFFFF;
+        mem_read(dst + done + i, c->page + addr, 1);
+      }
+    }
+    done += span;
+    c->count += span;
+    if (c->count > c->reload) {
+      status |= 1 << (channel & 3);
+      if (c->autoinit) {
+        c->count = 0;
+      }
+    }
+  }
+  return done;
 }
 
 // port write
 static void i8237_port_write(uint16_t addr, uint8_t value) {
   const uint8_t channel = value & 3;
-  switch (addr) {
-  case 0x2: // channel 1 address register
-    if (flipflop == 1)
-      dmachan[1].addr = (dmachan[1].addr & 0x00FF) | ((uint32_t)value << 8);
-    else
-      dmachan[1].addr = (dmachan[1].addr & 0xFF00) | value;
-    flipflop = ~flipflop & 1;
-    break;
-  case 0x3: // channel 1 count register
-    if (flipflop == 1)
-      dmachan[1].reload = (dmachan[1].reload & 0x00FF) | ((uint32_t)value << 8);
-    else
-      dmachan[1].reload = (dmachan[1].reload & 0xFF00) | value;
-    if (flipflop == 1) {
-      if (dmachan[1].reload == 0)
-        dmachan[1].reload = 0x10000;
-      dmachan[1].count = 0;
+  if (addr < 0x8) {
+    struct dmachan_s *c = &dmachan[(addr >> 1) & 3];
+    if (addr & 1) { // channel count register
+      write_word(&c->reload, value);
+      c->count = 0;
     }
-    flipflop = ~flipflop & 1;
-    break;
+    else { // channel address register
+      write_word(&c->addr, value);
+    }
+    return;
+  }
+  switch (addr) {
   case 0xA: // write single mask register
     dmachan[channel].masked = (value >> 2) & 1;
     break;
@@ -81,8 +106,24 @@ static void i8237_port_write(uint16_t addr, uint8_t value) {
   case 0xC: // clear byte pointer flip-flop
     flipflop = 0;
     break;
-  case 0x83: // DMA channel 1 page register
-    dmachan[1].page = (uint32_t)value << 16;
+  case 0xD: // master clear
+    for (int i = 0; i < 4; ++i) {
+      dmachan[i].masked = 1;
+    }
+    flipflop = 0;
+    status = 0;
+    break;
+  case 0xF: // write all mask register bits
+    for (int i = 0; i < 4; ++i) {
+      dmachan[i].masked = (value >> i) & 1;
+    }
+    break;
+  default:
+    for (int i = 0; i < 4; ++i) {
+      if (addr == page_port[i]) { // DMA page register
+        dmachan[i].page = (uint32_t)value << 16;
+      }
+    }
     break;
   }
 }
@@ -91,24 +132,28 @@ static void i8237_port_write(uint16_t addr, uint8_t value) {
 uint8_t i8237_port_read(uint16_t addr) {
   if (addr & 0x80) {
     // this is a DMA page register
-  } else {
-    switch (addr) {
-    case 3:
-      if (flipflop == 1) {
-        return dmachan[1].reload >> 8;
-      }
-      else {
-        return dmachan[1].reload;
-      }
-      flipflop = ~flipflop & 1;
-      break;
+  } else if (addr < 0x8) {
+    const struct dmachan_s *c = &dmachan[(addr >> 1) & 3];
+    if (addr & 1) {
+      // the count left, as the controller counts down
+      return read_word(c->reload - c->count);
+    }
+    else {
+      const uint32_t off = c->direction ? -c->count : c->count;
+      return read_word(c->addr + off);
     }
+  } else if (addr == 0x8) {
+    const uint8_t ret = status;
+    status = 0;
+    return ret;
   }
   return 0;
 }
 
-void init8237() {
+bool i8237_init(void) {
   memset(dmachan, 0, sizeof(dmachan));
+  flipflop = 0;
+  status = 0;
 
   // DMA 1
   set_port_write_redirector(0x00, 0x0F, &i8237_port_write);
@@ -117,22 +162,21 @@ void init8237() {
   // DMA Page registers
   set_port_write_redirector(0x80, 0x8F, &i8237_port_write);
   set_port_read_redirector(0x80, 0x8F, &i8237_port_read);
+  return true;
 }
 
 void i8237_tick(uint64_t cycles) {
   // dummy
 }
 
-bool i8237_init(void) {
-  return true;
-}
-
 void i8237_state_save(FILE *fd) {
   fwrite(dmachan, 1, sizeof(dmachan), fd);
   fwrite(&flipflop, 1, sizeof(flipflop), fd);
+  fwrite(&status, 1, sizeof(status), fd);
 }
 
 void i8237_state_load(FILE *fd) {
   fread(dmachan, 1, sizeof(dmachan), fd);
   fread(&flipflop, 1, sizeof(flipflop), fd);
+  fread(&status, 1, sizeof(status), fd);
 }
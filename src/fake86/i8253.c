@@ -137,9 +137,9 @@ static void i8253_channel_write(int channel,
   }
 #endif
 
-  // update audio
-  if (channel == 2) {
-    audio_pc_speaker_freq(c->frequency);
+  // update audio once the whole count has been written
+  if (channel == 2 && c->inhibit_count == 0) {
+    audio_pc_speaker_count(c->mode_op, c->rvalue == 0 ? 0x10000 : c->rvalue);
   }
 
 #if DEVELOPER
@@ -227,6 +227,11 @@ static void i8253_mode_write(uint8_t value) {
   // number of writes needed before timer is active again
   c->inhibit_count = (rl == PIT_RLMODE_LATCH)  ? 0 : (
                      (rl == PIT_RLMODE_TOGGLE) ? 2 : 1);
+
+  // the speaker holds its output until a count is written
+  if (select == 2) {
+    audio_pc_speaker_count(mode, 0);
+  }
 }
 
 // port write
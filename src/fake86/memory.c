@@ -39,7 +39,10 @@ void write86(uint32_t addr, uint8_t value) {
   }
   if (addr >= 0xA0000) {
     if (addr >= 0xB0000) {
-      RAM[addr] = value;
+      if (RAM[addr] != value) {
+        RAM[addr] = value;
+        neo_mark_dirty(addr);
+      }
       return;
     }
     neo_mem_write_A0000(addr, value); // vga/ega
@@ -59,33 +62,59 @@ void writew86(uint32_t addr32, uint16_t value) {
   if (addr32 < 0xA0000) {
     *(uint16_t*)(RAM + addr32) = value;
   }
+  else if (addr32 < 0xAFFFF) {
+    neo_mem_write_A0000_w(addr32, value); // vga/ega
+  }
   else {
     write86(addr32 + 0, (uint8_t)(value >> 0));
     write86(addr32 + 1, (uint8_t)(value >> 8));
   }
 }
 
+// end of the memory region containing `addr`
+static uint32_t _mem_region_end(uint32_t addr) {
+  if (addr < 0xA0000) return 0xA0000;  // ram
+  if (addr < 0xB0000) return 0xB0000;  // vga/ega
+  if (addr < 0xC0000) return 0xC0000;  // ram
+  return 0x100000;                     // rom
+}
+
 void mem_write(uint32_t addr, const uint8_t *src, size_t size) {
-  const uint32_t end = addr + size;
-  if (end <= 0xA0000) {
-    memcpy(RAM + addr, src, size);
-  }
-  else {
-    for (uint32_t i = 0; i < size; i++) {
-      write86(addr + i, src[i]);
+  // split the transfer at each memory region boundary
+  while (size) {
+    addr &= 0xFFFFF;
+    const uint32_t span = (uint32_t)SDL_min(size, _mem_region_end(addr) - addr);
+    if (addr < 0xA0000) {
+      memcpy(RAM + addr, src, span);
+    }
+    else if (addr >= 0xB0000 && addr < 0xC0000) {
+      memcpy(RAM + addr, src, span);
+      neo_mark_dirty_span(addr, span);
     }
+    else if (addr < 0xB0000) {
+      neo_mem_write_A0000_block(addr, src, span); // vga/ega
+    }
+    // rom is read only
+    addr += span;
+    src  += span;
+    size -= span;
   }
 }
 
 void mem_read(uint8_t *dst, uint32_t addr, size_t size) {
-  const uint32_t end = addr + size;
-  if (end <= 0xA0000) {
-    memcpy(dst, RAM + addr, size);
-  }
-  else {
-    for (uint32_t i = 0; i < size; i++) {
-      dst[i] = read86(addr + i);
+  // split the transfer at each memory region boundary
+  while (size) {
+    addr &= 0xFFFFF;
+    const uint32_t span = (uint32_t)SDL_min(size, _mem_region_end(addr) - addr);
+    if (addr >= 0xA0000 && addr < 0xB0000) {
+      neo_mem_read_A0000_block(dst, addr, span); // vga/ega
     }
+    else {
+      memcpy(dst, RAM + addr, span);
+    }
+    addr += span;
+    dst  += span;
+    size -= span;
   }
 }
 
@@ -116,6 +145,9 @@ uint16_t readw86(uint32_t addr) {
     if (addr >= 0xB0000) {
       return *(const uint16_t*)(RAM + addr);
     }
+    if (addr < 0xAFFFF) {
+      return neo_mem_read_A0000_w(addr); // vga/ega
+    }
     return (uint16_t)(read86(addr + 0) << 0) |
            (uint16_t)(read86(addr + 1) << 8);
   }
@@ -0,0 +1,296 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Headless framebuffer capture.
+//
+// The renderer draws into a memory buffer at vblank which is then written
+// out as an image per frame (.ppm or .png) or appended to a raw 24bit rgb
+// stream (.raw or - for stdout).  Image files are named after the refresh
+// they were taken on, so `shot.png` becomes `shot_000123.png`.  Frames that
+// have not changed are not written as images, while the raw stream repeats
+// the last frame so that it keeps a constant rate.
+
+#include "frontend.h"
+#include "../video/video.h"
+
+
+#define CAPTURE_W 640
+#define CAPTURE_H 480
+
+enum capture_format_t {
+  CAPTURE_PPM,
+  CAPTURE_PNG,
+  CAPTURE_RAW,
+};
+
+// params
+const char *capture_path;
+uint32_t capture_rate;
+
+static enum capture_format_t _format;
+// raw stream output
+static FILE *_stream;
+static uint32_t _pixels[CAPTURE_W * CAPTURE_H];
+// packed rgb, with room for a filter byte before each line for png
+static uint8_t _rgb[(CAPTURE_W * 3 + 1) * CAPTURE_H];
+static uint8_t *_png;
+static uint32_t _crc_table[256];
+// refreshes since the last capture
+static uint32_t _index;
+// a frame since the last capture has changed the screen, the first frame
+// is always written
+static bool _changed = true;
+
+
+static bool _ends_with(const char *str, const char *end) {
+  const size_t a = strlen(str), b = strlen(end);
+  return a >= b && strcmp(str + a - b, end) == 0;
+}
+
+// pack the framebuffer as rgb, `filter` adds the png filter byte per line
+static void _capture_pack(const bool filter) {
+  uint8_t *dst = _rgb;
+  const uint32_t *src = _pixels;
+  for (uint32_t y = 0; y < CAPTURE_H; ++y) {
+    if (filter) {
+      *dst++ = 0;
+    }
+    for (uint32_t x = 0; x < CAPTURE_W; ++x) {
+      const uint32_t rgb = *src++;
+      *dst++ = (uint8_t)(rgb >> 16);
+      *dst++ = (uint8_t)(rgb >> 8);
+      *dst++ = (uint8_t)(rgb >> 0);
+    }
+  }
+}
+
+static void _crc_build(void) {
+  for (uint32_t n = 0; n < 256; ++n) {
+    uint32_t c = n;
+    for (uint32_t k = 0; k < 8; ++k) {
+      c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+    }
+    _crc_table[n] = c;
+  }
+}
+
+static uint32_t _crc_update(uint32_t crc, const uint8_t *src, uint32_t size) {
+  for (uint32_t i = 0; i < size; ++i) {
+    crc = _crc_table[(crc ^ src[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static void _put_be32(uint8_t *dst, const uint32_t v) {
+  dst[0] = (uint8_t)(v >> 24);
+  dst[1] = (uint8_t)(v >> 16);
+  dst[2] = (uint8_t)(v >> 8);
+  dst[3] = (uint8_t)(v >> 0);
+}
+
+static void _png_chunk(FILE *fd, const char *type, const uint8_t *data,
+                       const uint32_t size) {
+  uint8_t buf[4];
+  _put_be32(buf, size);
+  fwrite(buf, 1, 4, fd);
+  fwrite(type, 1, 4, fd);
+  if (size) {
+    fwrite(data, 1, size, fd);
+  }
+  uint32_t crc = _crc_update(0xffffffffu, (const uint8_t *)type, 4);
+  crc = _crc_update(crc, data, size);
+  _put_be32(buf, crc ^ 0xffffffffu);
+  fwrite(buf, 1, 4, fd);
+}
+
+// wrap the filtered lines in a zlib stream of stored deflate blocks, this
+// avoids a dependency on zlib at the cost of larger files
+static uint32_t _png_deflate(void) {
+  const uint32_t size = sizeof(_rgb);
+  uint8_t *dst = _png;
+  // zlib header, deflate with a 32k window and no preset dictionary
+  *dst++ = 0x78;
+  *dst++ = 0x01;
+  uint32_t a = 1, b = 0;
+  for (uint32_t i = 0; i < size;) {
+    const uint32_t len = SDL_min(size - i, 0xffffu);
+    *dst++ = (i + len == size) ? 1 : 0;
+    *dst++ = (uint8_t)(len >> 0);
+    *dst++ = (uint8_t)(len >> 8);
+    *dst++ = (uint8_t)(~len >> 0);
+    *dst++ = (uint8_t)(~len >> 8);
+    memcpy(dst, _rgb + i, len);
+    dst += len;
+    // adler32 of the uncompressed data
+    for (uint32_t j = 0; j < len; ++j) {
+      a = (a + _rgb[i + j]) % 65521;
+      b = (b + a) % 65521;
+    }
+    i += len;
+  }
+  _put_be32(dst, (b << 16) | a);
+  dst += 4;
+  return (uint32_t)(dst - _png);
+}
+
+static bool _capture_png(FILE *fd) {
+  static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  fwrite(sig, 1, sizeof(sig), fd);
+  uint8_t ihdr[13];
+  _put_be32(ihdr + 0, CAPTURE_W);
+  _put_be32(ihdr + 4, CAPTURE_H);
+  ihdr[8]  = 8;  // bit depth
+  ihdr[9]  = 2;  // truecolour
+  ihdr[10] = 0;  // deflate
+  ihdr[11] = 0;  // adaptive filtering
+  ihdr[12] = 0;  // no interlace
+  _png_chunk(fd, "IHDR", ihdr, sizeof(ihdr));
+  _capture_pack(true);
+  _png_chunk(fd, "IDAT", _png, _png_deflate());
+  _png_chunk(fd, "IEND", NULL, 0);
+  return !ferror(fd);
+}
+
+static bool _capture_ppm(FILE *fd) {
+  fprintf(fd, "P6\n%u %u\n255\n", CAPTURE_W, CAPTURE_H);
+  _capture_pack(false);
+  fwrite(_rgb, 1, CAPTURE_W * CAPTURE_H * 3, fd);
+  return !ferror(fd);
+}
+
+static void _capture_image(void) {
+  // insert the refresh number before the extension
+  const char *ext = strrchr(capture_path, '.');
+  const int base = (int)(ext - capture_path);
+  char path[1024];
+  snprintf(path, sizeof(path), "%.*s_%06u%s", base, capture_path,
+           neo_frame()->refresh, ext);
+  FILE *fd = fopen(path, "wb");
+  if (!fd) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to open '%s'", path);
+    return;
+  }
+  const bool ok = (_format == CAPTURE_PNG) ? _capture_png(fd) :
+                                             _capture_ppm(fd);
+  if (!ok) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to write '%s'", path);
+  }
+  fclose(fd);
+}
+
+static void _capture_raw(void) {
+  _capture_pack(false);
+  if (fwrite(_rgb, 1, CAPTURE_W * CAPTURE_H * 3, _stream) !=
+      CAPTURE_W * CAPTURE_H * 3) {
+    // most likely the reader of a pipe has gone away
+    log_printf(LOG_CHAN_FRONTEND, "capture stream closed");
+    capture_close();
+  }
+}
+
+bool capture_init(void) {
+  if (!capture_path) {
+    return true;
+  }
+  if (_ends_with(capture_path, ".ppm")) {
+    _format = CAPTURE_PPM;
+  }
+  else if (_ends_with(capture_path, ".png")) {
+    _format = CAPTURE_PNG;
+    _crc_build();
+    // stored deflate blocks add 5 bytes each to the zlib header and checksum
+    _png = malloc(sizeof(_rgb) + (sizeof(_rgb) / 0xffff + 1) * 5 + 6);
+    if (!_png) {
+      return false;
+    }
+  }
+  else if (_ends_with(capture_path, ".raw") ||
+           strcmp(capture_path, "-") == 0) {
+    _format = CAPTURE_RAW;
+    _stream = (strcmp(capture_path, "-") == 0) ? stdout :
+                                                 fopen(capture_path, "wb");
+    if (!_stream) {
+      log_printf(LOG_CHAN_FRONTEND, "unable to open '%s'", capture_path);
+      return false;
+    }
+  }
+  else {
+    log_printf(LOG_CHAN_FRONTEND, "unknown capture format '%s'",
+               capture_path);
+    return false;
+  }
+  log_printf(LOG_CHAN_FRONTEND, "capturing to '%s' every %u frames",
+             capture_path, SDL_max(capture_rate, 1u));
+  return true;
+}
+
+void capture_close(void) {
+  if (_stream == stdout) {
+    fflush(stdout);
+  }
+  else if (_stream) {
+    fclose(_stream);
+  }
+  _stream = NULL;
+  free(_png);
+  _png = NULL;
+  capture_path = NULL;
+}
+
+void capture_tick(void) {
+  // a recording is taken from the same frames
+  if (!capture_path && !record_path) {
+    return;
+  }
+
+  // hand the display state over to the renderer, this is done even for
+  // frames that are not captured as it also marks the start of the next
+  if (neo_frame_capture()) {
+    _changed = true;
+  }
+
+  if (++_index < capture_rate) {
+    return;
+  }
+  _index = 0;
+
+  if (_changed) {
+    _changed = false;
+    neo_frame_acquire();
+    struct render_target_t target = {
+      _pixels,
+      CAPTURE_W,
+      CAPTURE_H,
+      CAPTURE_W
+    };
+    if (neo_render_tick(&target)) {
+      record_frame(&target, neo_frame()->refresh);
+      if (capture_path && _format != CAPTURE_RAW) {
+        _capture_image();
+      }
+    }
+  }
+
+  // a raw stream is played back at a fixed rate so always write a frame
+  if (capture_path && _format == CAPTURE_RAW) {
+    _capture_raw();
+  }
+}
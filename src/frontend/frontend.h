@@ -29,6 +29,8 @@ extern const char *biosfile;
 extern uint8_t bootdrive;
 extern bool do_fullscreen;
 extern uint32_t frame_skip;
+extern bool frame_skip_auto;
+extern bool render_sync;
 extern bool _cl_headless;
 
 extern bool cpu_halt;
@@ -40,9 +42,15 @@ struct render_target_t {
   uint32_t w, h, pitch;
 };
 
-void neo_render_tick(const struct render_target_t *target);
+// render the current frame, returns false if the frame was unchanged and
+// nothing was drawn
+bool neo_render_tick(const struct render_target_t *target);
+// force a full redraw on the next frame
+void neo_render_invalidate(void);
 
 // on screen display
+// creates the lock shared with the render thread, so call before win_init
+bool osd_init(void);
 void osd_disk_fdd_used(void);
 void osd_disk_hdd_used(void);
 
@@ -62,9 +70,34 @@ extern const uint8_t asset_disk_pic[256];
 // window.c
 void win_fs_toggle(void);
 bool win_init(void);
-void win_render(void);
+void win_close(void);
+// called at vblank, `lag_us` is how far the emulator is behind real time
+void win_render(const uint32_t lag_us);
 void win_size(uint32_t *w, uint32_t *h);
 
+// capture.c
+extern const char *capture_path;
+extern uint32_t capture_rate;
+bool capture_init(void);
+// called at vblank in place of win_render
+void capture_tick(void);
+void capture_close(void);
+
+// record.c
+extern const char *record_path;
+bool record_init(void);
+// queue a drawn frame for the encoder thread
+void record_frame(const struct render_target_t *target, uint32_t refresh);
+void record_close(void);
+
+// wav.c
+extern const char *wav_path;
+// switches audio on to render against emulated time, when headless
+bool wav_init(void);
+// called after each slice of hardware ticks
+void wav_tick(void);
+void wav_close(void);
+
 // events.c
 void tick_events(void);
 
@@ -36,8 +36,9 @@ static int64_t tick_cpu(int64_t num_cycles) {
   return cpu_exec86((int32_t)num_cycles);
 }
 
-static void tick_render() {
-  win_render();
+static void tick_render(int64_t lag_cycles) {
+  const int64_t lag_us = lag_cycles * 1000000 / CYCLES_PER_SECOND;
+  win_render((uint32_t)SDL_max(lag_us, 0));
 }
 
 static uint64_t get_ticks() {
@@ -60,6 +61,8 @@ static void tick_hardware(uint64_t cycles) {
   vga_timing_advance(cycles);
   // PIT timer
   i8253_tick(cycles);
+  // sound blaster, ahead of the audio event it plays under
+  blaster_tick(cycles);
   // tick audio event stream
   audio_tick(cycles);
   //
@@ -70,11 +73,20 @@ static void emulate_loop_headless(void) {
   // enter main emulation loop
   while (cpu_running) {
     // set ourselves some cycle targets
-    const int64_t target = SDL_min(CYCLES_PER_SLICE, i8253_cycles_before_irq());
+    int64_t target = SDL_min(CYCLES_PER_SLICE, i8253_cycles_before_irq());
+    target = SDL_min(target, blaster_cycles_before_irq());
+    // let the wav output drain the audio events before making more
+    target = audio_backlog_full() ? 0 : target;
     // run for some cycles
     const int64_t executed = tick_cpu(target);
     // tick the hardware
     tick_hardware(executed);
+    wav_tick();
+
+    if (vga_timing_should_flip()) {
+      vga_timing_did_flip();
+      capture_tick();
+    }
 
     // exit if we are locked up
     if (cpu_in_hlt_state()) {
@@ -113,11 +125,18 @@ static void emulate_loop(void) {
     // update cpu
     while (cpu_acc <= 0 || cpu_halt) {
 
+      // the audio thread has fallen far behind, emulate nothing more until
+      // it catches up and let the time lost be made up as any other lag
+      if (audio_backlog_full()) {
+        break;
+      }
+
       // set ourselves some cycle targets
       int64_t target;
       target = cpu_halt ? 0 : CYCLES_PER_SLICE;
       target = cpu_step ? 1 : target;
       target = SDL_min(target, i8253_cycles_before_irq());
+      target = SDL_min(target, blaster_cycles_before_irq());
       target = SDL_max(target, cpu_halt ? 0 : 1);
 
       // run for some cycles
@@ -146,7 +165,8 @@ static void emulate_loop(void) {
     }
     // refresh the screen buffer
     if (video_redraw || cpu_halt) {
-      tick_render();
+      // real time passed that has not been emulated yet
+      tick_render(MSTOCYCLES(get_ticks() - old_ms) - cpu_acc);
     }
     // parse events from host
     tick_events();
@@ -161,6 +181,52 @@ static void emulate_loop(void) {
   }
 }
 
+// as emulate_loop but run only the cycles that the audio device has played
+static void emulate_loop_audio(void) {
+  while (cpu_running) {
+    const uint32_t due = audio_clock_due();
+    if ((due == 0 && !cpu_halt) || audio_backlog_full()) {
+      // parse events from host while waiting on the next period
+      tick_events();
+      audio_clock_wait();
+      continue;
+    }
+    bool video_redraw = false;
+
+    // set ourselves some cycle targets
+    int64_t target;
+    target = cpu_halt ? 0 : SDL_min(due, CYCLES_PER_SLICE);
+    target = cpu_step ? 1 : target;
+    target = SDL_min(target, i8253_cycles_before_irq());
+    target = SDL_min(target, blaster_cycles_before_irq());
+    target = SDL_max(target, cpu_halt ? 0 : 1);
+
+    // run for some cycles
+    const int64_t executed = tick_cpu(target);
+
+    // disable the stepping flag
+    cpu_step = executed ? false : cpu_step;
+
+    // keep track of if the video needs refreshed
+    if (vga_timing_should_flip()) {
+      video_redraw = true;
+      vga_timing_did_flip();
+    }
+    // tick peripherals
+    tick_hardware(executed);
+
+    // refresh the screen buffer
+    if (video_redraw || cpu_halt) {
+      // cycles the audio device is waiting on
+      tick_render(due - SDL_min(executed, (int64_t)due));
+      tick_events();
+    }
+    if (cpu_halt) {
+      SDL_Delay(2);
+    }
+  }
+}
+
 static void sdl_audio_callback(void *userdata, Uint8 *stream, int len) {
   int16_t *samples = (int16_t*)stream;
   uint32_t todo = len / sizeof(int16_t);
@@ -179,7 +245,8 @@ static bool sdl_audio_init(void) {
   desired.freq = 22050;
   desired.callback = sdl_audio_callback;
   desired.format = AUDIO_S16;
-  desired.samples = 1024;
+  // synthesis runs ahead on its own thread so the callback can be short
+  desired.samples = 256;
 
   if (SDL_OpenAudio(&desired, &obtained)) {
     log_printf(LOG_CHAN_AUDIO, "SDL_OpenAudio failed");
@@ -227,18 +294,30 @@ static bool emulate_init(void) {
   i8237_init();
   i8255_init();
   cmos_init();
+#if USE_AUDIO_BLASTER
+  blaster_init();
+#endif
   mouse_init(0x3F8, 4);
   // initalize vga refresh timing
   vga_timing_init();
   if (!_cl_headless) {
     // initalize new video renderer
-    if (!win_init()) {
+    if (!osd_init() || !win_init()) {
       return false;
     }
     if (!neo_init()) {
       return false;
     }
   }
+  else if (capture_path || record_path) {
+    // render without a window
+    if (!neo_init() || !capture_init()) {
+      return false;
+    }
+  }
+  if (!record_init()) {
+    return false;
+  }
   return true;
 }
 
@@ -287,7 +366,12 @@ int main(int argc, const char *argv[]) {
                         SDL_DEFAULT_REPEAT_INTERVAL);
   }
   // initalize the audio stream
-  if (audio_enable) {
+  if (_cl_headless) {
+    if (!wav_init()) {
+      return 1;
+    }
+  }
+  else if (audio_enable) {
     if (!sdl_audio_init()) {
       return 1;
     }
@@ -302,21 +386,34 @@ int main(int argc, const char *argv[]) {
   }
 
   // enter the emulation loop
-  if (audio_enable) {
+  if (audio_enable && !_cl_headless) {
     SDL_PauseAudio(0);
   }
   cpu_running = true;
 
   if (_cl_headless) {
     emulate_loop_headless();
+    capture_close();
+    wav_close();
   }
   else {
-    emulate_loop();
+    if (audio_enable && audio_clock) {
+      emulate_loop_audio();
+    }
+    else {
+      emulate_loop();
+    }
+    win_close();
   }
+  // after the renderer has stopped queuing frames
+  record_close();
 
   // close the audio device
   if (audio_enable) {
-    SDL_CloseAudio();
+    if (!_cl_headless) {
+      SDL_CloseAudio();
+    }
+    audio_close();
   }
 
   SDL_Quit();
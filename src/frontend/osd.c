@@ -40,6 +40,23 @@ uint8_t _cmd_buf_last[WIDTH];
 uint8_t _cmd_buf[WIDTH];
 uint32_t _cmd_head;
 
+// the osd is drawn by the render thread but written by the emulator
+// SDL mutexes are recursive so commands may print while holding it
+static SDL_mutex *_lock;
+
+bool osd_init(void) {
+  _lock = SDL_CreateMutex();
+  return _lock != NULL;
+}
+
+static void _osd_lock(void) {
+  SDL_LockMutex(_lock);
+}
+
+static void _osd_unlock(void) {
+  SDL_UnlockMutex(_lock);
+}
+
 static char *_get_line(uint32_t index) {
   const uint32_t y = (index + _buf_head) % HEIGHT;
   return _buf + y * WIDTH;
@@ -425,8 +442,7 @@ static uint32_t _get_ascii(const SDL_Event *t) {
   return ch;
 }
 
-void osd_on_event(const SDL_Event *t) {
-  assert(t);
+static void _on_event(const SDL_Event *t) {
   if (t->type == SDL_KEYDOWN) {
 
     const uint32_t ch = _get_ascii(t);
@@ -465,11 +481,14 @@ void osd_on_event(const SDL_Event *t) {
   }
 }
 
-void osd_render(const struct render_target_t *target) {
-  if (!_is_active) {
-    return;
-  }
+void osd_on_event(const SDL_Event *t) {
+  assert(t);
+  _osd_lock();
+  _on_event(t);
+  _osd_unlock();
+}
 
+static void _render(const struct render_target_t *target) {
   uint32_t *dst = target->dst;
   const uint32_t offs = (target->h - ((HEIGHT + 1) * 16)) / 2;
   dst += offs;
@@ -491,11 +510,22 @@ void osd_render(const struct render_target_t *target) {
 #endif
 }
 
+void osd_render(const struct render_target_t *target) {
+  if (!_is_active) {
+    return;
+  }
+  _osd_lock();
+  _render(target);
+  _osd_unlock();
+}
+
 void osd_vprintf(const char *fmt, va_list list) {
+  _osd_lock();
   char *line = _get_line(0);
   memset(line, 0, WIDTH);
   vsnprintf(line + 2, WIDTH - 2, fmt, list);
   ++_buf_head;
+  _osd_unlock();
 }
 
 void osd_printf(const char *fmt, ...) {
@@ -76,6 +76,34 @@ static bool _cl_do_nosound(const char *opt, const char *arg[]) {
   return true;
 }
 
+static bool _cl_do_audioclock(const char *opt, const char *arg[]) {
+  audio_clock = true;
+  return true;
+}
+
+static bool _cl_do_blasterirq(const char *opt, const char *arg[]) {
+  const int irq = atoi(*arg);
+  if (irq != 5 && irq != 7) {
+    printf("Sound Blaster irq must be 5 or 7\n");
+    return false;
+  }
+  blaster_irq = (uint8_t)irq;
+  return true;
+}
+
+static bool _cl_do_volume(const char *opt, const char *arg[]) {
+  static const char *names[MIXER_NUM_SOURCES] = {"adlib", "speaker", "floppy",
+                                                     "blaster"};
+  for (int i = 0; i < MIXER_NUM_SOURCES; ++i) {
+    if (strcmp(arg[0], names[i]) == 0) {
+      mixer_set_gain((enum mixer_source_t)i, atoi(arg[1]));
+      return true;
+    }
+  }
+  printf("Unknown audio source '%s'\n", arg[0]);
+  return false;
+}
+
 static bool _cl_do_bios(const char *opt, const char *arg[]) {
   biosfile = *arg;
   return true;
@@ -87,11 +115,41 @@ static bool _cl_do_fullscreen(const char *opt, const char *arg[]) {
 }
 
 static bool _cl_do_frameskip(const char *opt, const char *arg[]) {
+  if (strcmp(*arg, "auto") == 0) {
+    frame_skip_auto = true;
+    log_printf(LOG_CHAN_FRONTEND, "adaptive frame skip");
+    return true;
+  }
   frame_skip = atoi(*arg);
   log_printf(LOG_CHAN_FRONTEND, "skipping %d frames", frame_skip);
   return true;
 }
 
+static bool _cl_do_capture(const char *opt, const char *arg[]) {
+  capture_path = *arg;
+  return true;
+}
+
+static bool _cl_do_capturerate(const char *opt, const char *arg[]) {
+  capture_rate = atoi(*arg);
+  return true;
+}
+
+static bool _cl_do_record(const char *opt, const char *arg[]) {
+  record_path = *arg;
+  return true;
+}
+
+static bool _cl_do_wav(const char *opt, const char *arg[]) {
+  wav_path = *arg;
+  return true;
+}
+
+static bool _cl_do_syncrender(const char *opt, const char *arg[]) {
+  render_sync = true;
+  return true;
+}
+
 static bool _cl_do_com(const char *opt, const char *arg[]) {
   disk_load_com(*arg);
   return true;
@@ -126,6 +184,15 @@ static const struct cl_entry_t _cl_list[] = {
   },
   {"-nosound", 0, _cl_do_nosound, "Disable sound output"
   },
+  {"-audioclock", 0, _cl_do_audioclock, "Pace emulation from the audio device"
+  },
+  {"-volume", 2, _cl_do_volume, "Set the volume of a sound source in percent",
+    "   -volume [adlib | speaker | floppy | blaster] [percent]\n"
+    "   -volume speaker 50\n"
+  },
+  {"-blasterirq", 1, _cl_do_blasterirq, "Set the Sound Blaster irq",
+    "   -blasterirq [5 | 7]\n"
+  },
   {"-bios", 1, _cl_do_bios, "Specify bios image to load",
     "   -bios pcxtbios.bin\n"
     "   -bios landmarktest.bin\n"
@@ -134,10 +201,35 @@ static const struct cl_entry_t _cl_list[] = {
   },
   {"-frameskip", 1, _cl_do_frameskip, "Number of frames to skip",
     "   -frameskip 1\n"
+    "   (skip only when the host falls behind)\n"
+    "   -frameskip auto\n"
   },
   {
     "-headless", 0, _cl_do_headless, "Run without a window"
   },
+  {
+    "-syncrender", 0, _cl_do_syncrender, "Render on the emulation thread"
+  },
+  {
+    "-capture", 1, _cl_do_capture, "Capture the display when headless",
+    "   -capture shot.png  (shot_000123.png on refresh 123)\n"
+    "   -capture shot.ppm\n"
+    "   -capture out.raw   (640x480 rgb24 stream)\n"
+    "   -capture -         (rgb24 stream to stdout, use with -quiet)\n"
+  },
+  {
+    "-record", 1, _cl_do_record, "Record the display losslessly",
+    "   -record session.f86v\n"
+    "   (export with f86v_export)\n"
+  },
+  {
+    "-wav", 1, _cl_do_wav, "Render audio to a wav file when headless",
+    "   -wav out.wav\n"
+  },
+  {
+    "-capturerate", 1, _cl_do_capturerate, "Capture every Nth frame",
+    "   -capturerate 70\n"
+  },
   {
     "-com", 1, _cl_do_com, "Boot into a COM file at address 0x01100",
     "   -com myprog.com"
@@ -159,10 +251,12 @@ static bool _cl_do_help(const char *opt, const char *arg[]) {
   return false;
 }
 
+// match an option against a pattern, where * stands for any one character,
+// the whole option must match so that no option can shadow a longer one
 static inline bool strpcmp(const char *a, const char *b) {
   for (;; ++a, ++b) {
     if (*a == '\0') {
-      return true;
+      return *b == '\0';
     }
     if (*b == '\0') {
       return false;
@@ -182,6 +276,7 @@ static void _cl_defaults() {
   biosfile = "pcxtbios.bin";
   audio_enable = true;
   frame_skip = 0;
+  capture_rate = 1;
   bootdrive = 0;
 }
 
@@ -216,5 +311,10 @@ bool cl_parse(const int argc, const char **args) {
       return false;
     }
   }
+  // audio is only rendered against emulated time without a window
+  if (wav_path && !_cl_headless) {
+    printf("-wav can only be used with -headless\n");
+    return false;
+  }
   return true;
 }
@@ -0,0 +1,144 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Video recording.
+//
+// The thread that renders copies each drawn frame into a free slot of a
+// single producer, single consumer ring and carries on.  An encoder thread
+// takes frames from the ring and writes them with vidrec.c.  If the encoder
+// falls behind the ring fills and frames are dropped rather than stalling
+// the renderer, the next frame recorded is still coded against the last one
+// written so the stream stays valid.
+
+#include "frontend.h"
+#include "../common/vidrec.h"
+
+
+#define RECORD_SLOTS 8
+#define RECORD_W 640
+#define RECORD_H 480
+
+struct record_slot_t {
+  uint32_t refresh;
+  uint32_t w, h;
+  uint32_t pixels[RECORD_W * RECORD_H];
+};
+
+// params
+const char *record_path;
+
+static struct record_slot_t *_slots;
+// written by the producer and consumer only
+static volatile uint32_t _head, _tail;
+static SDL_sem *_wake;
+static SDL_Thread *_thread;
+static volatile uint32_t _quit;
+static struct vidrec_enc_t _enc;
+static uint32_t _recorded, _dropped;
+
+
+static int _record_thread(void *arg) {
+  bool ok = true;
+  for (;;) {
+    SDL_SemWait(_wake);
+    // drain the ring before quitting so no frame is lost
+    const uint32_t head = atomic_load_acquire(&_head);
+    uint32_t tail = _tail;
+    for (; tail != head; ++tail) {
+      const struct record_slot_t *s = &_slots[tail % RECORD_SLOTS];
+      if (ok) {
+        ok = vidrec_enc_frame(&_enc, s->pixels, s->w, s->h, s->w, s->refresh);
+        if (!ok) {
+          log_printf(LOG_CHAN_FRONTEND, "unable to write '%s'", record_path);
+        }
+      }
+      atomic_store_release(&_tail, tail + 1);
+    }
+    if (atomic_load_acquire(&_quit) &&
+        atomic_load_acquire(&_head) == _tail) {
+      break;
+    }
+  }
+  return 0;
+}
+
+bool record_init(void) {
+  if (!record_path) {
+    return true;
+  }
+  FILE *fd = fopen(record_path, "wb");
+  if (!fd) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to open '%s'", record_path);
+    return false;
+  }
+  if (!vidrec_enc_open(&_enc, fd)) {
+    vidrec_enc_close(&_enc);
+    return false;
+  }
+  _slots = malloc(sizeof(struct record_slot_t) * RECORD_SLOTS);
+  _wake = SDL_CreateSemaphore(0);
+  _thread = (_slots && _wake) ? SDL_CreateThread(_record_thread, NULL) : NULL;
+  if (!_thread) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to start recording thread");
+    vidrec_enc_close(&_enc);
+    return false;
+  }
+  log_printf(LOG_CHAN_FRONTEND, "recording to '%s'", record_path);
+  return true;
+}
+
+void record_frame(const struct render_target_t *target, uint32_t refresh) {
+  if (!_thread) {
+    return;
+  }
+  const uint32_t head = _head;
+  if (head - atomic_load_acquire(&_tail) >= RECORD_SLOTS) {
+    ++_dropped;
+    return;
+  }
+  struct record_slot_t *s = &_slots[head % RECORD_SLOTS];
+  s->refresh = refresh;
+  s->w = SDL_min(target->w, RECORD_W);
+  s->h = SDL_min(target->h, RECORD_H);
+  for (uint32_t y = 0; y < s->h; ++y) {
+    memcpy(s->pixels + y * s->w, target->dst + y * target->pitch,
+           s->w * sizeof(uint32_t));
+  }
+  atomic_store_release(&_head, head + 1);
+  ++_recorded;
+  SDL_SemPost(_wake);
+}
+
+void record_close(void) {
+  if (!_thread) {
+    return;
+  }
+  atomic_store_release(&_quit, 1);
+  SDL_SemPost(_wake);
+  SDL_WaitThread(_thread, NULL);
+  _thread = NULL;
+  vidrec_enc_close(&_enc);
+  SDL_DestroySemaphore(_wake);
+  free(_slots);
+  _slots = NULL;
+  log_printf(LOG_CHAN_FRONTEND, "recorded %u frames, dropped %u",
+             _recorded, _dropped);
+}
@@ -0,0 +1,135 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Headless audio capture.
+//
+// Audio is rendered on the emulator thread after each slice of hardware
+// ticks, against emulated time rather than a sound device, and appended to
+// a 16bit stereo .wav file.  With nothing paced to the host clock the same
+// run always produces the same file, however fast it is emulated.
+
+#include "frontend.h"
+
+
+#define WAV_RATE 44100
+#define WAV_HEADER 44
+
+// params
+const char *wav_path;
+
+static FILE *_fd;
+static int16_t _buf[MIXER_MAX_SAMPLES];
+// `_buf` as little endian, whatever the host order
+static uint8_t _out[MIXER_MAX_SAMPLES * sizeof(int16_t)];
+// samples written after the header
+static uint32_t _written;
+
+
+static void _put_le16(uint8_t *dst, const uint32_t v) {
+  dst[0] = (uint8_t)(v >> 0);
+  dst[1] = (uint8_t)(v >> 8);
+}
+
+static void _put_le32(uint8_t *dst, const uint32_t v) {
+  dst[0] = (uint8_t)(v >> 0);
+  dst[1] = (uint8_t)(v >> 8);
+  dst[2] = (uint8_t)(v >> 16);
+  dst[3] = (uint8_t)(v >> 24);
+}
+
+static bool _wav_header(void) {
+  const uint32_t bytes = _written * sizeof(int16_t);
+  uint8_t h[WAV_HEADER];
+  memcpy(h + 0, "RIFF", 4);
+  _put_le32(h + 4, WAV_HEADER - 8 + bytes);
+  memcpy(h + 8, "WAVE", 4);
+  memcpy(h + 12, "fmt ", 4);
+  _put_le32(h + 16, 16);
+  // pcm, stereo
+  _put_le16(h + 20, 1);
+  _put_le16(h + 22, 2);
+  _put_le32(h + 24, WAV_RATE);
+  _put_le32(h + 28, WAV_RATE * 2 * sizeof(int16_t));
+  _put_le16(h + 32, 2 * sizeof(int16_t));
+  _put_le16(h + 34, 16);
+  memcpy(h + 36, "data", 4);
+  _put_le32(h + 40, bytes);
+  return fseek(_fd, 0, SEEK_SET) == 0 &&
+         fwrite(h, 1, WAV_HEADER, _fd) == WAV_HEADER;
+}
+
+bool wav_init(void) {
+  if (!wav_path) {
+    return true;
+  }
+  _fd = fopen(wav_path, "wb");
+  if (!_fd) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to open '%s'", wav_path);
+    return false;
+  }
+  // sizes are filled in once they are known
+  if (!_wav_header()) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to write '%s'", wav_path);
+    return false;
+  }
+  audio_enable = true;
+  audio_init_offline(WAV_RATE);
+  log_printf(LOG_CHAN_FRONTEND, "rendering audio to '%s'", wav_path);
+  return true;
+}
+
+// write out everything the audio has rendered so far
+static bool _wav_drain(void) {
+  for (;;) {
+    const uint32_t done = audio_render(_buf, MIXER_MAX_SAMPLES);
+    if (done == 0) {
+      return true;
+    }
+    for (uint32_t i = 0; i < done; ++i) {
+      _put_le16(_out + i * sizeof(int16_t), (uint16_t)_buf[i]);
+    }
+    if (fwrite(_out, sizeof(int16_t), done, _fd) != done) {
+      return false;
+    }
+    _written += done;
+  }
+}
+
+void wav_tick(void) {
+  if (_fd && !_wav_drain()) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to write '%s'", wav_path);
+    fclose(_fd);
+    _fd = NULL;
+  }
+}
+
+void wav_close(void) {
+  if (!_fd) {
+    return;
+  }
+  // render what is left of the last slice before the sizes are final
+  if (!_wav_drain() || !_wav_header()) {
+    log_printf(LOG_CHAN_FRONTEND, "unable to write '%s'", wav_path);
+  }
+  fclose(_fd);
+  _fd = NULL;
+  log_printf(LOG_CHAN_FRONTEND, "%u audio frames written", _written / 2);
+}
@@ -20,16 +20,76 @@
 */
 
 #include "frontend.h"
+#include "../video/video.h"
+
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 
 // params
 bool do_fullscreen;
 uint32_t frame_skip;
+bool frame_skip_auto;
+bool render_sync;
 
 static SDL_Surface *_surface;
 static uint32_t frame_index;
+// overlays were drawn on the last frame
+static bool _overlay_last;
+// a frame captured since the last hand over has changed the screen
+static bool _frame_changed;
+
+// adaptive frame skip
+// most frames skipped in a row so the display never freezes
+#define FRAME_SKIP_MAX 8
+// smoothed cost of drawing and presenting a frame on the emulation thread
+static uint32_t _present_us;
+static uint32_t _skip_count;
+
+// render thread
+// SDL 1.2 video calls are only safe from the thread that set the video mode,
+// so the render thread draws into back buffers and the emulation thread
+// copies the last finished one to the screen and flips.  The render thread
+// never touches `_surface`.
+static SDL_Thread *_thread;
+static bool _thread_quit;
+// posted by the emulator when a frame has been captured
+static SDL_sem *_frame_ready;
+// the render thread draws into `_back[_back_draw]`, the other buffer holds
+// the last finished frame, both the size the window was opened with
+static uint32_t *_back[2];
+static uint32_t _back_draw;
+static uint32_t _back_w, _back_h;
+// a finished frame has not been presented yet
+static volatile uint32_t _back_ready;
+// held to swap the buffers and while the finished one is copied, never
+// while drawing
+static SDL_mutex *_back_lock;
 
 
+// monotonic time in microseconds, SDL_GetTicks() only counts milliseconds
+// which is longer than presenting a frame often takes
+static uint64_t _win_time_us(void) {
+#ifdef _MSC_VER
+  static LARGE_INTEGER freq;
+  if (!freq.QuadPart) {
+    QueryPerformanceFrequency(&freq);
+  }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+         (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 void win_fs_toggle(void) {
   assert(_surface);
   const int flags = _surface->flags ^ SDL_FULLSCREEN;
@@ -38,6 +98,108 @@ void win_fs_toggle(void) {
     log_printf(LOG_CHAN_VIDEO, "SDL_SetVideoMode failed");
   }
   SDL_WM_SetCaption(BUILD_STRING, NULL);
+  // new surface so everything must be shown again, the render thread keeps
+  // its frame so it only has to be copied over
+  if (_thread) {
+    atomic_store_release(&_back_ready, 1);
+    return;
+  }
+  neo_render_invalidate();
+  _frame_changed = true;
+}
+
+// draw the last acquired frame to `target`, returns false if nothing was
+// drawn
+static bool _win_draw(const struct render_target_t *target) {
+
+  // overlays are blended over the frame so we need a full redraw while they
+  // are visible and on the frame after they have gone
+  const bool overlay = osd_is_active() || osd_should_draw_disk();
+  if (overlay || _overlay_last) {
+    neo_render_invalidate();
+  }
+  _overlay_last = overlay;
+
+  // skip presenting frames that have not changed
+  if (!neo_render_tick(target)) {
+    return false;
+  }
+  // recorded before the osd is drawn over it
+  record_frame(target, neo_frame()->refresh);
+  osd_render(target);
+  return true;
+}
+
+// draw the last acquired frame straight to the screen and present it
+static void _win_present(void) {
+
+  struct render_target_t target = {
+    (uint32_t*)_surface->pixels,
+    _surface->w,
+    _surface->h,
+    _surface->pitch / sizeof(uint32_t)
+  };
+
+  const uint64_t start = _win_time_us();
+
+  if (!_win_draw(&target)) {
+    return;
+  }
+  SDL_Flip(_surface);
+
+  const uint32_t cost = (uint32_t)(_win_time_us() - start);
+  _present_us = (_present_us * 7 + cost) / 8;
+}
+
+// copy the last frame finished by the render thread to the screen, returns
+// at once if there is none, the render thread only ever holds the lock to
+// swap buffers
+static void _win_flip(void) {
+  if (!atomic_load_acquire(&_back_ready) || !_surface) {
+    return;
+  }
+  SDL_LockMutex(_back_lock);
+  const uint32_t pitch = _surface->pitch / sizeof(uint32_t);
+  const uint32_t w = SDL_min(_back_w, (uint32_t)_surface->w);
+  const uint32_t h = SDL_min(_back_h, (uint32_t)_surface->h);
+  uint32_t *dst = (uint32_t*)_surface->pixels;
+  const uint32_t *src = _back[_back_draw ^ 1];
+  for (uint32_t y = 0; y < h; ++y) {
+    memcpy(dst, src, w * sizeof(uint32_t));
+    dst += pitch;
+    src += _back_w;
+  }
+  atomic_store_release(&_back_ready, 0);
+  SDL_UnlockMutex(_back_lock);
+  SDL_Flip(_surface);
+}
+
+static int _win_render_thread(void *arg) {
+  for (;;) {
+    SDL_SemWait(_frame_ready);
+    if (_thread_quit) {
+      break;
+    }
+    if (!neo_frame_acquire()) {
+      continue;
+    }
+    const struct render_target_t target = {
+      _back[_back_draw], _back_w, _back_h, _back_w
+    };
+    if (!_win_draw(&target)) {
+      continue;
+    }
+    // hand the frame over, waiting only if it is being copied right now
+    SDL_LockMutex(_back_lock);
+    _back_draw ^= 1;
+    atomic_store_release(&_back_ready, 1);
+    SDL_UnlockMutex(_back_lock);
+    // only dirty lines are drawn, so carry the frame on into the buffer
+    // drawn next, the emulation thread only ever reads the other one
+    memcpy(_back[_back_draw], _back[_back_draw ^ 1],
+           _back_w * _back_h * sizeof(uint32_t));
+  }
+  return 0;
 }
 
 bool win_init(void) {
@@ -51,37 +213,107 @@ bool win_init(void) {
     return false;
   }
   SDL_WM_SetCaption(BUILD_STRING, NULL);
+
+  if (!render_sync) {
+    _back_w = _surface->w;
+    _back_h = _surface->h;
+    _back[0] = calloc(_back_w * _back_h, sizeof(uint32_t));
+    _back[1] = calloc(_back_w * _back_h, sizeof(uint32_t));
+    _back_lock = (_back[0] && _back[1]) ? SDL_CreateMutex() : NULL;
+    _frame_ready = _back_lock ? SDL_CreateSemaphore(0) : NULL;
+    _thread = _frame_ready ? SDL_CreateThread(_win_render_thread, NULL) : NULL;
+    if (!_thread) {
+      log_printf(LOG_CHAN_VIDEO, "unable to start render thread");
+    }
+  }
   return true;
 }
 
-void win_render(void) {
+void win_close(void) {
+  if (_thread) {
+    _thread_quit = true;
+    SDL_SemPost(_frame_ready);
+    SDL_WaitThread(_thread, NULL);
+    _thread = NULL;
+  }
+  free(_back[0]);
+  free(_back[1]);
+  _back[0] = _back[1] = NULL;
+}
 
-  ++frame_index;
-  if (frame_index >= frame_skip) {
-    frame_index = 0;
+// when rendering on the emulation thread, skip presenting while the
+// emulator is further behind real time than a frame and drawing costs it
+// something, as that time is better spent catching up.  the render thread
+// costs the emulator nothing, so there skip while it is still busy with an
+// earlier frame, it will take the latest one when it is done.
+static bool _win_skip_adaptive(const uint32_t lag_us, const bool busy) {
+  const bool skip = _thread ? busy :
+    (lag_us > vga_timing_frame_us() && _present_us > 0);
+  if (skip && _skip_count < FRAME_SKIP_MAX) {
+    ++_skip_count;
+    return true;
   }
+  _skip_count = 0;
+  return false;
+}
 
-  if (frame_index != 0) {
-    return;
+// overlays may change without a new frame
+static bool _win_overlay(void) {
+  return osd_is_active() || osd_should_draw_disk() || _overlay_last;
+}
+
+void win_render(const uint32_t lag_us) {
+
+  // show what the render thread finished since the last vblank
+  if (_thread) {
+    _win_flip();
   }
 
-  SDL_FillRect(_surface, NULL, 0x050505);
+  // the render thread has not yet taken the last frame handed over
+  const bool busy = _thread && frame_skip_auto && neo_frame_pending();
 
-  struct render_target_t target = {
-    (uint32_t*)_surface->pixels,
-    _surface->w,
-    _surface->h,
-    _surface->pitch / sizeof(uint32_t)
-  };
+  // hand the display state over to the renderer, this is done even for
+  // skipped frames as it also marks the start of the next frame
+  if (neo_frame_capture()) {
+    _frame_changed = true;
+  }
+
+  if (frame_skip_auto) {
+    if (_win_skip_adaptive(lag_us, busy)) {
+      return;
+    }
+  }
+  else {
+    ++frame_index;
+    if (frame_index >= frame_skip) {
+      frame_index = 0;
+    }
+    if (frame_index != 0) {
+      return;
+    }
+  }
 
-  neo_render_tick(&target);
-  osd_render(&target);
+  // nothing new to draw
+  if (!_frame_changed && !_win_overlay()) {
+    return;
+  }
+  _frame_changed = false;
 
-  SDL_Flip(_surface);
+  if (_thread) {
+    // never wait on the render thread, it will pick up the latest frame
+    // once it has finished with the current one
+    if (SDL_SemValue(_frame_ready) == 0) {
+      SDL_SemPost(_frame_ready);
+    }
+    return;
+  }
+
+  neo_frame_acquire();
+  _win_present();
 }
 
 void win_size(uint32_t *w, uint32_t *h) {
   assert(w && h);
   *w = _surface->w;
   *h = _surface->h;
-}
\ No newline at end of file
+}
@@ -0,0 +1,352 @@
+// Check the structure of arrays OPL3 core against the reference core.
+//
+// Both chips are given the same register writes and must produce exactly
+// the same samples.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../external/nukedopl/opl3.h"
+#include "../../external/nukedopl/opl3v.h"
+
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+#define _root_seed 12345
+#define _test_runs 64
+#define _test_samples 20000
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+static opl3_chip _ref;
+static opl3v_chip _opt;
+
+// samples that were not silent, to show a test is exercising the chip
+static uint32_t _audible;
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+static uint32_t _rng_seed = _root_seed;
+
+static uint32_t _rand16(void) {
+  uint32_t x = _rng_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return (_rng_seed = x) & 0xffff;
+}
+
+static uint32_t _rand8(void) {
+  return _rand16() & 0xff;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+static void _reset(const uint32_t rate) {
+  OPL3_Reset(&_ref, rate);
+  OPL3V_Reset(&_opt, rate);
+}
+
+static void _write(const uint16_t reg, const uint8_t val) {
+  OPL3_WriteReg(&_ref, reg, val);
+  OPL3V_WriteReg(&_opt, reg, val);
+}
+
+static void _write_buffered(const uint16_t reg, const uint8_t val) {
+  OPL3_WriteRegBuffered(&_ref, reg, val);
+  OPL3V_WriteRegBuffered(&_opt, reg, val);
+}
+
+// run both chips at their native rate
+static bool _generate(const uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    int16_t ref[2], opt[2];
+    OPL3_Generate(&_ref, ref);
+    OPL3V_Generate(&_opt, opt);
+    if (ref[0] != opt[0] || ref[1] != opt[1]) {
+      printf("sample %u ref:%6d %6d got:%6d %6d  ", i, ref[0], ref[1],
+             opt[0], opt[1]);
+      return false;
+    }
+    _audible += (ref[0] | ref[1]) != 0;
+  }
+  return true;
+}
+
+// run both chips through the resampler
+static bool _generate_stream(const uint32_t count) {
+  int16_t ref[512], opt[512];
+  for (uint32_t done = 0; done < count;) {
+    const uint32_t todo = (count - done) < 256 ? (count - done) : 256;
+    OPL3_GenerateStream(&_ref, ref, todo);
+    OPL3V_GenerateStream(&_opt, opt, todo);
+    if (memcmp(ref, opt, todo * 2 * sizeof(int16_t))) {
+      printf("stream sample %u  ", done);
+      return false;
+    }
+    for (uint32_t i = 0; i < todo * 2; ++i) {
+      _audible += ref[i] != 0;
+    }
+    done += todo;
+  }
+  return true;
+}
+
+// a random register which the chip decodes
+static uint16_t _rand_reg(void) {
+  static const uint8_t base[] = {0x20, 0x40, 0x60, 0x80, 0xe0};
+  const uint16_t high = (_rand8() & 1) << 8;
+  switch (_rand8() % 8) {
+  case 0:
+    return high | 0xa0 | (_rand8() % 9);
+  case 1:
+    return high | 0xb0 | (_rand8() % 9);
+  case 2:
+    return high | 0xc0 | (_rand8() % 9);
+  case 3:
+    switch (_rand8() % 4) {
+    case 0:  return 0xbd;
+    case 1:  return 0x08;
+    case 2:  return 0x104;
+    default: return 0x105;
+    }
+  default:
+    return high | base[_rand8() % 5] | (_rand8() % 0x16);
+  }
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+// writes of any value to any register between runs of samples
+static bool test_random_writes(void) {
+  _reset(49716);
+  for (uint32_t done = 0; done < _test_samples;) {
+    const uint32_t writes = _rand8() % 8;
+    for (uint32_t i = 0; i < writes; ++i) {
+      _write(_rand_reg(), (uint8_t)_rand8());
+    }
+    const uint32_t run = _rand16() % 512;
+    if (!_generate(run)) {
+      return false;
+    }
+    done += run;
+  }
+  return true;
+}
+
+// instruments that sound, played as notes in every channel
+static bool test_notes(void) {
+  _reset(49716);
+  const bool opl3 = _rand8() & 1;
+  _write(0x105, opl3);
+  _write(0x104, opl3 ? (uint8_t)(_rand8() & 0x3f) : 0);
+  _write(0xbd, (uint8_t)(_rand8() & 0xc0));
+  for (uint16_t high = 0; high <= (opl3 ? 0x100u : 0u); high += 0x100) {
+    for (uint16_t slot = 0; slot < 0x16; ++slot) {
+      if ((slot & 7) >= 6) {
+        continue;
+      }
+      _write(high | 0x20 | slot, (uint8_t)_rand8());
+      _write(high | 0x40 | slot, (uint8_t)(_rand8() & 0xdf));
+      _write(high | 0x60 | slot, (uint8_t)(_rand8() | 0x80));
+      _write(high | 0x80 | slot, (uint8_t)_rand8());
+      _write(high | 0xe0 | slot, (uint8_t)_rand8());
+    }
+    for (uint16_t ch = 0; ch < 9; ++ch) {
+      _write(high | 0xc0 | ch, (uint8_t)(_rand8() | 0x30));
+    }
+  }
+  for (uint32_t done = 0; done < _test_samples;) {
+    const uint16_t high = opl3 ? (_rand8() & 1) << 8 : 0;
+    const uint16_t ch = _rand8() % 9;
+    _write(high | 0xa0 | ch, (uint8_t)_rand8());
+    _write(high | 0xb0 | ch, (uint8_t)(_rand8() & 0x3f));
+    if ((_rand8() & 7) == 0) {
+      // toggle the rhythm section and its drums
+      _write(0xbd, (uint8_t)_rand8());
+    }
+    const uint32_t run = _rand16() % 2048;
+    if (!_generate(run)) {
+      return false;
+    }
+    done += run;
+  }
+  return true;
+}
+
+// notes without feedback let to decay, skipped over while idle and played
+// again, which must sound as if the silence had been generated
+static bool test_idle(void) {
+  _reset(49716);
+  _write(0x105, 1);
+  _write(0x104, (uint8_t)(_rand8() & 0x3f));
+  _write(0xbd, (uint8_t)(_rand8() & 0xc0));
+  for (uint16_t high = 0; high <= 0x100u; high += 0x100) {
+    for (uint16_t slot = 0; slot < 0x16; ++slot) {
+      if ((slot & 7) >= 6) {
+        continue;
+      }
+      _write(high | 0x20 | slot, (uint8_t)_rand8());
+      _write(high | 0x40 | slot, (uint8_t)(_rand8() & 0xdf));
+      _write(high | 0x60 | slot, (uint8_t)(_rand8() | 0x80));
+      // a quick enough release to reach silence
+      _write(high | 0x80 | slot, (uint8_t)(_rand8() | 0x0c));
+      _write(high | 0xe0 | slot, (uint8_t)_rand8());
+    }
+    for (uint16_t ch = 0; ch < 9; ++ch) {
+      // without feedback no state is carried in the outputs
+      _write(high | 0xc0 | ch, (uint8_t)((_rand8() & 0xf1) | 0x30));
+    }
+  }
+  for (uint32_t note = 0; note < 2; ++note) {
+    for (uint16_t high = 0; high <= 0x100u; high += 0x100) {
+      for (uint16_t ch = 0; ch < 9; ++ch) {
+        _write(high | 0xa0 | ch, (uint8_t)_rand8());
+        _write(high | 0xb0 | ch, (uint8_t)((_rand8() & 0x1f) | 0x20));
+      }
+    }
+    _write(0xbd, (uint8_t)((_rand8() & 0xc0) | 0x3f));
+    if (!_generate_stream(_rand16() % 4096)) {
+      return false;
+    }
+    // key everything off and wait for it to decay
+    for (uint16_t high = 0; high <= 0x100u; high += 0x100) {
+      for (uint16_t ch = 0; ch < 9; ++ch) {
+        _write(high | 0xb0 | ch, 0);
+      }
+    }
+    _write(0xbd, (uint8_t)(_rand8() & 0xe0));
+    uint32_t waited = 0;
+    for (; !OPL3V_IsIdle(&_opt); waited += 256) {
+      if (waited > 49716 * 60 || !_generate_stream(256)) {
+        printf("not idle  ");
+        return false;
+      }
+    }
+    const uint32_t idle = 1 + _rand16();
+    int16_t ref[512];
+    for (uint32_t done = 0; done < idle;) {
+      const uint32_t todo = (idle - done) < 256 ? (idle - done) : 256;
+      OPL3_GenerateStream(&_ref, ref, todo);
+      done += todo;
+    }
+    OPL3V_SkipStream(&_opt, idle);
+    // the first few samples out hold residue left in the reference chip
+    int16_t opt[8];
+    OPL3_GenerateStream(&_ref, ref, 4);
+    OPL3V_GenerateStream(&_opt, opt, 4);
+  }
+  return true;
+}
+
+// the write buffer and resampler as used by the emulator
+static bool test_stream(void) {
+  static const uint32_t rates[] = {11025, 22050, 44100, 48000};
+  _reset(rates[_rand8() % 4]);
+  for (uint32_t done = 0; done < _test_samples;) {
+    const uint32_t writes = _rand8() % 32;
+    for (uint32_t i = 0; i < writes; ++i) {
+      _write_buffered(_rand_reg(), (uint8_t)_rand8());
+    }
+    const uint32_t run = _rand16() % 1024;
+    if (!_generate_stream(run)) {
+      return false;
+    }
+    done += run;
+  }
+  return true;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+typedef bool (*test_func_t)(void);
+
+struct test_info_t {
+  test_func_t func;
+  const char *name;
+};
+
+#define TEST(X) {X, #X}
+static struct test_info_t test[] = {
+  TEST(test_random_writes),
+  TEST(test_notes),
+  TEST(test_stream),
+  TEST(test_idle),
+  // sentinel
+  {NULL, NULL}
+};
+
+// time both cores on the same busy patch
+static void _benchmark(void) {
+  _rng_seed = _root_seed;
+  _reset(49716);
+  _write(0x105, 1);
+  for (uint32_t i = 0; i < 2000; ++i) {
+    _write(_rand_reg(), (uint8_t)_rand8());
+  }
+  for (uint16_t ch = 0; ch < 9; ++ch) {
+    _write(0xb0 | ch, 0x31);
+    _write(0x1b0 | ch, 0x31);
+  }
+  const uint32_t samples = 49716 * 10;
+  int16_t buf[2];
+  clock_t start = clock();
+  for (uint32_t i = 0; i < samples; ++i) {
+    OPL3_Generate(&_ref, buf);
+  }
+  const double ref = (double)(clock() - start) / CLOCKS_PER_SEC;
+  start = clock();
+  for (uint32_t i = 0; i < samples; ++i) {
+    OPL3V_Generate(&_opt, buf);
+  }
+  const double opt = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("10s of audio, reference %.3fs, vectorised %.3fs\n", ref, opt);
+}
+
+int main(int argc, char **args) {
+
+  uint32_t num_tests = 0;
+  uint32_t num_passed = 0;
+
+  struct test_info_t *info = test;
+  for (;info->func; ++info) {
+
+    ++num_tests;
+
+    printf("%20s  ", info->name);
+    _rng_seed = _root_seed;
+    _audible = 0;
+    bool ok = true;
+    for (int i=0; i<_test_runs; ++i) {
+      const uint32_t seed = _rng_seed;
+      if (!info->func()) {
+        printf("  fail (%08u)", seed);
+        ok = false;
+        break;
+      }
+    }
+    // a test that never made a sound has not compared anything
+    if (ok && _audible == 0) {
+      printf("silent");
+      ok = false;
+    }
+    if (ok) {
+      ++num_passed;
+      printf("ok");
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  printf("%d of %d passed\n", num_passed, num_tests);
+
+  if (argc > 1 && strcmp(args[1], "-bench") == 0) {
+    _benchmark();
+  }
+
+  return num_tests == num_passed ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+// Check that .f86v recordings decode to exactly the frames encoded.
+//
+// Each test encodes a sequence of frames to a temporary file and decodes
+// it again, comparing every pixel and the frame type chosen.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../common/vidrec.h"
+
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+#define _root_seed 12345
+#define _w 320
+#define _h 200
+// padding past the width, so the pitch is exercised
+#define _pitch (_w + 13)
+#define _max_frames 16
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+static uint32_t _frames[_max_frames][_pitch * _h];
+static uint8_t _types[_max_frames];
+static uint32_t _num_frames;
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+static uint32_t _rng_seed = _root_seed;
+
+static uint32_t _rand16(void) {
+  uint32_t x = _rng_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return (_rng_seed = x) & 0xffff;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+// add a frame of random blocks in `colours` distinct colours, expected to
+// be stored as `type`
+static void _frame(const uint32_t colours, const uint8_t type) {
+  uint32_t *dst = _frames[_num_frames];
+  const uint32_t base = _rand16() << 8;
+  for (uint32_t y = 0; y < _h; ++y) {
+    for (uint32_t x = 0; x < _w; ++x) {
+      // runs of a colour so the run length coding has work to do
+      const uint32_t c = ((x / 5) * 7 + y * 3 + (_rand16() & 1)) % colours;
+      dst[y * _pitch + x] = (base + c * 0x010305) & 0xffffff;
+    }
+  }
+  _types[_num_frames++] = type;
+}
+
+// a copy of the last frame with a few pixels changed
+static void _frame_touch(const uint8_t type) {
+  memcpy(_frames[_num_frames], _frames[_num_frames - 1],
+         sizeof(_frames[0]));
+  uint32_t *dst = _frames[_num_frames];
+  for (int i = 0; i < 32; ++i) {
+    dst[(_rand16() % _h) * _pitch + (_rand16() % _w)] = dst[0];
+  }
+  _types[_num_frames++] = type;
+}
+
+static bool _round_trip(void) {
+  FILE *fd = tmpfile();
+  if (!fd) {
+    printf("tmpfile failed  ");
+    return false;
+  }
+  struct vidrec_enc_t enc;
+  if (!vidrec_enc_open(&enc, fd)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < _num_frames; ++i) {
+    if (!vidrec_enc_frame(&enc, _frames[i], _w, _h, _pitch, i)) {
+      printf("encode %u failed  ", i);
+      return false;
+    }
+  }
+  // the encoder owns the file, keep it open for the decoder
+  fflush(fd);
+  enc.fd = NULL;
+  vidrec_enc_close(&enc);
+  rewind(fd);
+
+  struct vidrec_dec_t dec;
+  bool ok = vidrec_dec_open(&dec, fd);
+  for (uint32_t i = 0; ok && i < _num_frames; ++i) {
+    if (!vidrec_dec_frame(&dec)) {
+      printf("decode %u failed  ", i);
+      ok = false;
+      break;
+    }
+    if (dec.type != _types[i] || dec.refresh != i) {
+      printf("frame %u type %u expected %u  ", i, dec.type, _types[i]);
+      ok = false;
+      break;
+    }
+    for (uint32_t y = 0; ok && y < _h; ++y) {
+      if (memcmp(dec.rgb + y * _w, _frames[i] + y * _pitch,
+                 _w * sizeof(uint32_t))) {
+        printf("frame %u differs on line %u  ", i, y);
+        ok = false;
+      }
+    }
+  }
+  // nothing follows the last frame
+  if (ok && vidrec_dec_frame(&dec)) {
+    printf("trailing frame  ");
+    ok = false;
+  }
+  vidrec_dec_close(&dec);
+  return ok;
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+static bool test_indexed(void) {
+  _frame(16, VIDREC_KEY);
+  _frame_touch(VIDREC_DELTA);
+  _frame_touch(VIDREC_DELTA);
+  return _round_trip();
+}
+
+// a palette frame, one with too many colours and then back to a palette,
+// after both an odd and an even number of indexed frames
+static bool test_key_rgb_key(void) {
+  _frame(2, VIDREC_KEY);
+  _frame(4096, VIDREC_KEY_RGB);
+  _frame(2, VIDREC_KEY);
+  _frame_touch(VIDREC_DELTA);
+  _frame(4096, VIDREC_KEY_RGB);
+  _frame(4096, VIDREC_KEY_RGB);
+  _frame(16, VIDREC_KEY);
+  _frame_touch(VIDREC_DELTA);
+  return _round_trip();
+}
+
+// new colours appearing until the palette has to start over
+static bool test_palette_full(void) {
+  _frame(200, VIDREC_KEY);
+  _frame(40, VIDREC_DELTA);
+  _frame(250, VIDREC_KEY);
+  _frame_touch(VIDREC_DELTA);
+  return _round_trip();
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+typedef bool (*test_t)(void);
+
+struct test_info_t {
+  test_t func;
+  const char *name;
+};
+
+#define TEST(X) {X, #X}
+static struct test_info_t test[] = {
+  TEST(test_indexed),
+  TEST(test_key_rgb_key),
+  TEST(test_palette_full),
+  // sentinel
+  {NULL, NULL}
+};
+
+int main(int argc, char **args) {
+
+  uint32_t num_tests = 0;
+  uint32_t num_passed = 0;
+
+  struct test_info_t *info = test;
+  for (;info->func; ++info) {
+
+    ++num_tests;
+
+    printf("%20s  ", info->name);
+    _rng_seed = _root_seed;
+    _num_frames = 0;
+    if (info->func()) {
+      ++num_passed;
+      printf("ok");
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  printf("%d of %d passed\n", num_passed, num_tests);
+
+  return num_tests == num_passed ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Decode a recording made with -record.
+//
+//   f86v_export session.f86v              list the frames
+//   f86v_export session.f86v shot.ppm     one image per recorded frame
+//   f86v_export session.f86v out.raw      rgb24 stream, one frame per refresh
+//   f86v_export session.f86v -            rgb24 stream to stdout
+//
+// Only frames that changed are recorded, so the raw stream repeats each one
+// until the refresh of the next to play back at the emulated refresh rate.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../common/vidrec.h"
+
+
+static uint8_t *_rgb;
+
+static bool _ends_with(const char *str, const char *end) {
+  const size_t a = strlen(str), b = strlen(end);
+  return a >= b && strcmp(str + a - b, end) == 0;
+}
+
+static bool _pack(const struct vidrec_dec_t *dec) {
+  _rgb = realloc(_rgb, dec->w * dec->h * 3);
+  if (!_rgb) {
+    return false;
+  }
+  uint8_t *dst = _rgb;
+  for (uint32_t i = 0; i < dec->w * dec->h; ++i) {
+    *dst++ = (uint8_t)(dec->rgb[i] >> 16);
+    *dst++ = (uint8_t)(dec->rgb[i] >> 8);
+    *dst++ = (uint8_t)(dec->rgb[i] >> 0);
+  }
+  return true;
+}
+
+static bool _write_ppm(const struct vidrec_dec_t *dec, const char *name) {
+  // insert the refresh number before the extension
+  const char *ext = strrchr(name, '.');
+  char path[1024];
+  snprintf(path, sizeof(path), "%.*s_%06u%s", (int)(ext - name), name,
+           dec->refresh, ext);
+  FILE *fd = fopen(path, "wb");
+  if (!fd) {
+    fprintf(stderr, "unable to open '%s'\n", path);
+    return false;
+  }
+  fprintf(fd, "P6\n%u %u\n255\n", dec->w, dec->h);
+  fwrite(_rgb, 1, dec->w * dec->h * 3, fd);
+  const bool ok = !ferror(fd);
+  fclose(fd);
+  return ok;
+}
+
+int main(int argc, char **args) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: f86v_export <recording> [out.ppm | out.raw | -]\n");
+    return 1;
+  }
+  FILE *in = fopen(args[1], "rb");
+  if (!in) {
+    fprintf(stderr, "unable to open '%s'\n", args[1]);
+    return 1;
+  }
+  struct vidrec_dec_t dec;
+  if (!vidrec_dec_open(&dec, in)) {
+    fprintf(stderr, "'%s' is not a recording\n", args[1]);
+    vidrec_dec_close(&dec);
+    return 1;
+  }
+
+  const char *out = argc > 2 ? args[2] : NULL;
+  const bool ppm = out && _ends_with(out, ".ppm");
+  FILE *raw = NULL;
+  if (out && !ppm) {
+    raw = (strcmp(out, "-") == 0) ? stdout : fopen(out, "wb");
+    if (!raw) {
+      fprintf(stderr, "unable to open '%s'\n", out);
+      vidrec_dec_close(&dec);
+      return 1;
+    }
+  }
+
+  static const char *type_name[] = {"key", "delta", "key rgb"};
+  uint32_t frames = 0, stream_w = 0, stream_h = 0, last_refresh = 0;
+  bool ok = true;
+  while (ok && vidrec_dec_frame(&dec)) {
+    if (!out) {
+      printf("%6u  refresh %8u  %ux%u  %s\n", frames, dec.refresh, dec.w,
+             dec.h, type_name[dec.type]);
+    }
+    else if (ppm) {
+      ok = _pack(&dec) && _write_ppm(&dec, out);
+    }
+    else {
+      // a raw stream has no header so its size is fixed by the first frame
+      if (frames == 0) {
+        stream_w = dec.w;
+        stream_h = dec.h;
+      }
+      if (dec.w != stream_w || dec.h != stream_h) {
+        fprintf(stderr, "skipping %ux%u frame at refresh %u\n", dec.w, dec.h,
+                dec.refresh);
+      }
+      else {
+        // repeat the previous frame up to this one
+        const uint32_t size = stream_w * stream_h * 3;
+        for (uint32_t r = last_refresh + 1; frames && r < dec.refresh; ++r) {
+          fwrite(_rgb, 1, size, raw);
+        }
+        ok = _pack(&dec) && fwrite(_rgb, 1, size, raw) == size;
+        last_refresh = dec.refresh;
+      }
+    }
+    ++frames;
+  }
+  if (!feof(in) && ok) {
+    fprintf(stderr, "recording is damaged after %u frames\n", frames);
+  }
+  fprintf(stderr, "%u frames\n", frames);
+
+  if (raw && raw != stdout) {
+    fclose(raw);
+  }
+  vidrec_dec_close(&dec);
+  free(_rgb);
+  return ok ? 0 : 1;
+}
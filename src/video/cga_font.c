@@ -552,18 +552,65 @@ static const uint8_t cga_font_8x8[512 * 8] = {
 };
 
 
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// glyph atlas
+//
+// Glyphs are expanded into ready to store 32bit pixel rows for each colour
+// pair in use, so a glyph blit becomes a sequence of row copies.  Slots are
+// keyed by the rgb colour pair itself so a palette change simply selects a
+// different slot, and glyphs within a slot are expanded lazily on first use.
+
+#define ATLAS_SLOTS 16
+
+struct glyph_atlas_t {
+  // colour pair (foreground, background)
+  uint32_t rgb_a, rgb_b;
+  bool used;
+  // glyphs that have been expanded
+  uint32_t valid[512 / 32];
+  // 8 rows of 8 pixels for each glyph
+  uint32_t px[512][8 * 8];
+};
+
+static struct glyph_atlas_t _atlas[ATLAS_SLOTS];
+
+static const uint32_t *_atlas_glyph(uint16_t ch, const uint32_t rgb_a,
+                                    const uint32_t rgb_b) {
+  // select slot for this colour pair
+  const uint32_t hash = (rgb_a * 0x9E3779B1u) ^ (rgb_b * 0x85EBCA77u);
+  struct glyph_atlas_t *slot = &_atlas[(hash >> 16) & (ATLAS_SLOTS - 1)];
+  if (!slot->used || slot->rgb_a != rgb_a || slot->rgb_b != rgb_b) {
+    // evict the old colour pair
+    slot->used  = true;
+    slot->rgb_a = rgb_a;
+    slot->rgb_b = rgb_b;
+    memset(slot->valid, 0, sizeof(slot->valid));
+  }
+  ch &= 0x1ff;
+  uint32_t *dst = slot->px[ch];
+  // expand glyph if needed
+  if (!(slot->valid[ch >> 5] & (1u << (ch & 31)))) {
+    const uint8_t *src = &cga_font_8x8[ch * 8];
+    for (int y = 0; y < 8; ++y) {
+      uint8_t mask = src[y];
+      for (int x = 0; x < 8; ++x) {
+        dst[y * 8 + x] = (mask & 0x80) ? rgb_a : rgb_b;
+        mask <<= 1;
+      }
+    }
+    slot->valid[ch >> 5] |= (1u << (ch & 31));
+  }
+  return dst;
+}
+
 void font_draw_glyph_8x8(
   uint32_t *dst, const uint32_t pitch, uint16_t ch,
   const uint32_t rgb_a, const uint32_t rgb_b)
 {
-  const uint8_t *src = &cga_font_8x8[(ch & 0x1ff) * 8];
+  const uint32_t *src = _atlas_glyph(ch, rgb_a, rgb_b);
   for (int y=0; y<8; ++y) {
-    uint8_t mask = *src;
-    for (int x=0; x<8; ++x) {
-      dst[x] = (mask & 0x80) ? rgb_a : rgb_b;
-      mask <<= 1;
-    }
-    ++src;
+    memcpy(dst, src, 8 * sizeof(uint32_t));
+    src += 8;
     dst += pitch;
   }
 }
@@ -574,15 +621,12 @@ void font_draw_glyph_8x16(
 {
   //note: there is a font in the bios at 0xffa6e
 
-  const uint8_t *src = &cga_font_8x8[(ch & 0x1ff) * 8];
+  const uint32_t *src = _atlas_glyph(ch, rgb_a, rgb_b);
 
+  // each 8x8 font row is doubled up
   for (int y=0; y<16; ++y) {
-    uint8_t mask = *src;
-    for (int x=0; x<8; ++x) {
-      dst[x] = (mask & 0x80) ? rgb_a : rgb_b;
-      mask <<= 1;
-    }
-    src += (y & 1);
+    memcpy(dst, src, 8 * sizeof(uint32_t));
+    src += (y & 1) * 8;
     dst += pitch;
   }
 }
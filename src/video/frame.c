@@ -0,0 +1,312 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Display state hand over between the emulator and the renderer.
+//
+// The renderer never reads live emulator state.  At vblank the emulator
+// copies the blocks of video memory it has dirtied, along with the display
+// registers, into a pending frame.  The renderer later takes the pending frame
+// into its own copy and draws from that, so the two may run on different
+// threads with the lock only held while the dirty blocks are copied.
+//
+// Palette, start address and panning changes made while the beam is part way down
+// the screen are recorded as raster entries, each holding the registers for
+// the lines scanned out since the previous change.  A frame without such
+// changes has a single entry and is drawn in one pass.  Video memory is
+// still sampled once per frame.  The palette is too big to copy for every
+// entry, so a frame carries the palette at its top and a log of the entries
+// which changed, each raster entry marking how far into the log it reaches.
+
+#include "../common/common.h"
+#include "video.h"
+
+
+// published by the emulator, waiting to be taken by the renderer
+static struct neo_frame_t _pending;
+static bool _pending_valid;
+// owned by the renderer
+static struct neo_frame_t _current;
+
+static SDL_mutex *_lock;
+
+// raster state of the frame in progress, owned by the emulator
+static struct neo_raster_t _raster[NEO_RASTER_MAX];
+static uint32_t _raster_num;
+// first line of the raster entry in progress
+static uint32_t _raster_line;
+// raster entries and final start address of the last frame captured
+static uint32_t _raster_last;
+static uint32_t _start_last;
+static bool _blink_last;
+// palette at the top of the frame in progress and as of the last entry
+static uint32_t _dac_top[NEO_DAC_SIZE];
+static uint32_t _dac_last[NEO_DAC_SIZE];
+// palette changes of the frame in progress
+static struct neo_dac_write_t _dac_log[NEO_DAC_LOG_MAX];
+static uint32_t _dac_num;
+
+bool neo_frame_init(void) {
+  if (!_lock) {
+    _lock = SDL_CreateMutex();
+  }
+  return _lock != NULL;
+}
+
+// log a palette entry if it differs from the last one recorded
+static void _dac_note(const uint32_t index, const uint32_t rgb) {
+  if (_dac_last[index] == rgb) {
+    return;
+  }
+  // with the log full the change is picked up again by the next entry
+  if (_dac_num >= NEO_DAC_LOG_MAX) {
+    return;
+  }
+  _dac_last[index] = rgb;
+  _dac_log[_dac_num].index = index;
+  _dac_log[_dac_num].rgb = rgb;
+  ++_dac_num;
+}
+
+// record the current display registers
+static void _raster_record(struct neo_raster_t *r, const uint32_t line) {
+  r->line = line;
+  r->start_addr = (neo_crt_register(0xC) << 8) | neo_crt_register(0xD);
+  r->pel_pan = neo_attr_register(0x13);
+  const uint32_t *vga = neo_vga_dac();
+  for (uint32_t i = 0; i < 256; ++i) {
+    _dac_note(i, vga[i]);
+  }
+  const uint32_t *ega = neo_ega_dac();
+  for (uint32_t i = 0; i < 16; ++i) {
+    _dac_note(NEO_DAC_EGA + i, ega[i]);
+  }
+  r->dac_end = _dac_num;
+}
+
+void neo_frame_split(void) {
+  const uint32_t line = vga_timing_get_line();
+  // changes in vblank or before any line has been scanned out with the
+  // current state can just replace it
+  if (line <= _raster_line || line >= VGA_VISIBLE_LINES) {
+    return;
+  }
+  // keep one entry free for the final state
+  if (_raster_num + 1 >= NEO_RASTER_MAX) {
+    return;
+  }
+  _raster_record(&_raster[_raster_num++], _raster_line);
+  _raster_line = line;
+}
+
+// lines on screen from the vertical display end and scan doubling
+static uint32_t _frame_lines(void) {
+  const uint32_t r07 = neo_crt_register(0x07);
+  const uint32_t r09 = neo_crt_register(0x09);
+  // bit 8 lives in bit 1 of the overflow register and bit 9 in bit 6
+  const uint32_t vde = neo_crt_register(0x12) |
+                       ((r07 >> 1) & 1) << 8 |
+                       ((r07 >> 6) & 1) << 9;
+  // each line is repeated for max scan line + 1, then doubled again
+  const uint32_t scan = ((r09 & 0x1f) + 1) * ((r09 & 0x80) ? 2 : 1);
+  const uint32_t lines = (vde + 1) / scan;
+  // the bios may not have programmed the crtc timing
+  return (lines < 200 || lines > 480) ? 200 : lines;
+}
+
+// copy the display registers
+static void _frame_copy_regs(struct neo_frame_t *dst,
+                             const struct neo_frame_t *src) {
+  dst->mode = src->mode;
+  dst->refresh = src->refresh;
+  dst->cursor_addr = src->cursor_addr;
+  dst->cursor_start = src->cursor_start;
+  dst->cursor_end = src->cursor_end;
+  dst->cursor_blink = src->cursor_blink;
+  dst->line_compare = src->line_compare;
+  dst->pan_reset = src->pan_reset;
+  dst->chain4 = src->chain4;
+  dst->line_offset = src->line_offset;
+  dst->lines = src->lines;
+  dst->num_raster = src->num_raster;
+  memcpy(dst->raster, src->raster, src->num_raster * sizeof(*src->raster));
+  memcpy(dst->dac, src->dac, sizeof(dst->dac));
+  dst->num_dac_log = src->num_dac_log;
+  memcpy(dst->dac_log, src->dac_log,
+         src->num_dac_log * sizeof(*src->dac_log));
+}
+
+// copy one 16 byte block of video memory
+static void _frame_copy_block(uint32_t *vram, uint8_t *text,
+                              const uint32_t *src_vram, const uint8_t *src_text,
+                              const uint32_t blk) {
+  const uint32_t addr = 0xA0000 + blk * 16;
+  if (addr < 0xB0000) {
+    const uint32_t offs = addr - 0xA0000;
+    memcpy(vram + offs, src_vram + offs, 16 * sizeof(uint32_t));
+  }
+  else if (addr >= 0xB8000) {
+    const uint32_t offs = addr - 0xB8000;
+    memcpy(text + offs, src_text + offs, 16);
+  }
+}
+
+// copy every block set in `map`
+static void _frame_copy_dirty(uint32_t *vram, uint8_t *text,
+                              const uint32_t *src_vram, const uint8_t *src_text,
+                              const uint32_t *map) {
+  for (uint32_t i = 0; i < NEO_DIRTY_MAP_SIZE; ++i) {
+    uint32_t bit = 0;
+    for (uint32_t bits = map[i]; bits; bits >>= 1, ++bit) {
+      if (bits & 1) {
+        _frame_copy_block(vram, text, src_vram, src_text, i * 32 + bit);
+      }
+    }
+  }
+}
+
+// true if any block of video memory was written this frame
+static bool _frame_any_dirty(void) {
+  for (uint32_t i = 0; i < NEO_DIRTY_MAP_SIZE; ++i) {
+    if (neo_dirty_map[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool neo_frame_capture(void) {
+  const uint32_t flags = neo_dirty_flags();
+  // the registers as they are now apply to the rest of the frame
+  _raster_record(&_raster[_raster_num++], _raster_line);
+  // start address writes are the only display change that sets no dirty
+  // flag, and a split frame differs from the one before even if its
+  // registers end up where they started
+  const uint32_t start = _raster[_raster_num - 1].start_addr;
+  // the cursor blinks every 16 frames
+  const uint32_t refresh = vga_timing_frame_count();
+  const bool blink = (refresh & 0x10) == 0;
+  const bool changed = flags || _frame_any_dirty() || _raster_num > 1 ||
+                       _raster_last > 1 || start != _start_last ||
+                       blink != _blink_last;
+  _raster_last = _raster_num;
+  _start_last = start;
+  _blink_last = blink;
+  SDL_LockMutex(_lock);
+  struct neo_frame_t *f = &_pending;
+  // a mode change may have rewritten memory behind our back
+  if (flags & NEO_DIRTY_MODE) {
+    memcpy(f->vram, vga_ram(), sizeof(f->vram));
+    memcpy(f->text, RAM + 0xB8000, sizeof(f->text));
+  }
+  else {
+    _frame_copy_dirty(f->vram, f->text, vga_ram(), RAM + 0xB8000,
+                      neo_dirty_map);
+  }
+  for (uint32_t i = 0; i < NEO_DIRTY_MAP_SIZE; ++i) {
+    f->dirty[i] |= neo_dirty_map[i];
+  }
+  f->flags |= flags;
+  f->mode = neo_get_video_mode();
+  f->refresh = refresh;
+  f->cursor_addr = neo_crt_cursor_addr();
+  f->cursor_start = neo_crt_cursor_start();
+  f->cursor_end = neo_crt_cursor_end();
+  f->cursor_blink = blink;
+  // bit 8 lives in the overflow register and bit 9 in max scan line
+  f->line_compare = neo_crt_register(0x18) |
+                    ((neo_crt_register(0x07) >> 4) & 1) << 8 |
+                    ((neo_crt_register(0x09) >> 6) & 1) << 9;
+  f->pan_reset = (neo_attr_register(0x10) & 0x20) != 0;
+  f->chain4 = (neo_seq_register(0x4) & 0x08) != 0;
+  f->line_offset = neo_crt_register(0x13);
+  f->lines = _frame_lines();
+  f->num_raster = _raster_num;
+  memcpy(f->raster, _raster, _raster_num * sizeof(*_raster));
+  memcpy(f->dac, _dac_top, sizeof(f->dac));
+  f->num_dac_log = _dac_num;
+  memcpy(f->dac_log, _dac_log, _dac_num * sizeof(*_dac_log));
+  _pending_valid = true;
+  SDL_UnlockMutex(_lock);
+  neo_dirty_clear();
+  // start of a new frame
+  _raster_num = 0;
+  _raster_line = 0;
+  memcpy(_dac_top, _dac_last, sizeof(_dac_top));
+  _dac_num = 0;
+  return changed;
+}
+
+bool neo_frame_acquire(void) {
+  SDL_LockMutex(_lock);
+  if (!_pending_valid) {
+    SDL_UnlockMutex(_lock);
+    return false;
+  }
+  struct neo_frame_t *f = &_current;
+  if (_pending.flags & NEO_DIRTY_MODE) {
+    memcpy(f->vram, _pending.vram, sizeof(f->vram));
+    memcpy(f->text, _pending.text, sizeof(f->text));
+  }
+  else {
+    _frame_copy_dirty(f->vram, f->text, _pending.vram, _pending.text,
+                      _pending.dirty);
+  }
+  for (uint32_t i = 0; i < NEO_DIRTY_MAP_SIZE; ++i) {
+    f->dirty[i] |= _pending.dirty[i];
+  }
+  f->flags |= _pending.flags;
+  _frame_copy_regs(f, &_pending);
+  memset(_pending.dirty, 0, sizeof(_pending.dirty));
+  _pending.flags = 0;
+  _pending_valid = false;
+  SDL_UnlockMutex(_lock);
+  return true;
+}
+
+bool neo_frame_pending(void) {
+  SDL_LockMutex(_lock);
+  const bool pending = _pending_valid;
+  SDL_UnlockMutex(_lock);
+  return pending;
+}
+
+const struct neo_frame_t *neo_frame(void) {
+  return &_current;
+}
+
+bool neo_frame_dirty_span(uint32_t addr, uint32_t size) {
+  if (size == 0) {
+    return false;
+  }
+  const uint32_t first = (addr - 0xA0000) >> 4;
+  const uint32_t last  = (addr + size - 1 - 0xA0000) >> 4;
+  for (uint32_t blk = first; blk <= last; ++blk) {
+    if (_current.dirty[blk >> 5] & (1u << (blk & 31))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void neo_frame_rendered(void) {
+  memset(_current.dirty, 0, sizeof(_current.dirty));
+  _current.flags = 0;
+}
@@ -0,0 +1,211 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+               2019      Aidan Dodds
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+  USA.
+*/
+
+// Pixel conversion for the indexed framebuffer.
+//
+// Video memory is first decoded into one palette index per pixel, and the
+// indices are then looked up in the palette to produce rgb.  Keeping the two
+// stages apart lets a palette change skip the decode entirely.
+//
+// Each interleaved video memory word holds one byte from each of the four
+// planes.  Bit 7 of each byte is the left most pixel, and the four bits taken
+// from the same position in each plane form that pixels palette index:
+//
+//   index = (p3 << 3) | (p2 << 2) | (p1 << 1) | p0
+
+#include "../common/common.h"
+#include "video.h"
+
+#if USE_SIMD && defined(__AVX2__)
+  #define PLANAR_AVX2 1
+  #include <immintrin.h>
+#elif USE_SIMD && (defined(__SSE2__) || defined(_M_X64) || \
+                   (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #define PLANAR_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+
+// byte to 8 bytes, one per bit, left most pixel (bit 7) in the low byte
+static uint64_t _expand_lut[256];
+static bool _expand_lut_valid;
+
+static void _planar_build_lut(void) {
+  for (uint32_t b = 0; b < 256; ++b) {
+    uint64_t out = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+      out |= (uint64_t)((b >> (7 - i)) & 1) << (i * 8);
+    }
+    _expand_lut[b] = out;
+  }
+  _expand_lut_valid = true;
+}
+
+// 8 palette indices packed one per byte
+static inline uint64_t _planar_expand(const uint32_t lanes) {
+  return (_expand_lut[(lanes >>  0) & 0xff] << 0) |
+         (_expand_lut[(lanes >>  8) & 0xff] << 1) |
+         (_expand_lut[(lanes >> 16) & 0xff] << 2) |
+         (_expand_lut[(lanes >> 24) & 0xff] << 3);
+}
+
+// scalar decode, also used for the tail of the simd kernels
+static void _planar_span_index(uint8_t *dst, const uint32_t *src,
+                               uint32_t count) {
+  if (!_expand_lut_valid) {
+    _planar_build_lut();
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint64_t idx = _planar_expand(src[i]);
+    for (uint32_t j = 0; j < 8; ++j) {
+      dst[j] = (uint8_t)(idx >> (j * 8));
+    }
+    dst += 8;
+  }
+}
+
+// scalar lookup, each pixel written `scale` times
+static void _index_span_rgb(uint32_t *dst, const uint8_t *src, uint32_t count,
+                            const uint32_t *pal, uint32_t scale) {
+  if (scale == 1) {
+    for (uint32_t i = 0; i < count; ++i) {
+      dst[i] = pal[src[i]];
+    }
+    return;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t rgb = pal[src[i]];
+    for (uint32_t j = 0; j < scale; ++j) {
+      dst[j] = rgb;
+    }
+    dst += scale;
+  }
+}
+
+#if PLANAR_AVX2
+void planar_span_index(uint8_t *dst, const uint32_t *src, uint32_t count) {
+  // pixel bit within each plane byte, left most pixel first
+  const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ll);
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    // four words in both 128 bit lanes so pshufb can reach them all
+    const __m256i w =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(src + i)));
+    __m256i idx = _mm256_setzero_si256();
+    for (int p = 0; p < 4; ++p) {
+      // replicate plane `p` of word n across output bytes [n*8, n*8+8)
+      const __m256i sel = _mm256_setr_epi8(
+        p,      p,      p,      p,      p,      p,      p,      p,
+        p + 4,  p + 4,  p + 4,  p + 4,  p + 4,  p + 4,  p + 4,  p + 4,
+        p + 8,  p + 8,  p + 8,  p + 8,  p + 8,  p + 8,  p + 8,  p + 8,
+        p + 12, p + 12, p + 12, p + 12, p + 12, p + 12, p + 12, p + 12);
+      const __m256i b = _mm256_and_si256(_mm256_shuffle_epi8(w, sel), bits);
+      const __m256i m = _mm256_cmpeq_epi8(b, bits);
+      idx = _mm256_or_si256(idx, _mm256_and_si256(m, _mm256_set1_epi8(1 << p)));
+    }
+    _mm256_storeu_si256((__m256i *)(dst + i * 8), idx);
+  }
+  _planar_span_index(dst + i * 8, src + i, count - i);
+}
+
+void index_span_rgb(uint32_t *dst, const uint8_t *src, uint32_t count,
+                    const uint32_t *pal, uint32_t scale) {
+  uint32_t i = 0;
+  if (scale == 1) {
+    for (; i + 8 <= count; i += 8) {
+      const __m256i idx =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+      const __m256i rgb = _mm256_i32gather_epi32((const int *)pal, idx, 4);
+      _mm256_storeu_si256((__m256i *)(dst + i), rgb);
+    }
+  }
+  if (scale == 2) {
+    const __m256i lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    for (; i + 8 <= count; i += 8) {
+      const __m256i idx =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+      const __m256i rgb = _mm256_i32gather_epi32((const int *)pal, idx, 4);
+      _mm256_storeu_si256((__m256i *)(dst + i * 2 + 0),
+                          _mm256_permutevar8x32_epi32(rgb, lo));
+      _mm256_storeu_si256((__m256i *)(dst + i * 2 + 8),
+                          _mm256_permutevar8x32_epi32(rgb, hi));
+    }
+  }
+  _index_span_rgb(dst + i * scale, src + i, count - i, pal, scale);
+}
+
+#elif PLANAR_SSE2
+void planar_span_index(uint8_t *dst, const uint32_t *src, uint32_t count) {
+  // pixel bit within each plane byte, left most pixel first
+  const __m128i bits = _mm_set_epi8(
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+  uint32_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i idx = _mm_setzero_si128();
+    for (int p = 0; p < 4; ++p) {
+      // plane `p` of the first word in the low half, second in the high
+      const __m128i b = _mm_unpacklo_epi64(
+        _mm_set1_epi8((char)(src[i + 0] >> (p * 8))),
+        _mm_set1_epi8((char)(src[i + 1] >> (p * 8))));
+      const __m128i m = _mm_cmpeq_epi8(_mm_and_si128(b, bits), bits);
+      idx = _mm_or_si128(idx, _mm_and_si128(m, _mm_set1_epi8(1 << p)));
+    }
+    _mm_storeu_si128((__m128i *)(dst + i * 8), idx);
+  }
+  _planar_span_index(dst + i * 8, src + i, count - i);
+}
+
+// sse2 has no gather so the lookups are scalar, but the stores are not
+void index_span_rgb(uint32_t *dst, const uint8_t *src, uint32_t count,
+                    const uint32_t *pal, uint32_t scale) {
+  uint32_t i = 0;
+  if (scale == 1) {
+    for (; i + 4 <= count; i += 4) {
+      const __m128i rgb = _mm_setr_epi32(pal[src[i + 0]], pal[src[i + 1]],
+                                         pal[src[i + 2]], pal[src[i + 3]]);
+      _mm_storeu_si128((__m128i *)(dst + i), rgb);
+    }
+  }
+  if (scale == 2) {
+    for (; i + 4 <= count; i += 4) {
+      const __m128i rgb = _mm_setr_epi32(pal[src[i + 0]], pal[src[i + 1]],
+                                         pal[src[i + 2]], pal[src[i + 3]]);
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 0),
+                       _mm_unpacklo_epi32(rgb, rgb));
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 4),
+                       _mm_unpackhi_epi32(rgb, rgb));
+    }
+  }
+  _index_span_rgb(dst + i * scale, src + i, count - i, pal, scale);
+}
+
+#else
+void planar_span_index(uint8_t *dst, const uint32_t *src, uint32_t count) {
+  _planar_span_index(dst, src, count);
+}
+
+void index_span_rgb(uint32_t *dst, const uint8_t *src, uint32_t count,
+                    const uint32_t *pal, uint32_t scale) {
+  _index_span_rgb(dst, src, count, pal, scale);
+}
+#endif
@@ -28,8 +28,125 @@
 #include "../frontend/frontend.h"
 
 
-// offscreen render target
-static uint32_t _temp[320 * 240];
+// indexed framebuffer, one palette index per pixel at the mode resolution
+static uint8_t _index[640 * 480];
+// scanlines of `_index` updated this frame
+static bool _index_dirty[480];
+// video memory offset and pel panning each scanline was last decoded from
+static uint32_t _index_src[480];
+
+// force a full redraw on the next frame
+static bool _invalidate = true;
+// the current frame is being redrawn in full
+static bool _full;
+// the palette changed so every indexed line must be converted again
+static bool _repalette;
+// something was drawn during the current frame
+static bool _drawn;
+// number of raster entries in the last frame
+static uint32_t _raster_last;
+
+void neo_render_invalidate(void) {
+  _invalidate = true;
+}
+
+// returns true if a scanline sourced from video memory [addr, addr+size)
+// needs to be decoded this frame
+static bool _line_dirty(uint32_t addr, uint32_t size) {
+  return _full || neo_frame_dirty_span(addr, size);
+}
+
+// as above for `size` units from `offset` of the 64k display memory, which
+// may wrap back around to the start
+static bool _line_dirty_wrap(uint32_t offset, uint32_t size) {
+  const uint32_t first = SDL_min(size, 0x10000 - offset);
+  return _line_dirty(0xA0000 + offset, first) ||
+         (first < size && _line_dirty(0xA0000, size - first));
+}
+
+// walks the raster entries down the screen
+struct raster_iter_t {
+  const struct neo_raster_t *r, *end;
+  // palette log of the frame and how much of it has been applied
+  const struct neo_dac_write_t *log;
+  uint32_t log_pos;
+  // palette for the current entry
+  uint32_t dac[NEO_DAC_SIZE];
+};
+
+// bring the palette up to the current entry
+static void _raster_dac(struct raster_iter_t *it) {
+  for (; it->log_pos < it->r->dac_end; ++it->log_pos) {
+    const struct neo_dac_write_t *w = it->log + it->log_pos;
+    it->dac[w->index] = w->rgb;
+  }
+}
+
+static void _raster_begin(struct raster_iter_t *it) {
+  const struct neo_frame_t *frame = neo_frame();
+  it->r = frame->raster;
+  it->end = frame->raster + frame->num_raster;
+  it->log = frame->dac_log;
+  it->log_pos = 0;
+  memcpy(it->dac, frame->dac, sizeof(it->dac));
+  _raster_dac(it);
+}
+
+// raster entry for line `y` of a mode `height` lines high
+static const struct neo_raster_t *_raster_at(struct raster_iter_t *it,
+                                             uint32_t y, uint32_t height) {
+  const uint32_t beam = y * VGA_VISIBLE_LINES / height;
+  while (it->r + 1 < it->end && it->r[1].line <= beam) {
+    ++it->r;
+    _raster_dac(it);
+  }
+  return it->r;
+}
+
+// where a scanline is fetched from in display memory
+struct line_src_t {
+  // offset in display memory units
+  uint32_t offset;
+  // pixels to skip at the start of the line
+  uint32_t pan;
+};
+
+// follow the crtc start address, line compare and attribute pel panning
+// `unit` is the number of display memory units per start address step,
+// `pan_shift` converts the panning register into pixels
+static void _line_source(struct line_src_t *out,
+                         const struct neo_raster_t *r,
+                         const uint32_t y, const uint32_t height,
+                         const uint32_t stride, const uint32_t unit,
+                         const uint32_t pan_shift) {
+  const struct neo_frame_t *frame = neo_frame();
+  // the line compare counts scanlines so double scanned modes halve it
+  const uint32_t scan = (height <= 240) ? 2 : 1;
+  const uint32_t split = (frame->line_compare + 1) / scan;
+  out->pan = (r->pel_pan & 7) >> pan_shift;
+  if (y < split) {
+    out->offset = r->start_addr * unit + y * stride;
+  }
+  else {
+    // lines after the line compare restart at the top of memory
+    out->offset = (y - split) * stride;
+    if (frame->pan_reset) {
+      out->pan = 0;
+    }
+  }
+  out->offset &= 0xffff;
+}
+
+// fill the entire target with the border colour
+static void _neo_clear(const struct render_target_t *target) {
+  uint32_t *dsty = target->dst;
+  for (uint32_t y = 0; y < target->h; ++y) {
+    for (uint32_t x = 0; x < target->w; ++x) {
+      dsty[x] = 0x050505;
+    }
+    dsty += target->pitch;
+  }
+}
 
 
 // render a grey/black dither pattern
@@ -44,34 +161,62 @@ static void _neo_render_mode_unknown(const struct render_target_t *target) {
   }
 }
 
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// text modes
+//
+// A shadow copy of the character/attribute pairs drawn on the last frame is
+// kept so that only cells which have changed get rasterised again.  The
+// cursor state is tracked the same way, and when it changes the cells under
+// the old and new cursor positions are redrawn.
+
+#define TEXT_COLS 80
+#define TEXT_ROWS 25
+
+// character | (attribute << 8) last drawn for each cell
+static uint32_t _text_shadow[TEXT_COLS * TEXT_ROWS];
+
+// shadow value that never matches a real cell
+#define TEXT_STALE (~0u)
+
+struct text_cursor_t {
+  // cell index
+  uint32_t cell;
+  // scanline range
+  uint8_t start, end;
+  // on screen and in the visible blink phase
+  bool visible;
+};
+
+static struct text_cursor_t _cursor_last;
+
+static void _neo_cursor_state(struct text_cursor_t *out,
+                              const uint32_t cols, const uint32_t rows) {
+  memset(out, 0, sizeof(*out));
+  // convert address to location
+  const uint32_t cursor = neo_frame()->cursor_addr;
+  const uint32_t x = cursor % cols;
+  const uint32_t y = cursor / cols;
+  out->cell  = cursor;
+  out->start = neo_frame()->cursor_start;
+  out->end   = neo_frame()->cursor_end;
+  // blink and bail out if offscreen
+  out->visible = neo_frame()->cursor_blink && (x < cols && y < rows);
+}
+
 static void _neo_draw_cursor(const struct render_target_t *target,
                              const uint8_t chw, const uint8_t chh,
-                             const uint8_t w, const uint8_t h,
-                             const uint32_t yoffset) {
-
-  // blink
-  if ((SDL_GetTicks() % 1000) > 500) {
-    return;
-  }
-  // convert address to location
-  const uint32_t cursor = neo_crt_cursor_addr();
-  const uint32_t x = cursor % w;
-  const uint32_t y = cursor / w;
-  // bail out if offscreen
-  if (x >= w || y >= h) {
-    return;
-  }
+                             const uint32_t cols, const uint32_t yoffset,
+                             const struct text_cursor_t *cur) {
+  const uint32_t x = cur->cell % cols;
+  const uint32_t y = cur->cell / cols;
   // draw target
   const uint32_t pitch = target->pitch;
   uint32_t *dst = target->dst;
   dst += yoffset * pitch;
   dst += chw * x + chh * y * pitch;
-  // scanline locations
-  const uint32_t start = neo_crt_cursor_start();
-  const uint32_t end   = neo_crt_cursor_end();
   // draw it
   for (uint32_t y = 0; y < chh; ++y) {
-    if (y >= start && y <= end) {
+    if (y >= cur->start && y <= cur->end) {
       for (uint32_t x = 0; x < chw; ++x) {
         dst[x] = 0xffffff;
       }
@@ -80,34 +225,73 @@ static void _neo_draw_cursor(const struct render_target_t *target,
   }
 }
 
-// 80x25 greyscale text mode
-static void _neo_render_mode_02(const struct render_target_t *target) {
+// 80x25 text mode
+// `pal` maps attribute nibbles to rgb, or is NULL for fixed monochrome
+static void _neo_render_text(const struct render_target_t *target,
+                             const uint32_t *pal, const bool cursor) {
   // text mode buffer address
-  uint32_t src = 0xB8000;
+  const uint32_t base = 0xB8000;
   // cga/PCjr = 8x8  char px
   // EGA      = 8x14 char px
   // MCGA     = 8x16 char px
   // VGA      = 9x16 char px
   const int chw = 8, chh = 16;
   // step through VGA text-mode buffer
-  const int rows = 25, cols = 80;
+  const int rows = TEXT_ROWS, cols = TEXT_COLS;
   // screen buffer position
   const uint32_t pitch = target->pitch;
-  uint32_t *dsty = target->dst;
   const uint32_t yoffset = (target->h - (chh * rows)) / 2;
-  dsty += pitch * yoffset;
+
+  if (_full) {
+    for (int i = 0; i < rows * cols; ++i) {
+      _text_shadow[i] = TEXT_STALE;
+    }
+  }
+
+  // redraw the cells under the old and new cursor if it has changed
+  struct text_cursor_t cur;
+  _neo_cursor_state(&cur, cols, rows);
+  cur.visible &= cursor;
+  const bool cursor_moved = memcmp(&cur, &_cursor_last, sizeof(cur)) != 0;
+  if (cursor_moved) {
+    if (_cursor_last.cell < (uint32_t)(rows * cols)) {
+      _text_shadow[_cursor_last.cell] = TEXT_STALE;
+    }
+    if (cur.cell < (uint32_t)(rows * cols)) {
+      _text_shadow[cur.cell] = TEXT_STALE;
+    }
+    _cursor_last = cur;
+  }
+
+  // nothing to do if the text buffer and cursor are unchanged
+  if (!_full && !cursor_moved &&
+      !neo_frame_dirty_span(base, rows * cols * 2)) {
+    return;
+  }
+
+  bool cursor_drawn = false;
+
   // blit loop
+  const uint8_t *src = neo_frame()->text + (base - 0xB8000);
+  uint32_t *dsty = target->dst + pitch * yoffset;
   for (int y = 0; y < rows; ++y) {
     uint32_t *dstx = dsty;
     for (int x = 0; x < cols; ++x) {
+      const uint32_t cell = y * cols + x;
       // grab character and attribute
-      const uint8_t ch = RAM[src + 0];
-      const uint8_t at = RAM[src + 1];
-      // decode colour from attribute
-      const uint32_t rgba = palette_cga_2_rgb[at & 0xf];
-      const uint32_t rgbb = palette_cga_2_rgb[at >> 4];
-      // draw the glyph
-      font_draw_glyph_8x16(dstx, pitch, ch + 0x100, rgba, rgbb);
+      const uint8_t ch = src[0];
+      const uint8_t at = src[1];
+      const uint32_t val = ch | (at << 8);
+      if (_text_shadow[cell] != val) {
+        _text_shadow[cell] = val;
+        // decode colour from attribute
+        const uint32_t rgba = pal ? pal[at & 0xf] : 0xaaaaaa;
+        const uint32_t rgbb = pal ? pal[at >> 4]  : 0x0;
+        // draw the glyph
+        font_draw_glyph_8x16(dstx, pitch, ch + 0x100, rgba, rgbb);
+        cursor_drawn |= (cell == cur.cell);
+        _drawn = true;
+      }
       // step over to next glyph
       dstx += chw;
       // step over character and attribute
@@ -117,370 +301,242 @@ static void _neo_render_mode_02(const struct render_target_t *target) {
     dsty += pitch * chh;
   }
   // this is text mode so draw the cursor if needed
-  _neo_draw_cursor(target, chw, chh, cols, rows, yoffset);
+  if (cursor_drawn && cur.visible) {
+    _neo_draw_cursor(target, chw, chh, cols, yoffset, &cur);
+  }
+}
+
+// 80x25 greyscale text mode
+static void _neo_render_mode_02(const struct render_target_t *target) {
+  _neo_render_text(target, palette_cga_2_rgb, true);
 }
 
 // 80x25 16-colour text mode
 static void _neo_render_mode_03(const struct render_target_t *target) {
-  const uint32_t base = 0xB8000;
-  // text mode buffer address
-  uint32_t src = 0xB8000;
-  // cga/PCjr = 8x8  char px
-  // EGA      = 8x14 char px
-  // MCGA     = 8x16 char px
-  // VGA      = 9x16 char px
-  const int chw = 8, chh = 16;
-  // step through VGA text-mode buffer
-  const int rows = 25, cols = 80;
-  // screen buffer position
-  const uint32_t pitch = target->pitch;
-  uint32_t *dsty = target->dst;
-  const uint32_t yoffset = (target->h - (chh * rows)) / 2;
-  dsty += pitch * yoffset;
-  // blit loop
-  for (int y=0; y<rows; ++y) {
-    uint32_t *dstx = dsty;
-    for (int x=0; x<cols; ++x) {
-      // grab character and attribute
-      const uint8_t ch = RAM[src + 0];
-      const uint8_t at = RAM[src + 1];
-      // decode colour from attribute
-      const uint32_t rgba = palette_cga_3_rgb[at & 0xf];
-      const uint32_t rgbb = palette_cga_3_rgb[at >> 4];
-      // draw the glyph
-      font_draw_glyph_8x16(dstx, pitch, ch + 0x100, rgba, rgbb);
-      // step over to next glyph
-      dstx += chw;
-      // step over character and attribute
-      src += 2;
-    }
-    // step over glyph line
-    dsty += pitch * chh;
-  }
-  // this is text mode so draw the cursor if needed
-  _neo_draw_cursor(target, chw, chh, cols, rows, yoffset);
+  _neo_render_text(target, palette_cga_3_rgb, true);
 }
 
-// 320x200 4-colour graphics mode interleaved
-static void _neo_render_mode_04(void) {
+// 80x25 monochrome text mode
+// XXX: untested
+static void _neo_render_mode_07(const struct render_target_t *target) {
+  _neo_render_text(target, NULL, false);
+}
+
+// decode cga 2 bit per pixel video memory into the indexed framebuffer
+static void _neo_decode_cga(void) {
   // buffer address
-  uint32_t src = 0xB8000;
-  uint32_t span = 1024 * 8;
-  // screen buffer position
-  const uint32_t pitch = 320;
-  uint32_t *dsty = _temp;
-  // blit loop
+  const uint32_t src = 0xB8000;
+  const uint32_t span = 1024 * 8;
+  const uint8_t *text = neo_frame()->text;
+  // decode loop
   for (int y=0; y<200; ++y) {
-    uint32_t *dstx = dsty;
-    uint32_t srcx = src + ((y & 1) ? span : 0);
+    // even lines are in the first bank, odd lines in the second
+    uint32_t srcx = src + ((y & 1) ? span : 0) + (y >> 1) * (320 / 4);
+    _index_dirty[y] = _line_dirty(srcx, 320 / 4);
+    if (!_index_dirty[y]) {
+      continue;
+    }
+    uint8_t *dstx = _index + y * 320;
     for (int x=0; x<320; x += 4, ++srcx) {
-      const uint8_t ch = RAM[srcx];
-      dstx[x + 3] = palette_cga_4_rgb[0x3 & (ch >> 0)];
-      dstx[x + 2] = palette_cga_4_rgb[0x3 & (ch >> 2)];
-      dstx[x + 1] = palette_cga_4_rgb[0x3 & (ch >> 4)];
-      dstx[x + 0] = palette_cga_4_rgb[0x3 & (ch >> 6)];
+      const uint8_t ch = text[srcx - 0xB8000];
+      dstx[x + 3] = 0x3 & (ch >> 0);
+      dstx[x + 2] = 0x3 & (ch >> 2);
+      dstx[x + 1] = 0x3 & (ch >> 4);
+      dstx[x + 0] = 0x3 & (ch >> 6);
     }
-    dsty += pitch;
-    src += (y & 1) ? (320 / 4) : 0;
   }
 }
 
-// 320x200 greyscale graphics mode interleaved
-static void _neo_render_mode_05(void) {
-
-  static const uint32_t ramp[] = {
-    0x000000, 0x444444, 0x888888, 0xcccccc
-  };
-
-  // buffer address
-  uint32_t src = 0xB8000;
-  uint32_t span = 1024 * 8;
-  // screen buffer position
-  const uint32_t pitch = 320;
-  uint32_t *dsty = _temp;
-  // blit loop
-  for (int y=0; y<200; ++y) {
-    uint32_t *dstx = dsty;
-    uint32_t srcx = src + ((y & 1) ? span : 0);
-    for (int x=0; x<320; x += 4, ++srcx) {
-      const uint8_t ch = RAM[srcx];
-      dstx[x + 3] = ramp[0x3 & (ch >> 0)];
-      dstx[x + 2] = ramp[0x3 & (ch >> 2)];
-      dstx[x + 1] = ramp[0x3 & (ch >> 4)];
-      dstx[x + 0] = ramp[0x3 & (ch >> 6)];
+// decode 16 colour planar video memory into the indexed framebuffer
+static void _neo_decode_planar(const uint32_t width, const uint32_t height) {
+  const uint32_t stride = width / 8;
+  // video ram at 0xA0000 (interleaved planes)
+  const uint32_t *planes = neo_frame()->vram;
+  // one extra word to pan into
+  uint8_t line[640 + 8];
+  struct raster_iter_t it;
+  _raster_begin(&it);
+  for (uint32_t y = 0; y < height; ++y) {
+    struct line_src_t src;
+    _line_source(&src, _raster_at(&it, y, height), y, height, stride, 1, 0);
+    const uint32_t words = stride + (src.pan ? 1 : 0);
+    const uint32_t key = src.offset | (src.pan << 16);
+    _index_dirty[y] = _line_dirty_wrap(src.offset, words) ||
+                      _index_src[y] != key;
+    if (!_index_dirty[y]) {
+      continue;
+    }
+    _index_src[y] = key;
+    uint8_t *dst = src.pan ? line : _index + y * width;
+    // the line may wrap back around to the start of memory
+    const uint32_t first = SDL_min(words, 0x10000 - src.offset);
+    planar_span_index(dst, planes + src.offset, first);
+    planar_span_index(dst + first * 8, planes, words - first);
+    if (src.pan) {
+      memcpy(_index + y * width, line + src.pan, width);
     }
-    dsty += pitch;
-    src += (y & 1) ? (320 / 4) : 0;
   }
 }
 
-// 80x25 greyscale text mode
-// XXX: untested
-static void _neo_render_mode_07(const struct render_target_t *target) {
-  // text mode buffer address
-  uint32_t src = 0xB8000;
-  // cga/PCjr = 9x14  char px
-  const int chw = 8, chh = 16;
-  // step through VGA text-mode buffer
-  const int rows = 25, cols = 80;
-  // screen buffer position
-  const uint32_t pitch = target->pitch;
-  uint32_t *dsty = target->dst;
-  dsty += pitch * ((target->h - (chh * rows)) / 2);
-  // blit loop
-  for (int y=0; y<rows; ++y) {
-    uint32_t *dstx = dsty;
-    for (int x=0; x<cols; ++x) {
-      // grab character and attribute
-      const uint8_t ch = RAM[src + 0];
-      const uint8_t at = RAM[src + 1];
-      // draw the glyph
-      font_draw_glyph_8x16(dstx, pitch, ch + 0x100, 0xaaaaaa, 0x0);
-      // step over to next glyph
-      dstx += chw;
-      // step over character and attribute
-      src += 2;
+// decode chained 256 colour video memory into the indexed framebuffer
+// chain 4 places each pixel in the plane picked by its low address bits
+static void _neo_decode_256(void) {
+  const uint32_t *vram = neo_frame()->vram;
+  struct raster_iter_t it;
+  _raster_begin(&it);
+  for (uint32_t y = 0; y < 200; ++y) {
+    // the start address counts in groups of four pixels and panning moves
+    // in pixel pairs
+    struct line_src_t src;
+    _line_source(&src, _raster_at(&it, y, 200), y, 200, 320, 4, 1);
+    src.offset = (src.offset + src.pan) & 0xffff;
+    _index_dirty[y] = _line_dirty_wrap(src.offset, 320) ||
+                      _index_src[y] != src.offset;
+    if (!_index_dirty[y]) {
+      continue;
+    }
+    _index_src[y] = src.offset;
+    uint8_t *dst = _index + y * 320;
+    for (uint32_t x = 0; x < 320; ++x) {
+      const uint32_t p = (src.offset + x) & 0xffff;
+      dst[x] = (uint8_t)(vram[p & ~3u] >> ((p & 3) * 8));
     }
-    // step over glyph line
-    dsty += pitch * chh;
   }
 }
 
-static void _neo_render_mode_0e(const struct render_target_t *target) {
-  //
-  static const uint32_t width = 640;
-  static const uint32_t height = 200;
-  // vga dac palette
-  const uint32_t *dac = neo_ega_dac();
-  // video ram at 0xA0000
-  const uint8_t *plane0 = vga_ram() + 0x10000 * 0;
-  const uint8_t *plane1 = vga_ram() + 0x10000 * 1;
-  const uint8_t *plane2 = vga_ram() + 0x10000 * 2;
-  const uint8_t *plane3 = vga_ram() + 0x10000 * 3;
-  // target memory
-  uint32_t *dsty = target->dst;
-  const uint32_t pitch = target->pitch;
-  // center
-  dsty += ((target->h - (height * 2)) / 2) * pitch;
-  // blit loop
+// decode unchained (mode x) 256 colour video memory
+// pixel x of a line is in plane x & 3 at word x / 4
+static void _neo_decode_unchained(const uint32_t height) {
+  const uint32_t *vram = neo_frame()->vram;
+  // byte mode so the offset register counts pairs of words
+  const uint32_t line_offset = neo_frame()->line_offset;
+  const uint32_t stride = line_offset ? line_offset * 2 : 320 / 4;
+  struct raster_iter_t it;
+  _raster_begin(&it);
   for (uint32_t y = 0; y < height; ++y) {
-    uint32_t *dstx = dsty;
-    for (uint32_t x = 0; x < (width / 8); ++x) {
-      // get the next colour bytes from each plane
-      const uint8_t b0 = plane0[x];
-      const uint8_t b1 = plane1[x];
-      const uint8_t b2 = plane2[x];
-      const uint8_t b3 = plane3[x];
-      // write 8 pixels at a time
-      for (int i=0; i<8; ++i) {
-        const uint8_t mask = 0x80 >> i;
-        // combine bits for colour index
-        const uint8_t index = ((b0 & mask) ? 1 : 0) |
-                              ((b1 & mask) ? 2 : 0) |
-                              ((b2 & mask) ? 4 : 0) |
-                              ((b3 & mask) ? 8 : 0);
-        const uint32_t rgb = dac[index];
-        // XXX: this palette index is not right
-        *dstx           = rgb;
-        *(dstx + pitch) = rgb;
-        // next dest
-        ++dstx;
-      }
+    struct line_src_t src;
+    _line_source(&src, _raster_at(&it, y, height), y, height, stride, 1, 1);
+    const uint32_t key = src.offset | (src.pan << 16);
+    _index_dirty[y] = _line_dirty_wrap(src.offset, 320 / 4 + 1) ||
+                      _index_src[y] != key;
+    if (!_index_dirty[y]) {
+      continue;
+    }
+    _index_src[y] = key;
+    uint8_t *dst = _index + y * 320;
+    for (uint32_t x = 0; x < 320; ++x) {
+      const uint32_t px = x + src.pan;
+      const uint32_t word = vram[(src.offset + (px >> 2)) & 0xffff];
+      dst[x] = (uint8_t)(word >> ((px & 3) * 8));
     }
-    // step over the destination
-    dsty += pitch * 2;
-    // step the planes
-    plane0 += (width / 8);
-    plane1 += (width / 8);
-    plane2 += (width / 8);
-    plane3 += (width / 8);
   }
 }
 
-static void _neo_render_mode_0d(void) {
-  const uint32_t *dac = neo_ega_dac();
-  // clear temp buffer
-  memset(_temp, 0, 320 * 240 * 4);
-  // video ram at 0xA0000
-  const uint8_t *plane0 = vga_ram() + 0x10000 * 0;
-  const uint8_t *plane1 = vga_ram() + 0x10000 * 1;
-  const uint8_t *plane2 = vga_ram() + 0x10000 * 2;
-  const uint8_t *plane3 = vga_ram() + 0x10000 * 3;
-  // writing to temporary buffer
-  uint32_t *dsty = _temp;
-  // blit loop
-  for (int y = 0; y < 200; ++y) {
-    uint32_t *dstx = dsty;
-    for (int x = 0; x < (320 / 8); ++x) {
-      // get the next colour bytes from each plane
-      const uint8_t b0 = plane0[x];
-      const uint8_t b1 = plane1[x];
-      const uint8_t b2 = plane2[x];
-      const uint8_t b3 = plane3[x];
-      // write 8 pixels at a time
-      for (int i=0; i<8; ++i) {
-        const uint8_t mask = 0x80 >> i;
-        // combine bits for colour index
-        const uint32_t index = ((b0 & mask) ? 1 : 0) |
-                               ((b1 & mask) ? 2 : 0) |
-                               ((b2 & mask) ? 4 : 0) |
-                               ((b3 & mask) ? 8 : 0);
-
-        // XXX: this palette index is not right!
-        *dstx = dac[index];
-        // next dest
-        ++dstx;
-      }
-    }
-    // step over the destination
-    dsty += 320;
-    // step the planes
-    plane0 += (320 / 8);
-    plane1 += (320 / 8);
-    plane2 += (320 / 8);
-    plane3 += (320 / 8);
-  }
+// palette for the lines covered by the current raster entry
+typedef const uint32_t *(*raster_pal_t)(const struct raster_iter_t *it);
+
+static const uint32_t *_pal_ega(const struct raster_iter_t *it) {
+  return it->dac + NEO_DAC_EGA;
 }
 
-static void _neo_render_mode_10(const struct render_target_t *target) {
-  //
-  static const uint32_t width = 640;
-  static const uint32_t height = 350;
-  // vga dac palette
-  const uint32_t *dac = neo_vga_dac();
-  // video ram at 0xA0000
-  const uint8_t *plane0 = vga_ram() + 0x10000 * 0;
-  const uint8_t *plane1 = vga_ram() + 0x10000 * 1;
-  const uint8_t *plane2 = vga_ram() + 0x10000 * 2;
-  const uint8_t *plane3 = vga_ram() + 0x10000 * 3;
-  // destination
-  uint32_t *dsty = target->dst;
-  const uint32_t pitch = target->pitch;
-  dsty += pitch * ((target->h - height) / 2);
-  // blit loop
-  for (uint32_t y = 0; y < height; ++y) {
-    uint32_t *dstx = dsty;
-    for (uint32_t x = 0; x < (width / 8); ++x) {
-      // get the next colour bytes from each plane
-      const uint8_t b0 = plane0[x];
-      const uint8_t b1 = plane1[x];
-      const uint8_t b2 = plane2[x];
-      const uint8_t b3 = plane3[x];
-      // write 8 pixels at a time
-      for (int i=0; i<8; ++i) {
-        const uint8_t mask = 0x80 >> i;
-        // combine bits for colour index
-        const uint32_t index = ((b0 & mask) ? 1 : 0) |
-                               ((b1 & mask) ? 2 : 0) |
-                               ((b2 & mask) ? 4 : 0) |
-                               ((b3 & mask) ? 8 : 0);
-        *dstx = dac[index];
-        // next dest
-        ++dstx;
-      }
-    }
-    // step over the destination
-    dsty += pitch;
-    // step the planes
-    plane0 += (width / 8);
-    plane1 += (width / 8);
-    plane2 += (width / 8);
-    plane3 += (width / 8);
-  }
+static const uint32_t *_pal_vga(const struct raster_iter_t *it) {
+  return it->dac;
 }
 
-static void _neo_render_mode_13(void) {
-  const uint32_t *dac = neo_vga_dac();
-  // clear temp buffer
-  memset(_temp, 0, 320 * 240 * 4);
-  // source now is our video ram at 0xA0000
-  const uint8_t *srcy = vga_ram();
-  // writing to temporary buffer
-  uint32_t *dst = _temp;
-  // blit loop
-  for (int y = 0; y < 200; ++y) {
-    const uint8_t *srcx = srcy;
-    for (int x = 0; x < 320; ++x) {
-      dst[x] = dac[srcx[x]];
-    }
-    dst += 320;
-    srcy += 320;
-  }
+static const uint32_t *_pal_cga(const struct raster_iter_t *it) {
+  return palette_cga_4_rgb;
 }
 
-static void _neo_render_mode_12(const struct render_target_t *target) {
-  //
-  static const uint32_t width = 640;
-  static const uint32_t height = 480;
-  // vga dac palette
-  const uint32_t *dac = neo_vga_dac();
-  // video ram at 0xA0000
-  const uint8_t *plane0 = vga_ram() + 0x10000 * 0;
-  const uint8_t *plane1 = vga_ram() + 0x10000 * 1;
-  const uint8_t *plane2 = vga_ram() + 0x10000 * 2;
-  const uint8_t *plane3 = vga_ram() + 0x10000 * 3;
-  // destination
-  uint32_t *dsty = target->dst;
+static const uint32_t *_pal_cga_grey(const struct raster_iter_t *it) {
+  static const uint32_t ramp[] = {
+    0x000000, 0x444444, 0x888888, 0xcccccc
+  };
+  return ramp;
+}
+
+// convert the indexed framebuffer to rgb straight onto the target
+// the image is scaled by the largest integer factor that fits the target,
+// with each pixel covering `xaspect` by `yaspect` target pixels at 1x
+static void _neo_convert(const struct render_target_t *target,
+                         const uint32_t width, const uint32_t height,
+                         const uint32_t xaspect, const uint32_t yaspect,
+                         raster_pal_t pal) {
+  uint32_t scale = target->w / (width * xaspect);
+  if (scale > target->h / (height * yaspect)) {
+    scale = target->h / (height * yaspect);
+  }
+  scale = scale ? scale : 1;
+  const uint32_t xscale = scale * xaspect;
+  const uint32_t yscale = scale * yaspect;
+  // clip to the target and centre
   const uint32_t pitch = target->pitch;
-  dsty += pitch * ((target->h - height) / 2);
-  // blit loop
-  for (uint32_t y = 0; y < height; ++y) {
-    uint32_t *dstx = dsty;
-    for (uint32_t x = 0; x < (width / 8); ++x) {
-      // get the next colour bytes from each plane
-      const uint8_t b0 = plane0[x];
-      const uint8_t b1 = plane1[x];
-      const uint8_t b2 = plane2[x];
-      const uint8_t b3 = plane3[x];
-      // write 8 pixels at a time
-      for (int i=0; i<8; ++i) {
-        const uint8_t mask = 0x80 >> i;
-        // combine bits for colour index
-        const uint32_t index = ((b0 & mask) ? 1 : 0) |
-                               ((b1 & mask) ? 2 : 0) |
-                               ((b2 & mask) ? 4 : 0) |
-                               ((b3 & mask) ? 8 : 0);
-        *dstx = dac[index];
-        // next dest
-        ++dstx;
+  const uint32_t w = (width * xscale > target->w) ? target->w / xscale : width;
+  const uint32_t h = (height * yscale > target->h) ? target->h / yscale : height;
+  uint32_t *dst = target->dst +
+    pitch * ((target->h - h * yscale) / 2) + (target->w - w * xscale) / 2;
+  const uint8_t *src = _index;
+  struct raster_iter_t it;
+  _raster_begin(&it);
+  for (uint32_t y = 0; y < h; ++y) {
+    _raster_at(&it, y, height);
+    // a palette change needs every line but not a fresh decode
+    if (_repalette || _index_dirty[y]) {
+      index_span_rgb(dst, src, w, pal(&it), xscale);
+      for (uint32_t i = 1; i < yscale; ++i) {
+        memcpy(dst + pitch * i, dst, w * xscale * sizeof(uint32_t));
       }
+      _drawn = true;
     }
-    // step over the destination
-    dsty += pitch;
-    // step the planes
-    plane0 += (width / 8);
-    plane1 += (width / 8);
-    plane2 += (width / 8);
-    plane3 += (width / 8);
+    dst += pitch * yscale;
+    src += width;
   }
 }
 
-// blit offscreen render target to screen
-static void blit_2x(uint32_t w, uint32_t h, const struct render_target_t *target) {
+// 320x200 4-colour graphics mode interleaved
+static void _neo_render_mode_04(const struct render_target_t *target) {
+  _neo_decode_cga();
+  _neo_convert(target, 320, 200, 1, 1, _pal_cga);
+}
+
+// 320x200 greyscale graphics mode interleaved
+static void _neo_render_mode_05(const struct render_target_t *target) {
+  _neo_decode_cga();
+  _neo_convert(target, 320, 200, 1, 1, _pal_cga_grey);
+}
 
-  // TODO: check bounds
+static void _neo_render_mode_0d(const struct render_target_t *target) {
+  _neo_decode_planar(320, 200);
+  // XXX: this palette index is not right!
+  _neo_convert(target, 320, 200, 1, 1, _pal_ega);
+}
 
-  const uint32_t pitch = target->pitch;
-  uint32_t *dst = target->dst;
-  // offset to centre
-  if (target->h > (int32_t)(2 * h)) {
-    dst += pitch * ((target->h - h * 2) / 2);
-  }
-  // blit loop
-  const uint32_t *src = _temp;
-  for (uint32_t y = 0; y < h; ++y) {
-    uint32_t *dstx = dst;
-    for (uint32_t x = 0; x < w; ++x) {
-      const uint32_t rgb = src[x];
-      dstx[      + 0] = rgb;
-      dstx[      + 1] = rgb;
-      dstx[pitch + 0] = rgb;
-      dstx[pitch + 1] = rgb;
-      dstx += 2;
-    }
-    dst += pitch * 2;
-    src += w;
+static void _neo_render_mode_0e(const struct render_target_t *target) {
+  _neo_decode_planar(640, 200);
+  // XXX: this palette index is not right
+  // double scanned so each pixel is twice as tall as it is wide
+  _neo_convert(target, 640, 200, 1, 2, _pal_ega);
+}
+
+static void _neo_render_mode_10(const struct render_target_t *target) {
+  _neo_decode_planar(640, 350);
+  _neo_convert(target, 640, 350, 1, 1, _pal_vga);
+}
+
+static void _neo_render_mode_12(const struct render_target_t *target) {
+  _neo_decode_planar(640, 480);
+  _neo_convert(target, 640, 480, 1, 1, _pal_vga);
+}
+
+static void _neo_render_mode_13(const struct render_target_t *target) {
+  if (neo_frame()->chain4) {
+    _neo_decode_256();
+    _neo_convert(target, 320, 200, 1, 1, _pal_vga);
+    return;
   }
+  // unchained modes may change the number of lines (320x240, 320x400)
+  const uint32_t lines = neo_frame()->lines;
+  _neo_decode_unchained(lines);
+  _neo_convert(target, 320, lines, lines > 240 ? 2 : 1, 1, _pal_vga);
 }
 
 static void _draw_disk(const struct render_target_t *target) {
@@ -498,26 +554,50 @@ static void _draw_disk(const struct render_target_t *target) {
   }
 }
 
-void neo_render_tick(const struct render_target_t *target) {
+bool neo_render_tick(const struct render_target_t *target) {
+
+  // a mode change affects every pixel on screen, while a palette change
+  // only needs the indexed framebuffer converted again
+  const uint32_t flags = neo_frame()->flags;
+  _full = _invalidate || (flags & NEO_DIRTY_MODE);
+  // lines may take their palette from a different raster entry than
+  // last frame even when no register has changed since
+  const uint32_t num_raster = neo_frame()->num_raster;
+  _repalette = _full || (flags & NEO_DIRTY_PALETTE) ||
+               num_raster > 1 || _raster_last > 1;
+  _raster_last = num_raster;
+  _drawn = false;
+
+  if (_full) {
+    _neo_clear(target);
+    _drawn = true;
+  }
 
-  switch (neo_get_video_mode()) {
+  switch (neo_frame()->mode) {
   case 0x02: _neo_render_mode_02(target); break;
   case 0x03: _neo_render_mode_03(target); break;
-  case 0x04: _neo_render_mode_04(); blit_2x(320, 200, target); break;
-  case 0x05: _neo_render_mode_05(); blit_2x(320, 200, target); break;
+  case 0x04: _neo_render_mode_04(target); break;
+  case 0x05: _neo_render_mode_05(target); break;
   case 0x07: _neo_render_mode_07(target); break;
-  case 0x0d: _neo_render_mode_0d(); blit_2x(320, 200, target); break;
+  case 0x0d: _neo_render_mode_0d(target); break;
   case 0x0e: _neo_render_mode_0e(target); break;
   case 0x10: _neo_render_mode_10(target); break;
   case 0x12: _neo_render_mode_12(target); break;
-  case 0x13: _neo_render_mode_13(); blit_2x(320, 200, target); break;
+  case 0x13: _neo_render_mode_13(target); break;
   default:
     _neo_render_mode_unknown(target);
+    _drawn = true;
     break;
   }
 
+  neo_frame_rendered();
+  _invalidate = false;
+
   // indicate disk activity
   if (osd_should_draw_disk()) {
     _draw_disk(target);
+    _drawn = true;
   }
+
+  return _drawn;
 }
@@ -33,6 +33,8 @@ struct vga_timing_t {
 static struct vga_timing_t _vga_timing;
 
 static bool _should_flip;
+// vertical refreshes since power on
+static uint32_t _frame_count;
 
 void vga_timing_init(void) {
 
@@ -68,12 +70,22 @@ void vga_timing_advance(const uint64_t cycles) {
   // wrap back into range
   while (_vga_timing.px_accum > _vga_timing.px_per_frame) {
     _should_flip = true;
+    ++_frame_count;
     // wrap back into range
     _vga_timing.px_accum -= _vga_timing.px_per_frame;
   }
 }
 
-uint8_t vga_timing_get_3da(void) {
+uint32_t vga_timing_frame_count(void) {
+  return _frame_count;
+}
+
+uint32_t vga_timing_frame_us(void) {
+  return (uint32_t)(1000000.0 / ((double)_vga_timing.hz * speed_scale));
+}
+
+// current beam position within the frame
+static void _vga_timing_beam(uint64_t *hpos, uint64_t *vpos) {
   // find our cycles part way through the slice
   double acc = _vga_timing.px_accum;
   acc += _vga_timing.px_per_cycle * (double)cpu_slice_ticks() * speed_scale;
@@ -83,16 +95,27 @@ uint8_t vga_timing_get_3da(void) {
   // current pixel in frame
   const uint64_t px_number = (uint64_t)acc;
   // horz and vert progression
-  const uint64_t hpos = px_number % _vga_timing.hlines;
-  const uint64_t vpos = px_number / _vga_timing.hlines;
+  *hpos = px_number % _vga_timing.hlines;
+  *vpos = px_number / _vga_timing.hlines;
+}
+
+uint8_t vga_timing_get_3da(void) {
+  uint64_t hpos, vpos;
+  _vga_timing_beam(&hpos, &vpos);
   // set vblank and hblank bits accordingly
   const bool in_hblank = (hpos >= 640);
-  const bool in_vblank = (vpos >= 400);
+  const bool in_vblank = (vpos >= VGA_VISIBLE_LINES);
   // vblank is 8 + 1
   return (in_vblank ? 9 : 0) |
          (in_hblank ? 1 : 0);
 }
 
+uint32_t vga_timing_get_line(void) {
+  uint64_t hpos, vpos;
+  _vga_timing_beam(&hpos, &vpos);
+  return (uint32_t)vpos;
+}
+
 bool vga_timing_should_flip(void) {
   return _should_flip;
 }
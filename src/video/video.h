@@ -30,7 +30,109 @@ uint8_t neo_crt_register(uint32_t index);
 uint8_t neo_crt_cursor_start(void);
 uint8_t neo_crt_cursor_end(void);
 
-const uint8_t *vga_ram(void);
+// sequencer and attribute controller access
+uint8_t neo_seq_register(uint32_t index);
+uint8_t neo_attr_register(uint32_t index);
+
+// interleaved plane memory, one 32bit word per address
+// plane N is held in bits [N*8 + 7 : N*8]
+const uint32_t *vga_ram(void);
+
+// display state dirty flags
+enum {
+  NEO_DIRTY_MODE    = 1,  // video mode or display registers changed
+  NEO_DIRTY_PALETTE = 2,  // dac or attribute palette changed
+  NEO_DIRTY_CURSOR  = 4,  // text cursor shape or position changed
+};
+
+// dirty state since the last call to neo_dirty_clear()
+uint32_t neo_dirty_flags(void);
+bool neo_dirty_span(uint32_t addr, uint32_t size);
+void neo_dirty_clear(void);
+
+// display registers which may change part way through a frame
+struct neo_raster_t {
+  // first beam line these registers apply from
+  uint32_t line;
+  // crtc start address
+  uint32_t start_addr;
+  // attribute pel panning
+  uint8_t pel_pan;
+  // end of the palette changes in the frame log applying from this entry
+  uint32_t dac_end;
+};
+
+// enough entries for a change on every visible line plus the final state
+#define NEO_RASTER_MAX (VGA_VISIBLE_LINES + 1)
+
+// the vga dac followed by the ega attribute palette
+#define NEO_DAC_EGA 256
+#define NEO_DAC_SIZE (NEO_DAC_EGA + 16)
+
+// a palette entry changed part way through a frame
+struct neo_dac_write_t {
+  uint16_t index;
+  uint32_t rgb;
+};
+
+// most palette changes recorded in a single frame, later changes take
+// effect from the first entry of the next frame
+#define NEO_DAC_LOG_MAX 4096
+
+// display state handed from the emulator to the renderer at vblank
+struct neo_frame_t {
+  int mode;
+  // vertical refresh the frame was captured on
+  uint32_t refresh;
+  // NEO_DIRTY_* flags and dirty blocks since the last render
+  uint32_t flags;
+  uint32_t dirty[NEO_DIRTY_MAP_SIZE];
+  // text cursor
+  uint32_t cursor_addr;
+  uint8_t cursor_start, cursor_end;
+  // cursor is in the visible half of its blink cycle
+  bool cursor_blink;
+  // scanline after which display restarts from the top of memory
+  uint32_t line_compare;
+  // pel panning is ignored below the line compare
+  bool pan_reset;
+  // 256 colour memory is chained, otherwise it is unchained (mode x)
+  bool chain4;
+  // crtc offset register, display memory per line in words
+  uint32_t line_offset;
+  // displayed lines after scan doubling
+  uint32_t lines;
+  // raster state ordered by line, the first entry starts at line 0
+  uint32_t num_raster;
+  struct neo_raster_t raster[NEO_RASTER_MAX];
+  // palette at the top of the frame and the changes made on the way down
+  uint32_t dac[NEO_DAC_SIZE];
+  uint32_t num_dac_log;
+  struct neo_dac_write_t dac_log[NEO_DAC_LOG_MAX];
+  // copy of vga_ram()
+  uint32_t vram[0x10000];
+  // copy of 0xB8000-0xBFFFF
+  uint8_t text[0x8000];
+};
+
+// frame.c
+bool neo_frame_init(void);
+// publish the display state, called by the emulator at vblank, returns
+// false if nothing on screen changed since the last capture
+bool neo_frame_capture(void);
+// called by the emulator before changing a display register part way
+// through a frame, so lines already scanned out keep the old state
+void neo_frame_split(void);
+// take the last published state for rendering, returns false if nothing
+// has been published since the last call
+bool neo_frame_acquire(void);
+// true while a published frame is still waiting to be acquired
+bool neo_frame_pending(void);
+// the frame being rendered
+const struct neo_frame_t *neo_frame(void);
+bool neo_frame_dirty_span(uint32_t addr, uint32_t size);
+// the frame has been drawn so clear its dirty state
+void neo_frame_rendered(void);
 
 // return video DAC data
 const uint32_t *neo_vga_dac(void);
@@ -48,6 +150,14 @@ void font_draw_glyph_8x16(
 void font_draw_glyph_8x16_gliss(
   uint32_t *dst, const uint32_t pitch, uint16_t ch, uint32_t rgb);
 
+// planar.c
+// decode `count` interleaved planar words (8 pixels each) to palette indices
+void planar_span_index(uint8_t *dst, const uint32_t *src, uint32_t count);
+// convert `count` palette indices to rgb via `pal`, writing each pixel
+// `scale` times horizontally
+void index_span_rgb(uint32_t *dst, const uint8_t *src, uint32_t count,
+                    const uint32_t *pal, uint32_t scale);
+
 // palette.c
 extern const uint32_t palette_cga_2_rgb[];
 extern const uint32_t palette_cga_3_rgb[];
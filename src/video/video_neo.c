@@ -21,6 +21,7 @@
 
 #include "../common/common.h"
 #include "../cpu/cpu.h"
+#include "video.h"
 
 // References:
 //   http://www.osdever.net/FreeVGA/vga/vgareg.htm
@@ -68,8 +69,19 @@ static uint8_t _active_page = 0;
 
 static bool _no_blanking = false;
 
-// 4x 64k memory planes
-static uint8_t _vga_ram[0x40000];
+// 4x 64k memory planes interleaved
+//
+// each 32bit word holds one byte from each plane at the same address, in the
+// same lane layout as the latch register, so a latch fill is a single load:
+// msb                                 lsb
+//   [plane 3] [plane 2] [plane 1] [plane 0]
+static uint32_t _vga_ram[0x10000];
+
+// video memory dirty bitmap, one bit per 16 byte block of 0xA0000-0xBFFFF
+uint32_t neo_dirty_map[NEO_DIRTY_MAP_SIZE];
+
+// display state dirty flags (NEO_DIRTY_*)
+static uint32_t _dirty_flags = NEO_DIRTY_MODE;
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 
@@ -77,6 +89,47 @@ bool is_non_blanking(void) {
   return _no_blanking;
 }
 
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// dirty tracking
+//
+// Writes to video memory mark 16 byte blocks in `neo_dirty_map` and register
+// writes raise `_dirty_flags`, so the renderer can skip scanlines (or entire
+// frames) that have not changed since the last time it ran.
+
+void neo_mark_dirty_span(uint32_t addr, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+  const uint32_t first = (addr - 0xA0000) >> 4;
+  const uint32_t last  = (addr + size - 1 - 0xA0000) >> 4;
+  for (uint32_t blk = first; blk <= last; ++blk) {
+    neo_dirty_map[blk >> 5] |= 1u << (blk & 31);
+  }
+}
+
+bool neo_dirty_span(uint32_t addr, uint32_t size) {
+  if (size == 0) {
+    return false;
+  }
+  const uint32_t first = (addr - 0xA0000) >> 4;
+  const uint32_t last  = (addr + size - 1 - 0xA0000) >> 4;
+  for (uint32_t blk = first; blk <= last; ++blk) {
+    if (neo_dirty_map[blk >> 5] & (1u << (blk & 31))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t neo_dirty_flags(void) {
+  return _dirty_flags;
+}
+
+void neo_dirty_clear(void) {
+  memset(neo_dirty_map, 0, sizeof(neo_dirty_map));
+  _dirty_flags = 0;
+}
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 
 // rotate right
@@ -87,13 +140,14 @@ static inline uint8_t _ror8(uint8_t in, uint8_t rot) {
 }
 
 // lower four bits to byte mask
-static uint32_t _make_mask(const uint8_t bits) {
-  uint32_t out;
-  out  = (bits & 0x1) ? 0x000000ff : 0;
-  out |= (bits & 0x2) ? 0x0000ff00 : 0;
-  out |= (bits & 0x4) ? 0x00ff0000 : 0;
-  out |= (bits & 0x8) ? 0xff000000 : 0;
-  return out;
+static inline uint32_t _make_mask(const uint8_t bits) {
+  static const uint32_t lut[16] = {
+    0x00000000, 0x000000ff, 0x0000ff00, 0x0000ffff,
+    0x00ff0000, 0x00ff00ff, 0x00ffff00, 0x00ffffff,
+    0xff000000, 0xff0000ff, 0xff00ff00, 0xff00ffff,
+    0xffff0000, 0xffff00ff, 0xffffff00, 0xffffffff,
+  };
+  return lut[bits & 0xf];
 }
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
@@ -176,7 +230,28 @@ static void _write_3d4_3d5(uint16_t portnum, uint8_t value) {
       log_printf(LOG_CHAN_VIDEO, "CRT_REG[%02x] = %02x", (int)crt_reg_addr, (int)value);
     }
 
+    // start address changes can happen mid frame
+    if (crt_reg_addr == 0xC || crt_reg_addr == 0xD) {
+      neo_frame_split();
+    }
     crt_register[crt_reg_addr] = value;
+
+    switch (crt_reg_addr) {
+    case 0xA: // cursor start
+    case 0xB: // cursor end
+    case 0xE: // cursor address hi
+    case 0xF: // cursor address lo
+      _dirty_flags |= NEO_DIRTY_CURSOR;
+      break;
+    case 0xC: // start address hi
+    case 0xD: // start address lo
+      // the renderer tracks where each line was fetched from so page
+      // flipping only redraws the lines that differ
+      break;
+    default:
+      _dirty_flags |= NEO_DIRTY_MODE;
+      break;
+    }
   } else {
     crt_reg_addr = value & 0x1f;
   }
@@ -232,6 +307,24 @@ static uint32_t _vga_plane_write_enable(void) {
   return _vga_seq_data[0x2] & 0x0f;
 }
 
+// chain 4 addressing, low two address bits select the plane
+// 0x3C4  04  ....*... lsb
+//
+static bool _vga_chain4(void) {
+  return (_vga_seq_data[0x4] & 0x08) != 0;
+}
+
+// odd/even write addressing, low address bit selects the plane pair
+// 0x3C4  04  .....*.. lsb  (set disables)
+//
+static bool _vga_odd_even_write(void) {
+  return (_vga_seq_data[0x4] & 0x04) == 0;
+}
+
+uint8_t neo_seq_register(uint32_t index) {
+  return _vga_seq_data[index & 0xff];
+}
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // VGA Graphics Controller - 3CE - 3CF
 
@@ -268,6 +361,13 @@ static uint32_t _vga_memory_map_select(void) {
   return (_vga_reg_data[0x6] >> 2) & 3;
 }
 
+// odd/even read addressing
+// 0x3CE  05  ...*.... lsb
+//
+static bool _vga_odd_even_read(void) {
+  return (_vga_reg_data[0x5] & 0x10) != 0;
+}
+
 // enable set/reset
 // 0x3CE  01  ....**** lsb
 //
@@ -316,6 +416,8 @@ static uint32_t _vga_bit_mask(void) {
   return _vga_reg_data[0x8];
 }
 
+static void _vga_update_write_state(void);
+
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // VGA DAC - 3C6H - 3C9H
 
@@ -362,6 +464,7 @@ static uint8_t _dac_data_read(void) {
 }
 
 static void _dac_data_write(const uint8_t val) {
+  neo_frame_split();
   switch (_dac_pal_write) {
   case 0:
     _dac_entry[_dac_mode_write] &= 0x00FFFF;
@@ -380,6 +483,7 @@ static void _dac_data_write(const uint8_t val) {
     ++_dac_mode_write;
     break;
   }
+  _dirty_flags |= NEO_DIRTY_PALETTE;
 }
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
@@ -400,6 +504,10 @@ const uint32_t *neo_ega_dac(void) {
   return _ega_dac;
 }
 
+uint8_t neo_attr_register(uint32_t index) {
+  return _ega_reg[index & 0x1f];
+}
+
 static uint32_t _ega_attr_to_rgb(const uint8_t value) {
   // `value` layout:   [msb]  ..rgbRGB  [lsb]
   //
@@ -420,11 +528,18 @@ static void _write_port_3c0(const uint8_t value) {
   if (_3c0_flipflop & 1) {
     // if this is a palette write
     if (_3c0_addr < 16) {
+      neo_frame_split();
       _ega_dac[_3c0_addr] = _ega_attr_to_rgb(value);
+      _dirty_flags |= NEO_DIRTY_PALETTE;
     }
     // other register
     else {
+      // pel panning may change mid frame
+      if (_3c0_addr == 0x13) {
+        neo_frame_split();
+      }
       _ega_reg[_3c0_addr] = value;
+      _dirty_flags |= NEO_DIRTY_MODE;
     }
   }
   // set address mode
@@ -480,11 +595,17 @@ static void ega_port_write(uint16_t portnum, uint8_t value) {
   case 0x3c5:
 //    printf("_vga_seq_data[0x%02x] = 0x%02x\n", _vga_seq_addr, value);
     _vga_seq_data[_vga_seq_addr] = value;
+    _vga_update_write_state();
+    // memory mode changes how the renderer walks video memory
+    if (_vga_seq_addr == 0x4) {
+      _dirty_flags |= NEO_DIRTY_MODE;
+    }
     break;
 
   case 0x3c6:
 //    printf("_vga_mask_reg = 0x%02x\n", value);
     _dac_mask_reg = value;
+    _dirty_flags |= NEO_DIRTY_PALETTE;
     break;
 
   case 0x3c7:
@@ -509,6 +630,7 @@ static void ega_port_write(uint16_t portnum, uint8_t value) {
     break;
   case 0x3cf:
     _vga_reg_data[_vga_reg_addr] = value;
+    _vga_update_write_state();
     break;
 
   default:
@@ -563,6 +685,7 @@ static void cga_port_write(uint16_t portnum, uint8_t value) {
       //  5     blink/intense
 
       _cga_control = value;
+      _dirty_flags |= NEO_DIRTY_MODE;
 
       switch (value) {
       case 0x2c:  // 40x25 text b&w
@@ -589,6 +712,7 @@ static void cga_port_write(uint16_t portnum, uint8_t value) {
       break;
     case 0x3d9:
       _cga_palette = value;
+      _dirty_flags |= NEO_DIRTY_PALETTE;
       break;
     default:
       if (NEO_VERBOSE) {
@@ -619,6 +743,42 @@ static void _clear_vga_buffer(void) {
   memset(_vga_ram, 0, sizeof(_vga_ram));
 }
 
+// reset the registers that move the display within video memory, the
+// video bios may not program them all for us
+static void _reset_display_start(void) {
+  // start address
+  crt_register[0x0C] = 0;
+  crt_register[0x0D] = 0;
+  // line compare disabled (0x3ff)
+  crt_register[0x18] = 0xff;
+  crt_register[0x07] |= 0x10;
+  crt_register[0x09] |= 0x40;
+  // pel panning
+  _ega_reg[0x13] = 0;
+}
+
+// program the memory addressing the bios would for mode `al`
+static void _reset_memory_mode(const uint8_t al) {
+  if (al <= 0x07) {
+    // odd/even
+    _vga_seq_data[0x4] = 0x02;
+    _vga_reg_data[0x5] = 0x10;
+  }
+  else if (al == 0x13) {
+    // chain 4 with 256 colour shift
+    _vga_seq_data[0x4] = 0x0e;
+    _vga_reg_data[0x5] = 0x40;
+  }
+  else {
+    // planar
+    _vga_seq_data[0x4] = 0x06;
+    _vga_reg_data[0x5] = 0x00;
+  }
+  // all planes enabled
+  _vga_seq_data[0x2] = 0x0f;
+  _vga_update_write_state();
+}
+
 static void neo_set_video_mode(uint8_t al) {
 
   log_printf(LOG_CHAN_VIDEO, "set video mode to %02Xh", (int)al);
@@ -668,7 +828,11 @@ static void neo_set_video_mode(uint8_t al) {
     _clear_vga_buffer();
   }
 
+  _reset_display_start();
+  _reset_memory_mode(al);
+
   _video_mode = al;
+  _dirty_flags |= NEO_DIRTY_MODE;
 }
 
 // BIOS int 10h Video Services handler
@@ -699,7 +863,11 @@ bool neo_init(void) {
   // it seems we should boot into video mode 3 by default
   // Landmark Diagnostic ROM expects it
   _video_mode = 3;
-  return true;
+  _reset_display_start();
+  // this also selects a write function for the reset register state
+  _reset_memory_mode(_video_mode);
+  // renderer hand over
+  return neo_frame_init();
 }
 
 int neo_get_video_mode(void) {
@@ -747,15 +915,32 @@ static uint8_t _neo_vga_read_1(uint32_t addr) {
   return m0 & m1 & m2 & m3 & _vga_colour_dont_care();
 }
 
+// address bits that select the plane for chain 4 (3) or odd/even (1) reads,
+// or 0xff for planar addressing
+static uint32_t _vga_read_plane;
+
+// chain 4 and odd/even reads take the plane from the address
+static uint8_t _neo_vga_read_chained(uint32_t addr) {
+  uint32_t plane = addr & _vga_read_plane;
+  if (_vga_read_plane == 1) {
+    // read map select still picks the plane pair
+    plane |= _vga_read_map_select() & 2;
+  }
+  _vga_latch = _vga_ram[addr & ~_vga_read_plane];
+  if (_vga_read_mode() == 1) {
+    return _neo_vga_read_1(addr);
+  }
+  return (uint8_t)(_vga_latch >> (plane * 8));
+}
+
 // EGA/VGA
 uint8_t neo_mem_read_A0000(uint32_t addr) {
   addr -= 0xA0000;
-  const uint32_t planesize = 0x10000;
+  if (_vga_read_plane != 0xff) {
+    return _neo_vga_read_chained(addr);
+  }
   // fill the latches
-  _vga_latch  = ((uint32_t)_vga_ram[addr + planesize * 0]) << 0;
-  _vga_latch |= ((uint32_t)_vga_ram[addr + planesize * 1]) << 8;
-  _vga_latch |= ((uint32_t)_vga_ram[addr + planesize * 2]) << 16;
-  _vga_latch |= ((uint32_t)_vga_ram[addr + planesize * 3]) << 24;
+  _vga_latch = _vga_ram[addr];
   // dispatch via read mode
   switch (_vga_read_mode()) {
   case 0: return _neo_vga_read_0(addr);
@@ -765,33 +950,112 @@ uint8_t neo_mem_read_A0000(uint32_t addr) {
   }
 }
 
-static void _neo_vga_write_planes(uint32_t addr, const uint32_t lanes) {
-
-  const uint32_t planesize = 0x10000;
-
-  if (_vga_plane_write_enable() & 0x01) {
-    _vga_ram[addr + planesize * 0] = (lanes >> 0) & 0xff;
+// EGA/VGA 16bit read
+// note: both bytes must fall inside of the A0000-AFFFF window
+uint16_t neo_mem_read_A0000_w(uint32_t addr) {
+  if (_vga_read_mode() == 0 && _vga_read_plane == 0xff) {
+    addr -= 0xA0000;
+    const uint32_t shift = _vga_read_map_select() * 8;
+    const uint16_t lo = (uint8_t)(_vga_ram[addr + 0] >> shift);
+    const uint16_t hi = (uint8_t)(_vga_ram[addr + 1] >> shift);
+    // latches hold the last byte read
+    _vga_latch = _vga_ram[addr + 1];
+    return lo | (hi << 8);
   }
-  if (_vga_plane_write_enable() & 0x02) {
-    _vga_ram[addr + planesize * 1] = (lanes >> 8) & 0xff;
+  else {
+    const uint16_t lo = neo_mem_read_A0000(addr + 0);
+    const uint16_t hi = neo_mem_read_A0000(addr + 1);
+    return lo | (hi << 8);
   }
-  if (_vga_plane_write_enable() & 0x04) {
-    _vga_ram[addr + planesize * 2] = (lanes >> 16) & 0xff;
+}
+
+// EGA/VGA block read
+// note: the span must fall inside of the A0000-AFFFF window
+void neo_mem_read_A0000_block(uint8_t *dst, uint32_t addr, uint32_t size) {
+  if (_vga_read_mode() == 0 && _vga_read_plane == 0xff) {
+    addr -= 0xA0000;
+    assert((addr + size) <= 0x10000);
+    const uint32_t shift = _vga_read_map_select() * 8;
+    for (uint32_t i = 0; i < size; ++i) {
+      dst[i] = (uint8_t)(_vga_ram[addr + i] >> shift);
+    }
+    // latches hold the last byte read
+    if (size) {
+      _vga_latch = _vga_ram[addr + size - 1];
+    }
   }
-  if (_vga_plane_write_enable() & 0x08) {
-    _vga_ram[addr + planesize * 3] = (lanes >> 24) & 0xff;
+  else {
+    for (uint32_t i = 0; i < size; ++i) {
+      dst[i] = neo_mem_read_A0000(addr + i);
+    }
   }
 }
 
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// VGA write pipeline
+//
+// The graphics controller and map mask registers are decoded when they are
+// written rather than for every byte written to video memory.  The decoded
+// state selects a write function specialised for the current write mode and
+// logic operation, so the per byte path is a single indirect call.
+
+typedef void (*vga_write_t)(uint32_t addr, uint8_t value);
+
+struct vga_write_state_t {
+  // write function for the current register state
+  vga_write_t write;
+  // pipeline behind `write` when chain 4 or odd/even addressing is in use
+  vga_write_t pipe;
+  // map mask register as lane mask
+  uint32_t map_mask;
+  // lanes written by the current byte
+  uint32_t plane_mask;
+  // bit mask register broadcast to all lanes
+  uint32_t bit_mask;
+  // lanes to take from set/reset rather then the input byte
+  uint32_t sr_mask;
+  // set/reset value for lanes in sr_mask (write mode 0)
+  uint32_t sr_fill;
+  // set/reset value expanded to all lanes (write mode 3)
+  uint32_t sr_value;
+  // data rotate count
+  uint8_t rot_count;
+};
+
+static void _neo_vga_write_0_fast(uint32_t addr, uint8_t value);
+
+// plain writes to all planes until the registers are first programmed, so
+// there is always a write function to call
+static struct vga_write_state_t _vga_wr = {
+  .write      = _neo_vga_write_0_fast,
+  .pipe       = _neo_vga_write_0_fast,
+  .map_mask   = ~0u,
+  .plane_mask = ~0u,
+  .bit_mask   = ~0u,
+};
+
 static inline uint32_t _broadcast(const uint8_t val) {
-  return (val << 24) | (val << 16) | (val << 8) | val;
+  return 0x01010101u * val;
 }
 
-static void _neo_vga_write_alu(uint32_t addr, uint32_t input) {
+static inline void _neo_vga_write_planes(uint32_t addr, const uint32_t lanes) {
+  // only lanes for write enabled planes get updated
+  const uint32_t mask = _vga_wr.plane_mask;
+  const uint32_t old = _vga_ram[addr];
+  const uint32_t val = (old & ~mask) | (lanes & mask);
+  if (val != old) {
+    _vga_ram[addr] = val;
+    neo_mark_dirty(0xA0000 + addr);
+  }
+}
 
+// alu operation and bit mask mux
+// note: `op` is always a constant so each caller gets its own alu
+static inline void _neo_vga_write_alu(uint32_t addr, uint32_t input,
+                                      const uint32_t op) {
   // alu operations
   uint32_t tmp1;
-  switch (_vga_logic_op()) {
+  switch (op) {
   case 0: tmp1 = input;              break;
   case 1: tmp1 = input & _vga_latch; break;
   case 2: tmp1 = input | _vga_latch; break;
@@ -801,33 +1065,47 @@ static void _neo_vga_write_alu(uint32_t addr, uint32_t input) {
   }
 
   // mux between tmp0 or alu results
-  // todo: precompute this
-  const uint32_t bm_mux = _broadcast(_vga_bit_mask());
-  uint32_t tmp2 = (tmp1 & bm_mux) | (_vga_latch & ~bm_mux);
+  const uint32_t bm_mux = _vga_wr.bit_mask;
+  const uint32_t tmp2 = (tmp1 & bm_mux) | (_vga_latch & ~bm_mux);
 
   // write data to planes
   _neo_vga_write_planes(addr, tmp2);
 }
 
 // 00 = Write Mode 0
-static void _neo_vga_write_0(uint32_t addr, uint8_t value) {
+static inline void _neo_vga_write_0(uint32_t addr, uint8_t value,
+                                    const uint32_t op) {
 
-  value = _ror8(value, _vga_rot_count());
-  
-  // 4 lanes of input bytes
-  uint32_t path = (value << 24) | (value << 16) | (value << 8) | value;
-  // 4 lanes on input bits from s/r value
-  uint32_t srvl = _vga_sr_value() ? 0 : ~0u;
+  value = _ror8(value, _vga_wr.rot_count);
 
-  // mask to mux between bytes or s/r value
-  // todo: precompute this
-  const uint8_t sr_reg = _vga_sr_enable();
-  uint32_t sr_mask = ~_make_mask(sr_reg);
+  // 4 lanes of input bytes
+  const uint32_t path = _broadcast(value);
 
   // mux between byte inputs or s/r value
-  uint32_t tmp0 = (path & sr_mask) | (srvl & ~sr_mask);
+  const uint32_t tmp0 = (path & ~_vga_wr.sr_mask) | _vga_wr.sr_fill;
+
+  _neo_vga_write_alu(addr, tmp0, op);
+}
+
+static void _neo_vga_write_0_mov(uint32_t addr, uint8_t value) {
+  _neo_vga_write_0(addr, value, 0);
+}
 
-  _neo_vga_write_alu(addr, tmp0);
+static void _neo_vga_write_0_and(uint32_t addr, uint8_t value) {
+  _neo_vga_write_0(addr, value, 1);
+}
+
+static void _neo_vga_write_0_or(uint32_t addr, uint8_t value) {
+  _neo_vga_write_0(addr, value, 2);
+}
+
+static void _neo_vga_write_0_xor(uint32_t addr, uint8_t value) {
+  _neo_vga_write_0(addr, value, 3);
+}
+
+// Write Mode 0 with no rotate, set/reset, logic op or bit mask
+static void _neo_vga_write_0_fast(uint32_t addr, uint8_t value) {
+  _neo_vga_write_planes(addr, _broadcast(value));
 }
 
 // 01 = Write Mode 1
@@ -836,13 +1114,30 @@ static void _neo_vga_write_1(uint32_t addr, uint8_t value) {
 }
 
 // 10 = Write Mode 2
-static void _neo_vga_write_2(uint32_t addr, uint8_t value) {
+static inline void _neo_vga_write_2(uint32_t addr, uint8_t value,
+                                    const uint32_t op) {
   //see: https://www.phatcode.net/res/224/files/html/ch27/27-01.html
 
   //XXX: called by INDY
 
   const uint32_t mask = _make_mask(value);
-  _neo_vga_write_alu(addr, mask);
+  _neo_vga_write_alu(addr, mask, op);
+}
+
+static void _neo_vga_write_2_mov(uint32_t addr, uint8_t value) {
+  _neo_vga_write_2(addr, value, 0);
+}
+
+static void _neo_vga_write_2_and(uint32_t addr, uint8_t value) {
+  _neo_vga_write_2(addr, value, 1);
+}
+
+static void _neo_vga_write_2_or(uint32_t addr, uint8_t value) {
+  _neo_vga_write_2(addr, value, 2);
+}
+
+static void _neo_vga_write_2_xor(uint32_t addr, uint8_t value) {
+  _neo_vga_write_2(addr, value, 3);
 }
 
 // 11 = Write Mode 3
@@ -851,7 +1146,7 @@ static void _neo_vga_write_3(uint32_t addr, uint8_t value) {
   // https://wiki.osdev.org/VGA_Hardware - write mode 3
 
   // rotate input bits
-  value = _ror8(value, _vga_rot_count());
+  value = _ror8(value, _vga_wr.rot_count);
 
   //TODO: verify this please
   //XXX: not just AND, use function select register bits 3-4 for func
@@ -859,41 +1154,158 @@ static void _neo_vga_write_3(uint32_t addr, uint8_t value) {
 
   // The resulting value is ANDed with the Bit Mask Register, resulting in the
   // bit mask to be applied
-  uint8_t tmp0 = _vga_bit_mask() & value;
+  const uint8_t tmp0 = (uint8_t)_vga_wr.bit_mask & value;
 
   // Each plane takes one bit from the Set/Reset Value register, and turns it
   // into either 0x00 (if set) or 0xff (if clear) 
-  uint32_t srvl = _vga_sr_value() ? 0 : ~0u;
+  const uint32_t srvl = _vga_wr.sr_value;
 
   // The computed bit mask is checked, for each set bit the corresponding bit
   // from the set/reset logic is forwarded. If the bit is clear the bit is taken
   // directly from the Latch
-  uint32_t switcher = _make_mask(tmp0);
-  uint32_t tmp1 = (srvl & switcher) | (_vga_latch & ~switcher );
+  const uint32_t switcher = _make_mask(tmp0);
+  const uint32_t tmp1 = (srvl & switcher) | (_vga_latch & ~switcher);
 
   // The result is sent towards memory
   _neo_vga_write_planes(addr, tmp1);
 }
 
-// EGA/VGA
-void neo_mem_write_A0000(uint32_t addr, uint8_t value) {
+// chain 4 writes go to the plane selected by the low two address bits
+static void _neo_vga_write_chain4(uint32_t addr, uint8_t value) {
+  _vga_wr.plane_mask = _vga_wr.map_mask & (0xffu << ((addr & 3) * 8));
+  _vga_wr.pipe(addr & ~3u, value);
+}
 
-  addr -= 0xA0000;
+// odd/even writes go to planes 0 and 2 for even addresses, 1 and 3 for odd
+static void _neo_vga_write_odd_even(uint32_t addr, uint8_t value) {
+  _vga_wr.plane_mask = _vga_wr.map_mask & (0x00ff00ffu << ((addr & 1) * 8));
+  _vga_wr.pipe(addr & ~1u, value);
+}
+
+// rebuild the write pipeline after a register change
+static void _vga_update_write_state(void) {
+
+  static const vga_write_t mode_0[] = {
+    _neo_vga_write_0_mov, _neo_vga_write_0_and,
+    _neo_vga_write_0_or,  _neo_vga_write_0_xor,
+  };
+  static const vga_write_t mode_2[] = {
+    _neo_vga_write_2_mov, _neo_vga_write_2_and,
+    _neo_vga_write_2_or,  _neo_vga_write_2_xor,
+  };
+
+  struct vga_write_state_t *wr = &_vga_wr;
+
+  wr->map_mask   = _make_mask(_vga_plane_write_enable());
+  wr->plane_mask = wr->map_mask;
+  wr->bit_mask   = _broadcast(_vga_bit_mask());
+  wr->rot_count  = _vga_rot_count();
+  wr->sr_mask    = _make_mask(_vga_sr_enable());
+  wr->sr_value   = _vga_sr_value() ? 0 : ~0u;
+  wr->sr_fill    = wr->sr_value & wr->sr_mask;
+
+  const uint32_t op = _vga_logic_op();
 
   switch (_vga_write_mode()) {
-  case 0: _neo_vga_write_0(addr, value); break;
-  case 1: _neo_vga_write_1(addr, value); break;
-  case 2: _neo_vga_write_2(addr, value); break;
-  case 3: _neo_vga_write_3(addr, value); break;
+  case 0:
+    if (op == 0 && wr->rot_count == 0 && wr->sr_mask == 0 &&
+        wr->bit_mask == ~0u) {
+      wr->write = _neo_vga_write_0_fast;
+    }
+    else {
+      wr->write = mode_0[op];
+    }
+    break;
+  case 1: wr->write = _neo_vga_write_1;    break;
+  case 2: wr->write = mode_2[op];          break;
+  case 3: wr->write = _neo_vga_write_3;    break;
   default:
     UNREACHABLE();
   }
+
+  // the address decides the plane before the pipeline sees the write
+  if (_vga_chain4()) {
+    wr->pipe  = wr->write;
+    wr->write = _neo_vga_write_chain4;
+  }
+  else if (_vga_odd_even_write()) {
+    wr->pipe  = wr->write;
+    wr->write = _neo_vga_write_odd_even;
+  }
+
+  // reads are addressed the same way
+  if (_vga_chain4()) {
+    _vga_read_plane = 3;
+  }
+  else if (_vga_odd_even_read()) {
+    _vga_read_plane = 1;
+  }
+  else {
+    _vga_read_plane = 0xff;
+  }
+}
+
+// EGA/VGA
+void neo_mem_write_A0000(uint32_t addr, uint8_t value) {
+  _vga_wr.write(addr - 0xA0000, value);
+}
+
+// EGA/VGA 16bit write
+// note: both bytes must fall inside of the A0000-AFFFF window
+void neo_mem_write_A0000_w(uint32_t addr, uint16_t value) {
+  addr -= 0xA0000;
+  const vga_write_t write = _vga_wr.write;
+  write(addr + 0, (uint8_t)(value >> 0));
+  write(addr + 1, (uint8_t)(value >> 8));
+}
+
+// EGA/VGA block write
+// note: the span must fall inside of the A0000-AFFFF window
+void neo_mem_write_A0000_block(uint32_t addr, const uint8_t *src,
+                               uint32_t size) {
+  addr -= 0xA0000;
+  assert((addr + size) <= 0x10000);
+  const vga_write_t write = _vga_wr.write;
+  if (write == _neo_vga_write_0_fast) {
+    // no need to go through the pipeline for plain stores
+    for (uint32_t i = 0; i < size; ++i) {
+      _neo_vga_write_planes(addr + i, _broadcast(src[i]));
+    }
+  }
+  else {
+    for (uint32_t i = 0; i < size; ++i) {
+      write(addr + i, src[i]);
+    }
+  }
 }
 
-const uint8_t *vga_ram(void) {
+const uint32_t *vga_ram(void) {
   return _vga_ram;
 }
 
+// save states keep display memory one plane after another, as it was
+// stored before the planes were interleaved, so older states still load
+static uint8_t _vga_plane[0x10000];
+
+static void _vga_ram_save(FILE *fd) {
+  for (uint32_t p = 0; p < 4; ++p) {
+    for (uint32_t i = 0; i < 0x10000; ++i) {
+      _vga_plane[i] = (uint8_t)(_vga_ram[i] >> (p * 8));
+    }
+    fwrite(_vga_plane, 1, sizeof(_vga_plane), fd);
+  }
+}
+
+static void _vga_ram_load(FILE *fd) {
+  memset(_vga_ram, 0, sizeof(_vga_ram));
+  for (uint32_t p = 0; p < 4; ++p) {
+    fread(_vga_plane, 1, sizeof(_vga_plane), fd);
+    for (uint32_t i = 0; i < 0x10000; ++i) {
+      _vga_ram[i] |= (uint32_t)_vga_plane[i] << (p * 8);
+    }
+  }
+}
+
 void neo_state_save(FILE *fd) {
   fwrite(&_video_mode, 1, sizeof(_video_mode), fd);
   fwrite(&_system, 1, sizeof(_system), fd);
@@ -905,7 +1317,7 @@ void neo_state_save(FILE *fd) {
   fwrite(&_base, 1, sizeof(_base), fd);
   fwrite(&_active_page, 1, sizeof(_active_page), fd);
   fwrite(&_no_blanking, 1, sizeof(_no_blanking), fd);
-  fwrite(_vga_ram, 1, sizeof(_vga_ram), fd);
+  _vga_ram_save(fd);
 
   fwrite(&crt_reg_addr, 1, sizeof(crt_reg_addr), fd);
   fwrite(crt_register, 1, sizeof(crt_register), fd);
@@ -950,7 +1362,7 @@ void neo_state_load(FILE *fd) {
   fread(&_base, 1, sizeof(_base), fd);
   fread(&_active_page, 1, sizeof(_active_page), fd);
   fread(&_no_blanking, 1, sizeof(_no_blanking), fd);
-  fread(_vga_ram, 1, sizeof(_vga_ram), fd);
+  _vga_ram_load(fd);
 
   fread(&crt_reg_addr, 1, sizeof(crt_reg_addr), fd);
   fread(crt_register, 1, sizeof(crt_register), fd);
@@ -982,4 +1394,7 @@ void neo_state_load(FILE *fd) {
   fread(&_cga_palette, 1, sizeof(_cga_palette), fd);
 
   fread(&_vga_latch, 1, sizeof(_vga_latch), fd);
+
+  _vga_update_write_state();
+  _dirty_flags |= NEO_DIRTY_MODE | NEO_DIRTY_PALETTE;
 }